@@ -9,6 +9,7 @@
 #include <stdlib.h>		// for size_t
 #include <inttypes.h>	// for uint16_t
 #include <string.h>
+#include <stdbool.h>
 
 // components of F19FS
 typedef struct inode inode_t;
@@ -18,7 +19,7 @@ typedef struct directoryFile directoryFile_t;
 typedef struct F19FS F19FS_t;
 
 // seek_t is for fs_seek
-typedef enum { FS_SEEK_SET, FS_SEEK_CUR, FS_SEEK_END } seek_t;
+typedef enum { FS_SEEK_SET, FS_SEEK_CUR, FS_SEEK_END, FS_SEEK_DATA, FS_SEEK_HOLE } seek_t;
 
 typedef enum { FS_REGULAR, FS_DIRECTORY } file_t;
 
@@ -32,6 +33,90 @@ typedef struct {
     file_t type;
 } file_record_t;
 
+// fs_opendir handle, see fs_readdir and fs_openat
+typedef struct fs_dir fs_dir_t;
+
+// attributes of a file, see fs_stat and fs_readdirplus
+typedef struct {
+    file_t type;
+    size_t inode;        // inode number
+    size_t size;         // bytes, write-back data not yet on the device included
+    size_t links;        // directory entries naming the file
+    size_t blocks;       // blocks the file holds on the device, pointer blocks included
+    uint32_t generation; // tells this file from a later one in the same inode, see fs_handle_t
+} fs_stat_t;
+
+// usage of a volume, see fs_statfs
+typedef struct {
+    size_t block_size;   // bytes per block
+    size_t total_blocks; // blocks the free block bitmap covers, metadata blocks included
+    size_t free_blocks;  // not in use and not promised to write-back data
+    size_t total_inodes;
+    size_t free_inodes;
+    size_t name_max;     // longest file name, terminator excluded
+} fs_statfs_t;
+
+// a directory entry with the attributes of the file it names, see fs_readdirplus
+typedef struct {
+    char name[FS_FNAME_MAX];
+    fs_stat_t stat;
+} file_record_plus_t;
+
+// names a file by inode and generation, stays valid across renames and remounts until the file is removed
+typedef struct {
+    uint32_t inode;
+    uint32_t generation;
+} fs_handle_t;
+
+// fs_op_t is for fs_submit
+typedef enum { FS_OP_READ, FS_OP_WRITE, FS_OP_CREATE, FS_OP_REMOVE } fs_op_t;
+
+// Slots shared by the submission and completion rings
+#define FS_QUEUE_DEPTH (1024)
+// Threads started on the first fs_submit of a mounted volume
+#define FS_QUEUE_WORKERS (4)
+
+// fs_advice_t is for fs_advise
+typedef enum { FS_ADV_NORMAL, FS_ADV_SEQUENTIAL, FS_ADV_RANDOM, FS_ADV_WILLNEED, FS_ADV_DONTNEED } fs_advice_t;
+
+// Blocks prefetched past a sequential reader, the window starts at FS_READAHEAD_MIN and doubles
+#define FS_READAHEAD_MIN (4)
+#define FS_READAHEAD_MAX (128)
+
+// Dirty blocks the write-back page cache holds, across all files, before it flushes
+#define FS_PAGE_CACHE_PAGES (4096)
+
+typedef struct {
+    fs_op_t op;
+    int fd;              // FS_OP_READ, FS_OP_WRITE
+    void *buf;           // destination of a read, source of a write
+    size_t nbyte;        // FS_OP_READ, FS_OP_WRITE
+    const char *path;    // FS_OP_CREATE, FS_OP_REMOVE
+    file_t type;         // FS_OP_CREATE
+    uint64_t user_data;  // handed back untouched in the completion
+} fs_request_t;
+
+typedef struct {
+    uint64_t user_data;
+    ssize_t result;      // what the synchronous call would have returned
+} fs_completion_t;
+
+// fs_format_ex flags
+#define FS_FORMAT_IN_PLACE  (0x1)   // reuse an existing volume file, zero the inode table as it gets used
+#define FS_FORMAT_JOURNAL   (0x2)   // reserve a metadata journal (1 MiB) so a crash never leaves half an operation
+#define FS_FORMAT_SPARSE    (0x4)   // let descriptors seek past EOF, skipped ranges become holes
+
+// fs_mount_ex flags
+#define FS_MOUNT_POPULATE   (0x1)   // prefault the whole volume at mount
+#define FS_MOUNT_HUGEPAGE   (0x2)   // back the mapping with transparent huge pages where possible
+#define FS_MOUNT_MLOCK_META (0x4)   // keep bitmaps, inode table and directory blocks resident
+
+// fs_open2 flags
+#define FS_OPEN_CREATE      (0x1)   // create the file if it does not exist
+#define FS_OPEN_EXCL        (0x2)   // with FS_OPEN_CREATE, fail if the file exists
+#define FS_OPEN_TRUNC       (0x4)   // cut the file to 0 bytes
+#define FS_OPEN_APPEND      (0x8)   // every write goes to the end of file, wherever the position was
+
 ///
 /// Formats (and mounts) an F19FS file for use
 /// \param fname The file to format
@@ -39,6 +124,19 @@ typedef struct {
 ///
 F19FS_t *fs_format(const char *path);
 
+///
+/// Formats (and mounts) an F19FS file with format options
+///   Only the bitmaps, the root inode and the superblock are written,
+///   unused blocks stay holes in the file
+///   FS_FORMAT_IN_PLACE keeps an existing volume file instead of recreating it,
+///   its data blocks are punched out and inode table blocks are zeroed on first use
+///   FS_FORMAT_SPARSE allows seeking past EOF, a write there leaves a hole that takes no blocks
+/// \param path The file to format
+/// \param flags Bitwise or of FS_FORMAT_* flags, 0 behaves like fs_format
+/// \return Mounted F19FS object, NULL on error
+///
+F19FS_t *fs_format_ex(const char *path, unsigned flags);
+
 ///
 /// Mounts an F19FS object and prepares it for use
 /// \param fname The file to mount
@@ -48,6 +146,16 @@ F19FS_t *fs_format(const char *path);
 ///
 F19FS_t *fs_mount(const char *path);
 
+///
+/// Mounts an F19FS object with mount options
+///   FS_MOUNT_POPULATE and FS_MOUNT_HUGEPAGE are hints the kernel may ignore,
+///   FS_MOUNT_MLOCK_META fails the mount when the metadata cannot be locked
+/// \param path The file to mount
+/// \param flags Bitwise or of FS_MOUNT_* flags, 0 behaves like fs_mount
+/// \return Mounted F19FS object, NULL on error
+///
+F19FS_t *fs_mount_ex(const char *path, unsigned flags);
+
 ///
 /// Unmounts the given object and frees all related resources
 /// \param fs The F19FS object to unmount
@@ -75,6 +183,18 @@ int fs_create(F19FS_t *fs, const char *path, file_t type);
 ///
 int fs_open(F19FS_t *fs, const char *path);
 
+///
+/// Opens the specified file for use, creating or truncating it in the same path walk
+///   R/W position is set to the beginning of the file (BOF)
+///   Directories cannot be opened
+/// \param fs The F19FS containing the file
+/// \param path Absolute path to the file
+/// \param flags Bitwise or of FS_OPEN_* flags, 0 behaves like fs_open
+/// \return file descriptor to the file, -2 if it does not exist, -3 if it exists and
+///   FS_OPEN_CREATE | FS_OPEN_EXCL was given, other < 0 on error
+///
+int fs_open2(F19FS_t *fs, const char *path, unsigned flags);
+
 ///
 /// Closes the given file descriptor
 /// \param fs The F19FS containing the file
@@ -87,6 +207,10 @@ int fs_close(F19FS_t *fs, int fd);
 /// Moves the R/W position of the given descriptor to the given location
 ///   Files cannot be seeked past EOF or before BOF (beginning of file)
 ///   Seeking past EOF will seek to EOF, seeking before BOF will seek to BOF
+///   On volumes formatted with FS_FORMAT_SPARSE seeking past EOF is allowed
+///   FS_SEEK_DATA and FS_SEEK_HOLE move to the first data or hole at or after offset,
+///   EOF counts as a hole; an offset at or past EOF (or no data after it) is an error
+///   Holes read as zeros
 /// \param fs The F19FS containing the file
 /// \param fd The descriptor to seek
 /// \param offset Desired offset relative to whence
@@ -120,6 +244,108 @@ ssize_t fs_read(F19FS_t *fs, int fd, void *dst, size_t nbyte);
 ///
 ssize_t fs_write(F19FS_t *fs, int fd, const void *src, size_t nbyte);
 
+///
+/// Sets the size of the file behind the descriptor
+///   Shrinking frees the blocks past the new end (and pointer blocks left empty) in runs,
+///   growing leaves a hole that reads as zeros; staged write-back data is written first
+/// \param fs The F19FS containing the file
+/// \param fd The descriptor of the file
+/// \param size The new size in bytes
+/// \return 0 on success, < 0 on error
+///
+int fs_ftruncate(F19FS_t *fs, int fd, off_t size);
+
+///
+/// Sets the size of the file at path, see fs_ftruncate
+/// \param fs The F19FS containing the file
+/// \param path Absolute path to the file
+/// \param size The new size in bytes
+/// \return 0 on success, < 0 on error
+///
+int fs_truncate(F19FS_t *fs, const char *path, off_t size);
+
+///
+/// Backs every hole in [offset, offset + len) of the file with zeroed blocks, growing it if needed
+///   Blocks are taken in contiguous runs; when they can't all be had none are taken
+/// \param fs The F19FS containing the file
+/// \param fd The descriptor of the file
+/// \param offset First byte of the range
+/// \param len Length of the range, > 0
+/// \return 0 on success, < 0 on error (-5 when the volume is out of blocks)
+///
+int fs_fallocate(F19FS_t *fs, int fd, off_t offset, off_t len);
+
+///
+/// Switches a descriptor between write-through and write-back
+///   Write-back descriptors stage writes in memory and only allocate blocks
+///   on fs_fsync, fs_close, fs_unmount or when FS_PAGE_CACHE_PAGES is reached,
+///   so the allocator can hand out contiguous runs and files removed before
+///   then never touch the device
+///   Switching back to write-through flushes the staged data
+/// \param fs The F19FS containing the file
+/// \param fd The descriptor to change
+/// \param buffered true for write-back, false for write-through
+/// \return 0 on success, < 0 on error
+///
+int fs_set_buffered(F19FS_t *fs, int fd, bool buffered);
+
+///
+/// Writes the file behind the descriptor to stable storage
+///   Staged data is written to the device, then only the dirty blocks of the file,
+///   its inode table block and the bitmaps are synced, in one msync per run of neighbours
+///   On a journaled volume this also makes every metadata change committed so far durable,
+///   concurrent callers share one flush of the journal
+/// \param fs The F19FS containing the file
+/// \param fd The descriptor of the file
+/// \return 0 on success, < 0 on error
+///
+int fs_fsync(F19FS_t *fs, int fd);
+
+///
+/// Writes every file of the volume to stable storage
+///   Only the blocks changed since they were last synced are written
+/// \param fs The F19FS to sync
+/// \return 0 on success, < 0 on error
+///
+int fs_sync(F19FS_t *fs);
+
+///
+/// Streams a snapshot of the volume, written back data included
+///   A full snapshot holds only the blocks in use, a delta only the blocks written since
+///   the snapshot named by base, so backups scale with live or changed data
+///   Generations are only valid until the volume is unmounted
+/// \param fs The F19FS to snapshot
+/// \param fd File, pipe or socket to write the snapshot to
+/// \param base Generation of an earlier snapshot of this mount for a delta, 0 for a full snapshot
+/// \param generation Receives the generation of this snapshot, may be NULL
+/// \return Number of bytes written, < 0 on error or when base is unknown
+///
+ssize_t fs_snapshot(F19FS_t *fs, int fd, uint64_t base, uint64_t *generation);
+
+///
+/// Restores a volume from a device image or a snapshot and mounts it
+///   Images are cloned or copied range by range in the kernel, snapshots only write
+///   the blocks they hold; a delta snapshot is applied on top of the volume at path
+/// \param source The image or snapshot file
+/// \param path The volume file to restore to
+/// \return Mounted F19FS object, NULL on error
+///
+F19FS_t *fs_restore(const char *source, const char *path);
+
+///
+/// Tells the volume how the file behind a descriptor is going to be read
+///   FS_ADV_NORMAL, FS_ADV_SEQUENTIAL and FS_ADV_RANDOM stick to the descriptor
+///   and set the read-ahead window (sequential: largest, random: none)
+///   FS_ADV_WILLNEED prefetches the range, FS_ADV_DONTNEED lets it be evicted
+/// \param fs The F19FS containing the file
+/// \param fd The descriptor of the file
+/// \param offset Start of the range, from BOF
+/// \param len Length of the range, 0 for up to EOF
+/// \param advice The expected access pattern
+/// \return 0 on success, < 0 on error
+///
+int fs_advise(F19FS_t *fs, int fd, off_t offset, size_t len, fs_advice_t advice);
+
 ///
 /// Deletes the specified file and closes all open descriptors to the file
 ///   Directories can only be removed when empty
@@ -129,15 +355,180 @@ ssize_t fs_write(F19FS_t *fs, int fd, const void *src, size_t nbyte);
 ///
 int fs_remove(F19FS_t *fs, const char *path);
 
+///
+/// Creates every name in names inside the directory dir
+///   The directory is resolved, read and written back once for the whole batch; a name
+///   holding a '/' is a path relative to dir and is created in its own parent on its own
+/// \param fs The F19FS containing the directory
+/// \param dir Absolute path to the parent directory
+/// \param names File names, or paths relative to dir, to create
+/// \param count Number of names
+/// \param type Type of the files to create (regular/directory)
+/// \param results Optional, receives 0 or < 0 for each name
+/// \return number of files created, < 0 on error
+///
+int fs_create_many(F19FS_t *fs, const char *dir, const char *const *names, size_t count, file_t type, int *results);
+
+///
+/// Removes every name in names from the directory dir
+///   The directory is resolved, read and written back once for the whole batch
+///   Directories can only be removed when empty; a name holding a '/' is a path relative
+///   to dir and is removed from its own parent on its own
+/// \param fs The F19FS containing the directory
+/// \param dir Absolute path to the parent directory
+/// \param names File names, or paths relative to dir, to remove
+/// \param count Number of names
+/// \param results Optional, receives 0 or < 0 for each name
+/// \return number of files removed, < 0 on error
+///
+int fs_remove_many(F19FS_t *fs, const char *dir, const char *const *names, size_t count, int *results);
+
 ///
 /// Populates a dyn_array with information about the files in a directory
-///   Array contains up to 15 file_record_t structures
+///   Array contains up to 31 file_record_t structures, in the order fs_readdir yields them
 /// \param fs The F19FS containing the file
 /// \param path Absolute path to the directory to inspect
 /// \return dyn_array of file records, NULL on error
 ///
 dyn_array_t *fs_get_dir(F19FS_t *fs, const char *path);
 
+///
+/// Opens a directory for listing with fs_readdir
+///   The path is resolved in place, entries are read one at a time as they are asked for
+/// \param fs The F19FS containing the directory
+/// \param path Absolute path to the directory
+/// \return The directory handle, NULL on error
+///
+fs_dir_t *fs_opendir(F19FS_t *fs, const char *path);
+
+///
+/// Reads the next entry of an open directory
+///   Nothing is allocated; entries created or removed behind the position show up or vanish,
+///   entries ahead of it are never repeated
+/// \param dir The directory handle
+/// \param record Receives the name and type of the entry
+/// \return 1 when record was filled, 0 at the end of the directory, < 0 on error (-2 once the directory was removed)
+///
+int fs_readdir(fs_dir_t *dir, file_record_t *record);
+
+///
+/// Reads the next entry of an open directory together with the attributes of its file
+///   Same order and cookies as fs_readdir; the inode of the following entry is prefetched
+/// \param dir The directory handle
+/// \param record Receives the name and attributes of the entry
+/// \return 1 when record was filled, 0 at the end of the directory, < 0 on error
+///
+int fs_readdirplus(fs_dir_t *dir, file_record_plus_t *record);
+
+///
+/// Populates a dyn_array with the files in a directory and their attributes, in one pass
+///   Array contains up to 31 file_record_plus_t structures, in the order fs_readdirplus yields them
+/// \param fs The F19FS containing the directory
+/// \param path Absolute path to the directory to inspect
+/// \return dyn_array of file records with attributes, NULL on error
+///
+dyn_array_t *fs_get_dir_plus(F19FS_t *fs, const char *path);
+
+///
+/// Reports the attributes of the file at path without opening it
+/// \param fs The F19FS containing the file
+/// \param path Absolute path to the file or directory
+/// \param stat Receives the attributes
+/// \return 0 on success, < 0 on error
+///
+int fs_stat(F19FS_t *fs, const char *path, fs_stat_t *stat);
+
+///
+/// Reports the attributes of the file behind a descriptor
+/// \param fs The F19FS containing the file
+/// \param fd The descriptor of the file
+/// \param stat Receives the attributes
+/// \return 0 on success, < 0 on error
+///
+int fs_fstat(F19FS_t *fs, int fd, fs_stat_t *stat);
+
+///
+/// Reports block and inode usage of the volume
+///   Served from counters kept as blocks and inodes are taken and freed, the bitmaps are not recounted
+/// \param fs The F19FS to inspect
+/// \param stat Receives the usage
+/// \return 0 on success, < 0 on error
+///
+int fs_statfs(F19FS_t *fs, fs_statfs_t *stat);
+
+///
+/// Makes a handle for the file at path that can be cached in place of the path
+/// \param fs The F19FS containing the file
+/// \param path Absolute path to the file or directory
+/// \param handle Receives the handle
+/// \return 0 on success, < 0 on error
+///
+int fs_get_handle(F19FS_t *fs, const char *path, fs_handle_t *handle);
+
+///
+/// Opens the regular file a handle names, no path is resolved
+/// \param fs The F19FS containing the file
+/// \param handle Handle from fs_get_handle or the inode and generation fs_stat reported
+/// \return The file descriptor, -2 if the file was removed since, other < 0 on error
+///
+int fs_open_by_handle(F19FS_t *fs, const fs_handle_t *handle);
+
+///
+/// Reports the attributes of the file a handle names, no path is resolved
+/// \param fs The F19FS containing the file
+/// \param handle Handle from fs_get_handle or the inode and generation fs_stat reported
+/// \param stat Receives the attributes
+/// \return 0 on success, -2 if the file was removed since, other < 0 on error
+///
+int fs_stat_by_handle(F19FS_t *fs, const fs_handle_t *handle, fs_stat_t *stat);
+
+///
+/// Opens a regular file relative to an open directory, the directory's own path is not resolved again
+/// \param dir The directory handle from fs_opendir
+/// \param path Path relative to dir, e.g. "file" or "sub/file"
+/// \return The file descriptor, -2 if the directory was removed since, other < 0 on error
+///
+int fs_openat(fs_dir_t *dir, const char *path);
+
+///
+/// Creates a file or directory in an open directory
+/// \param dir The directory handle from fs_opendir
+/// \param name File name (not a path) of the new file
+/// \param type Type of file to create (regular or directory)
+/// \return 0 on success, < 0 on error
+///
+int fs_createat(fs_dir_t *dir, const char *name, file_t type);
+
+///
+/// Removes a file or an empty directory from an open directory
+/// \param dir The directory handle from fs_opendir
+/// \param name File name (not a path) to remove
+/// \return 0 on success, < 0 on error
+///
+int fs_removeat(fs_dir_t *dir, const char *name);
+
+///
+/// Tells the position of a directory listing, a cookie fs_seekdir takes back
+///   Cookies stay valid across fs_closedir and for other handles of the same directory
+/// \param dir The directory handle
+/// \return The cookie, 0 for the start of the directory
+///
+uint64_t fs_telldir(const fs_dir_t *dir);
+
+///
+/// Resumes a directory listing at a cookie from fs_telldir
+/// \param dir The directory handle
+/// \param cookie The position to continue from, 0 to start over
+/// \return 0 on success, < 0 on error
+///
+int fs_seekdir(fs_dir_t *dir, uint64_t cookie);
+
+///
+/// Closes a directory handle
+/// \param dir The directory handle, may be NULL
+///
+void fs_closedir(fs_dir_t *dir);
+
 /// Moves the file from one location to the other
 ///   Moving files does not affect open descriptors
 /// \param fs The F19FS containing the file
@@ -156,6 +547,37 @@ int fs_move(F19FS_t *fs, const char *src, const char *dst);
 ///
 int fs_link(F19FS_t *fs, const char *src, const char *dst);
 
+///
+/// Queues requests for the volume's worker threads and returns without waiting
+///   Requests run as fs_read/fs_write/fs_create/fs_remove would and may complete in any order
+///   Reads run alongside each other, everything else runs alone
+///   The calls that change the volume, fs_read, fs_fsync, fs_sync, fs_snapshot and the stat calls
+///   take the same volume lock and may be mixed with requests in flight; other lookups (seek,
+///   directory listings, handles) don't, keep them to files no request in flight changes
+///   buf and path must stay valid until the matching completion is reaped
+///   Keep at most one request in flight per descriptor, its R/W position is shared
+///   A write that isn't buffered takes its range alone and copies its data alongside other writes
+///   and reads; writes to an FS_OPEN_APPEND descriptor take theirs at the end of file, so any
+///   number may be in flight for one file or descriptor, in the file in the order they were taken
+///   A read of the file overlapping a write not yet completed may see zeros or the old data in its range
+/// \param fs The F19FS to operate on
+/// \param requests The requests to queue
+/// \param count Number of requests
+/// \return number of requests queued (< count IFF the rings are full), < 0 on error
+///
+int fs_submit(F19FS_t *fs, const fs_request_t *requests, size_t count);
+
+///
+/// Reaps finished requests
+///   Blocks until min_complete completions are ready, or fewer if that many aren't outstanding
+/// \param fs The F19FS the requests were submitted to
+/// \param completions The buffer to write completions to
+/// \param max Capacity of completions
+/// \param min_complete Completions to wait for (0 to only poll)
+/// \return number of completions written, < 0 on error
+///
+int fs_poll_completions(F19FS_t *fs, fs_completion_t *completions, size_t max, size_t min_complete);
+
 
 ssize_t write_direct_block(F19FS_t* fs, inode_t* inode, uint16_t fd_locator, uint16_t fd_offset, const void* src, size_t nbyte);
 
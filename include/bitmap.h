@@ -24,6 +24,14 @@ typedef struct bitmap bitmap_t;
 ///
 void bitmap_set(bitmap_t *const bitmap, const size_t bit);
 
+///
+/// Sets requested bit in bitmap with an atomic or, for threads setting bits of one bitmap side by side
+///   The total of a BITMAP_COUNTED bitmap is not kept
+/// \param bitmap The bitmap
+/// \param bit The bit to set
+///
+void bitmap_set_shared(bitmap_t *const bitmap, const size_t bit);
+
 ///
 /// Clears requested bit in bitmap
 /// \param bitmap The bitmap
@@ -66,12 +74,72 @@ size_t bitmap_ffs(const bitmap_t *const bitmap);
 ///
 size_t bitmap_ffz(const bitmap_t *const bitmap);
 
+///
+/// Find the next set bit, words without one are skipped whole
+/// \param bitmap The bitmap
+/// \param from The first bit to look at
+/// \return The first set bit at or after from, SIZE_MAX on error/not found
+///
+size_t bitmap_next_set(const bitmap_t *const bitmap, const size_t from);
+
+///
+/// Find the next zero bit, words of all ones are skipped whole
+/// \param bitmap The bitmap
+/// \param from The first bit to look at
+/// \return The first zero bit at or after from, SIZE_MAX on error/not found
+///
+size_t bitmap_next_zero(const bitmap_t *const bitmap, const size_t from);
+
 ///
 /// Count all bits set
 /// \param bitmap the bitmap
 /// \return the total number of bits that are set in the bitmap
 ///
 size_t bitmap_total_set(const bitmap_t *const bitmap);
+
+///
+/// Keeps the number of set bits up to date from now on, so bitmap_total_set is O(1)
+///   Every change made through the bitmap functions adjusts it, writes that go around
+///   them (straight into overlaid memory) leave it stale until the next call
+/// \param bitmap The bitmap
+/// \param total The number of bits set right now, SIZE_MAX to count them
+///
+void bitmap_track_total(bitmap_t *const bitmap, const size_t total);
+
+///
+/// Sets count bits starting at start
+/// \param bitmap The bitmap
+/// \param start The first bit to set
+/// \param count Number of bits to set
+///
+void bitmap_set_range(bitmap_t *const bitmap, const size_t start, const size_t count);
+
+///
+/// Clears count bits starting at start
+/// \param bitmap The bitmap
+/// \param start The first bit to clear
+/// \param count Number of bits to clear
+///
+void bitmap_reset_range(bitmap_t *const bitmap, const size_t start, const size_t count);
+
+///
+/// Counts the bits set among count bits starting at start
+/// \param bitmap The bitmap
+/// \param start The first bit to count
+/// \param count Number of bits to look at, cut at the end of the bitmap
+/// \return The number of set bits in the range
+///
+size_t bitmap_count_range(const bitmap_t *const bitmap, const size_t start, const size_t count);
+
+///
+/// Finds the first run of len clear bits at or after start
+/// \param bitmap The bitmap
+/// \param start The first bit the run may begin at
+/// \param len Length of the run
+/// \return The first bit of the run, SIZE_MAX on error/not found
+///
+size_t bitmap_find_zero_run(const bitmap_t *const bitmap, const size_t start, const size_t len);
+
 ///
 /// For each loop for all set bits
 ///  (Arguments passed to func are saved across calls)
@@ -139,6 +207,23 @@ bitmap_t *bitmap_import(const size_t n_bits, const void *const bitmap_data);
 ///
 bitmap_t *bitmap_overlay(const size_t n_bits, void *const bitmap_data);
 
+// Caller-owned storage for a bitmap, e.g. on the stack, see bitmap_view
+// Only its size matters, the contents belong to the bitmap functions
+typedef struct {
+    size_t opaque[6];
+} bitmap_view_t;
+
+///
+/// Sets up a bitmap over the given memory inside view, nothing is allocated
+/// Note: Like bitmap_overlay, but the result is never passed to bitmap_destroy;
+///  it stays valid as long as view and bitmap_data do
+/// \param view Storage for the bitmap
+/// \param n_bits The number of bits in the bitmap
+/// \param bitmap_data The memory holding the bits
+/// \return The bitmap inside view, NULL on error
+///
+bitmap_t *bitmap_view(bitmap_view_t *const view, const size_t n_bits, void *const bitmap_data);
+
 ///
 /// Destructs and destroys bitmap object
 /// \param bitmap The bitmap
@@ -0,0 +1,67 @@
+#ifndef BITMAP_INLINE_H__
+#define BITMAP_INLINE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <bitmap.h>
+
+// The bitmap object laid open, for the single-bit accessors below
+// Only code built together with the bitmap library should include this: the layout
+//  is not part of the shared library's interface and may change with it
+
+// BITMAP_OVERLAY indicates we're an overlay and should not free
+// BITMAP_COUNTED keeps total in step with every change, see bitmap_track_total
+// (also, make sure that BITMAP_ALL is as wide as ll of the flags)
+typedef enum { BITMAP_NONE = 0x00, BITMAP_OVERLAY = 0x01, BITMAP_COUNTED = 0x02, BITMAP_ALL = 0xFF } BITMAP_FLAGS;
+
+struct bitmap {
+    unsigned leftover_bits;  // Packing will increase this to an int anyway
+    BITMAP_FLAGS flags;      // Generic place to store flags. Not enough flags to worry about width yet.
+    uint8_t *data;
+    size_t bit_count, byte_count;
+    size_t total;            // bits set, only kept while BITMAP_COUNTED
+};
+
+///
+/// bitmap_test, inlined into the caller
+/// \param bitmap The bitmap
+/// \param bit The bit to query
+/// \return The value of the requested bit
+///
+static inline bool bitmap_test_inline(const bitmap_t *const bitmap, const size_t bit) {
+    return bitmap->data[bit >> 3] & (1u << (bit & 0x07));
+}
+
+///
+/// bitmap_set, inlined into the caller
+/// \param bitmap The bitmap
+/// \param bit The bit to set
+///
+static inline void bitmap_set_inline(bitmap_t *const bitmap, const size_t bit) {
+    if ((bitmap->flags & BITMAP_COUNTED) && !bitmap_test_inline(bitmap, bit)) {
+        ++bitmap->total;
+    }
+    bitmap->data[bit >> 3] |= (uint8_t) (1u << (bit & 0x07));
+}
+
+///
+/// bitmap_reset, inlined into the caller
+/// \param bitmap The bitmap
+/// \param bit The bit to clear
+///
+static inline void bitmap_reset_inline(bitmap_t *const bitmap, const size_t bit) {
+    if ((bitmap->flags & BITMAP_COUNTED) && bitmap_test_inline(bitmap, bit)) {
+        --bitmap->total;
+    }
+    bitmap->data[bit >> 3] &= (uint8_t) ~(1u << (bit & 0x07));
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
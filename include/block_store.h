@@ -30,6 +30,16 @@ typedef struct block_store block_store_t;
 /////
 block_store_t *block_store_create(const char *const fname);
 
+///
+///// Creates a new back_store file with options, see block_store_open_ex for the flags
+/////  BLOCK_STORE_IN_PLACE keeps an existing file of the right size instead of truncating it,
+/////  only the free block bitmap is cleared
+///// \param fname the file to create
+///// \param flags bitwise or of BLOCK_STORE_* flags
+///// \return a pointer to the new object, NULL on error
+/////
+block_store_t *block_store_create_ex(const char *const fname, const unsigned flags);
+
 ///
 ///// Opens the specified back_store file
 /////  and returns a back_store object linked to it
@@ -38,6 +48,20 @@ block_store_t *block_store_create(const char *const fname);
 /////
 block_store_t *block_store_open(const char *const fname);
 
+// block_store_open_ex flags
+#define BLOCK_STORE_POPULATE (0x1)  // prefault the mapping (MAP_POPULATE)
+#define BLOCK_STORE_HUGEPAGE (0x2)  // ask for transparent huge pages (MADV_HUGEPAGE)
+#define BLOCK_STORE_IN_PLACE (0x4)  // block_store_create_ex: reuse the existing file
+
+///
+///// Opens the specified back_store file with mapping options
+/////  flags the platform does not support are ignored
+///// \param fname the file to open
+///// \param flags bitwise or of BLOCK_STORE_* flags
+///// \return a pointer to the new object, NULL on error
+/////
+block_store_t *block_store_open_ex(const char *const fname, const unsigned flags);
+
 ///
 /// Destroys the provided block storage device
 /// This is an idempotent operation, so there is no return value
@@ -52,6 +76,16 @@ void block_store_destroy(block_store_t *const bs);
 ///
 size_t block_store_allocate(block_store_t *const bs);
 
+///
+/// Searches for a run of contiguous free blocks and marks it as in use
+///  First fit; if no gap is long enough the longest one is taken instead
+/// \param bs BS device
+/// \param count Number of blocks wanted
+/// \param allocated Receives the length of the run taken (<= count)
+/// \return First block id of the run, SIZE_MAX on error/no free block
+///
+size_t block_store_allocate_run(block_store_t *const bs, const size_t count, size_t *const allocated);
+
 ///
 /// Attempts to allocate the requested block id
 /// \param bs the block store object
@@ -67,8 +101,19 @@ bool block_store_request(block_store_t *const bs, const size_t block_id);
 ///
 void block_store_release(block_store_t *const bs, const size_t block_id);
 
+///
+/// Frees count neighbouring blocks starting at block_id, blocks already free are skipped
+///   The change hook hears about each bitmap byte once rather than about every block
+/// \param bs BS device
+/// \param block_id The first block to free
+/// \param count Number of blocks to free
+/// \return Number of blocks freed
+///
+size_t block_store_release_run(block_store_t *const bs, const size_t block_id, const size_t count);
+
 ///
 /// Counts the number of blocks marked as in use
+///   O(1) for a fresh device or after block_store_set_used_blocks, a popcount of the bitmap otherwise
 /// \param bs BS device
 /// \return Total blocks in use, SIZE_MAX on error
 ///
@@ -107,20 +152,53 @@ size_t block_store_read(const block_store_t *const bs, const size_t block_id, vo
 size_t block_store_write(block_store_t *const bs, const size_t block_id, const void *buffer);
 
 ///
-/// Imports BS device from the given file - for grads/bonus
+/// Imports BS device from the given file, a device image or a full snapshot
+///   The file is mapped copy-on-write (a snapshot's blocks are read into an anonymous mapping),
+///   changes to the device never reach the file
 /// \param filename The file to load
 /// \return Pointer to new BS device, NULL on error
 ///
 block_store_t *block_store_deserialize(const char *const filename);
 
 ///
-/// Writes the entirety of the BS device to file, overwriting it if it exists - for grads/bonus
+/// Writes the device held by source to the file target
+///   A device image is cloned (FICLONE) where the file system shares extents, otherwise only
+///   its data ranges are copied with copy_file_range; a full snapshot replaces target with
+///   its blocks in a sparse file, a delta is applied on top of the base already in target
+///   Target is marked past its device bytes with the generation it was restored to, a delta
+///   whose base is not that generation is refused and target left as it was
+/// \param source Device image or snapshot stream file
+/// \param target The device file to write
+/// \return true on success
+///
+bool block_store_restore(const char *const source, const char *const target);
+
+///
+/// Writes a full snapshot of the BS device to file, overwriting it if it exists
+///   Only the blocks in use are written, the snapshot can't be the base of a delta
 /// \param bs BS device
 /// \param filename The file to write to
 /// \return Number of bytes written, 0 on error
 ///
 size_t block_store_serialize(const block_store_t *const bs, const char *const filename);
 
+// Snapshot stream: a 40 byte header (magic "F19S", version, block size, block count,
+//  number of blocks held, generation, base generation), a bitmap with a bit per device
+//  block telling which blocks the stream holds, then those blocks in ascending order.
+// A full snapshot holds every block in use and the free block bitmap, a delta only those
+//  written since its base, so both scale with live or changed data rather than capacity.
+// Generations are only known to the open device that handed them out.
+
+///
+/// Streams a snapshot of the BS device to fd and starts a new generation
+/// \param bs BS device
+/// \param fd File, pipe or socket to write to
+/// \param base Generation of an earlier snapshot of this open device for a delta, 0 for a full snapshot
+/// \param generation Receives the generation of this snapshot, the base of the next delta, may be NULL
+/// \return Number of bytes written, 0 on error or when base is unknown
+///
+size_t block_store_snapshot(block_store_t *const bs, const int fd, const uint64_t base, uint64_t *const generation);
+
 
 //////////////////////////////////////////////////////////////////////
 /// some added library functions for this specific implementation  ///
@@ -167,6 +245,46 @@ size_t block_store_fd_write(block_store_t *const bs, const size_t block_id, cons
 
 uint8_t* block_store_get_data(block_store_t *const bs);
 
+// called with the address about to change, before a bitmap bit flips or an inode is written
+typedef void (*block_store_hook_t)(void *arg, const void *addr);
+
+// install (or with NULL remove) the change hook of a block store
+void block_store_set_hook(block_store_t *const bs, block_store_hook_t hook, void *arg);
+
+// write count blocks starting at block_id back to the file and wait for it (msync)
+bool block_store_sync_range(block_store_t *const bs, const size_t block_id, const size_t count);
+
+// remember count blocks from block_id as changed, for writes that bypass block_store_write
+void block_store_mark_dirty(block_store_t *const bs, const size_t block_id, const size_t count);
+
+// block_store_mark_dirty for writers running side by side, each one after its data is in place
+//  syncs and snapshots still have to wait for them, they clear the bits without atomics
+void block_store_mark_dirty_shared(block_store_t *const bs, const size_t block_id, const size_t count);
+
+// true if the block changed since it was last synced
+bool block_store_is_dirty(const block_store_t *const bs, const size_t block_id);
+
+///
+/// Writes dirty blocks back to the file (msync MS_SYNC), one call per run of neighbouring blocks
+/// \param bs BS device
+/// \param only Bitmap over all device blocks limiting what is synced, NULL syncs every dirty block
+/// \return true on success
+///
+bool block_store_sync_dirty(block_store_t *const bs, const bitmap_t *const only);
+
+// hand in a trusted count of the blocks in use (e.g. saved at a clean shutdown), SIZE_MAX counts the bitmap now;
+// either way the count is kept up to date from then on
+void block_store_set_used_blocks(block_store_t *const bs, const size_t used);
+
+// zero count blocks starting at block_id, punching a hole in the file where the platform allows
+bool block_store_discard(block_store_t *const bs, const size_t block_id, const size_t count);
+
+// keep count blocks starting at block_id resident in memory, false when mlock fails
+bool block_store_lock(block_store_t *const bs, const size_t block_id, const size_t count);
+
+// pass a posix_madvise hint (POSIX_MADV_*) for count blocks starting at block_id of the mapping
+bool block_store_advise(block_store_t *const bs, const size_t block_id, const size_t count, const int advice);
+
 bitmap_t* block_store_get_bm(block_store_t* const bs);
 
 
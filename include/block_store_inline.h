@@ -0,0 +1,117 @@
+#ifndef BLOCK_STORE_INLINE_H__
+#define BLOCK_STORE_INLINE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <block_store.h>
+#include <bitmap_inline.h>
+
+// The block store object laid open, for the accessors the file system calls once per block
+// Only code built together with the block store library should include this: the layout
+//  is not part of the shared library's interface and may change with it
+
+#define BLOCK_STORE_INLINE_BLOCK_BYTES 1024   // same as BLOCK_SIZE_BYTES
+#define BLOCK_STORE_INLINE_DATA_BLOCKS 65528  // same as BLOCK_STORE_AVAIL_BLOCKS
+#define BLOCK_STORE_INLINE_INODE_BYTES 64     // one inode of an inode table store
+#define BLOCK_STORE_INLINE_FD_BYTES 6         // one descriptor of a file descriptor store
+#define BLOCK_STORE_INLINE_ENTRIES 256        // inodes or descriptors in such a store
+
+struct block_store {
+    int fd;
+    uint8_t *data_blocks;
+    bitmap_t *fbm;
+    block_store_hook_t hook;    // told about bitmap and inode table changes before they happen
+    void *hook_arg;
+    bitmap_t *dirty;            // blocks written since they were last synced, NULL if not tracked
+    uint32_t *changed;          // per block, the generation it was last written in, 0 if not since open
+    uint32_t session;           // tells the generations of this open device from any other
+    uint32_t generation;        // the generation writes are stamped with, a snapshot ends it
+};
+
+///
+/// block_store_read, inlined into the caller
+/// \param bs BS device
+/// \param block_id Source block id
+/// \param buffer Data buffer to write to
+/// \return Number of bytes read, 0 on error
+///
+static inline size_t block_store_read_inline(const block_store_t *const bs, const size_t block_id, void *buffer) {
+    if (bs && buffer && block_id <= BLOCK_STORE_INLINE_DATA_BLOCKS) {
+        memcpy(buffer, bs->data_blocks + block_id * BLOCK_STORE_INLINE_BLOCK_BYTES, BLOCK_STORE_INLINE_BLOCK_BYTES);
+        return BLOCK_STORE_INLINE_BLOCK_BYTES;
+    }
+    return 0;
+}
+
+///
+/// block_store_inode_read, inlined into the caller
+/// \param bs Inode table store
+/// \param block_id The inode to read
+/// \param buffer Receives the inode
+/// \return Number of bytes read, 0 on error
+///
+static inline size_t block_store_inode_read_inline(const block_store_t *const bs, const size_t block_id, void *buffer) {
+    if (bs && buffer && block_id < BLOCK_STORE_INLINE_ENTRIES) {
+        memcpy(buffer, bs->data_blocks + block_id * BLOCK_STORE_INLINE_INODE_BYTES, BLOCK_STORE_INLINE_INODE_BYTES);
+        return BLOCK_STORE_INLINE_INODE_BYTES;
+    }
+    return 0;
+}
+
+///
+/// block_store_inode_write, inlined into the caller; the hook still sees the change first
+/// \param bs Inode table store
+/// \param block_id The inode to write
+/// \param buffer The inode
+/// \return Number of bytes written, 0 on error
+///
+static inline size_t block_store_inode_write_inline(block_store_t *const bs, const size_t block_id, const void *buffer) {
+    if (bs && buffer && block_id < BLOCK_STORE_INLINE_ENTRIES) {
+        if (bs->hook) {
+            bs->hook(bs->hook_arg, bs->data_blocks + block_id * BLOCK_STORE_INLINE_INODE_BYTES);
+        }
+        memcpy(bs->data_blocks + block_id * BLOCK_STORE_INLINE_INODE_BYTES, buffer, BLOCK_STORE_INLINE_INODE_BYTES);
+        return BLOCK_STORE_INLINE_INODE_BYTES;
+    }
+    return 0;
+}
+
+///
+/// block_store_fd_read, inlined into the caller
+/// \param bs File descriptor store
+/// \param block_id The descriptor to read
+/// \param buffer Receives the descriptor
+/// \return Number of bytes read, 0 on error
+///
+static inline size_t block_store_fd_read_inline(const block_store_t *const bs, const size_t block_id, void *buffer) {
+    if (bs && buffer && block_id < BLOCK_STORE_INLINE_ENTRIES) {
+        memcpy(buffer, bs->data_blocks + block_id * BLOCK_STORE_INLINE_FD_BYTES, BLOCK_STORE_INLINE_FD_BYTES);
+        return BLOCK_STORE_INLINE_FD_BYTES;
+    }
+    return 0;
+}
+
+///
+/// block_store_fd_write, inlined into the caller
+/// \param bs File descriptor store
+/// \param block_id The descriptor to write
+/// \param buffer The descriptor
+/// \return Number of bytes written, 0 on error
+///
+static inline size_t block_store_fd_write_inline(block_store_t *const bs, const size_t block_id, const void *buffer) {
+    if (bs && buffer && block_id < BLOCK_STORE_INLINE_ENTRIES) {
+        memcpy(bs->data_blocks + block_id * BLOCK_STORE_INLINE_FD_BYTES, buffer, BLOCK_STORE_INLINE_FD_BYTES);
+        return BLOCK_STORE_INLINE_FD_BYTES;
+    }
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
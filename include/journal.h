@@ -0,0 +1,106 @@
+#ifndef JOURNAL_H__
+#define JOURNAL_H__
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <block_store.h>
+
+// Undo/redo journal of metadata blocks kept in a reserved block range of a block store
+//
+// A transaction lists the blocks it changes. Before the first change to a block its
+//  before-image is written to the journal and synced to the file (msync), so the undo record
+//  is durable before the block changes; the transactions committed before it are synced first.
+//  At the end of the transaction the after-images follow inside the mapping, unsynced.
+//  journal_replay rolls committed transactions forward from their after-images. The newest
+//  one, if it was cut short or its after-images did not all reach the file, is rolled back
+//  from its before-images, which carry their own checksum; when that fails nothing is
+//  applied and replay reports an error.
+// journal_sync makes every committed transaction durable with one msync of the journal,
+//  concurrent callers share that flush. When the journal fills up, the whole device is
+//  written back and the journal starts over, so replay never reads more than the journal.
+//  A transaction that outgrows the journal has its header voided and the device written
+//  back at once, replay never rolls back a transaction with missing before-images.
+// One thread runs a transaction at a time, journal_begin waits for the running one to end.
+
+typedef struct journal journal_t;
+
+///
+/// Writes an empty journal over count blocks starting at start and opens it
+///   The blocks must already be marked in use in the block store
+/// \param bs The block store the journal and the blocks it covers live in
+/// \param start First block of the journal
+/// \param count Number of blocks of the journal, at least 3
+/// \return The journal, NULL on error
+///
+journal_t *journal_create(block_store_t *const bs, const size_t start, const size_t count);
+
+///
+/// Opens the journal written by journal_create, nothing is replayed yet
+/// \param bs The block store the journal lives in
+/// \param start First block of the journal
+/// \param count Number of blocks of the journal
+/// \return The journal, NULL if there is no journal there
+///
+journal_t *journal_open(block_store_t *const bs, const size_t start, const size_t count);
+
+///
+/// Rolls committed transactions forward and an interrupted or torn one back, then empties the journal
+///   Fails (-3), applying nothing of that transaction, when its before-images don't match their checksum
+/// \param journal The journal to replay
+/// \return Number of transactions applied, < 0 on error
+///
+int journal_replay(journal_t *const journal);
+
+///
+/// Starts a transaction, nested calls join the outermost one
+///   Another thread's transaction is waited for, the calling thread owns this one until its outermost end
+/// \param journal The journal
+///
+void journal_begin(journal_t *const journal);
+
+///
+/// Records the before-image of a block the running transaction is about to change
+///   Blocks changed outside of a transaction, or by a thread not running it, are not journaled
+/// \param journal The journal
+/// \param block_id The block about to change
+///
+void journal_touch(journal_t *const journal, const size_t block_id);
+
+///
+/// Ends a transaction, the outermost end commits it
+/// \param journal The journal
+///
+void journal_end(journal_t *const journal);
+
+///
+/// Makes every transaction committed so far durable
+///   One msync of the journal covers all of them, callers arriving during a flush wait for it
+/// \param journal The journal
+/// \return 0 on success, < 0 on error
+///
+int journal_sync(journal_t *const journal);
+
+///
+/// Writes the whole device back and empties the journal
+/// \param journal The journal
+/// \return 0 on success, < 0 on error
+///
+int journal_checkpoint(journal_t *const journal);
+
+///
+/// Checkpoints and frees the journal
+/// \param journal The journal
+///
+void journal_close(journal_t *const journal);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
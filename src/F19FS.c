@@ -1,8 +1,11 @@
 #include "dyn_array.h"
 #include "bitmap.h"
 #include "block_store.h"
+#include "block_store_inline.h"
 #include "F19FS.h"
+#include "journal.h"
 #include <libgen.h>
+#include <pthread.h>
 
 #define BLOCK_STORE_NUM_BLOCKS 65536   // 2^16 blocks.
 #define BLOCK_STORE_AVAIL_BLOCKS 65528 // Last 8 blocks consumed by the FBM
@@ -22,6 +25,7 @@
 #define BLOCK_STORE_NUM_INODE_BITMAP_BLOCK 1
 #define BLOCK_STORE_NUM_INODE_TABLE_BLOCK 16
 #define NUM_OF_ENTRIES 31
+#define ENTRY_BITS ((UINT32_C(1) << NUM_OF_ENTRIES) - 1)	// the bits of vacantFile that stand for entries
 #define SIZE_OF_ENTRY_BYTE 33
 #define NUM_DIRECT_PTR 6
 #define NUM_INDIRECT_PTR 512
@@ -30,7 +34,9 @@
 // each inode represents a regular file or a directory file
 struct inode {
     uint32_t vacantFile;    // this parameter is only for directory. Used as a bitmap denoting availibility of entries in a directory file.
-    char owner[18];         // for alignment purpose only   
+    char owner[12];         // for alignment purpose only   
+    uint32_t generation;    // bumped each time the slot is freed, tells a reused slot from the file a handle named
+    uint16_t reserved;
 
     char fileType;          // 'r' denotes regular file, 'd' denotes directory file
 
@@ -56,16 +62,118 @@ struct fileDescriptor {
 };
 
 
+// fileDescriptor usage bits above the pointer usage info
+#define FD_WRITE_BACK 0x08	// writes are staged in the page cache
+#define FD_APPEND 0x10		// every write starts at the end of file
+
 struct directoryFile {
     char filename[32];
     uint8_t inodeNumber;
 };
 
+// an open directory listing, see fs_opendir
+struct fs_dir {
+    F19FS_t * fs;
+    size_t inodeID;             // the directory being listed
+    uint32_t generation;        // of that inode, the *at calls refuse a directory removed since
+    uint64_t cookie;            // first entry not handed out yet, NUM_OF_ENTRIES at the end
+};
+
+
+// submission/completion rings drained by the worker threads of fs_submit
+typedef struct fs_ring {
+    pthread_mutex_t mutex;
+    pthread_cond_t submitted;   // workers wait here for requests
+    pthread_cond_t completed;   // fs_poll_completions waits here for completions
+
+    fs_request_t sq[FS_QUEUE_DEPTH];
+    fs_completion_t cq[FS_QUEUE_DEPTH];
+    size_t sq_head, sq_tail;    // free running, wrapped on access
+    size_t cq_head, cq_tail;
+    size_t inflight;            // taken off the sq, completion not posted yet
+
+    pthread_t workers[FS_QUEUE_WORKERS];
+    size_t nr_workers;          // 0 until the first fs_submit
+    bool stopping;
+} fs_ring_t;
+
+
+// the superblock shares block 0 with the inode bitmap, which only needs the first 32 bytes
+#define SUPERBLOCK_OFFSET 512
+#define SUPERBLOCK_MAGIC 0x53393146	// "F19S"
+#define SUPERBLOCK_VERSION 2
+#define INODE_BITMAP_BLOCK 0
+#define INODE_TABLE_START 1			// first block of the inode table
+#define INODE_TABLE_BLOCKS (number_inodes * inode_size / BLOCK_SIZE_BYTES)
+
+typedef struct superblock {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t staleInodeBlocks;	// bit i set: inode table block i still holds bytes of an older volume
+    // geometry, a volume laid out differently from this build is not mounted
+    uint32_t blockCount;
+    uint16_t blockSize;
+    uint16_t inodeCount;
+    uint16_t inodeSize;
+    uint16_t inodeBitmapBlock;
+    uint16_t inodeTableStart;
+    uint16_t inodeTableBlocks;
+    // written by fs_unmount, only trusted when clean is set
+    uint32_t usedBlocks;
+    uint16_t usedInodes;
+    uint8_t clean;				// 1 after fs_unmount, 0 while the volume is mounted
+    uint8_t reserved;
+    // optional parts of the volume, zero on volumes that predate them
+    uint32_t features;			// FEATURE_* bits
+    uint32_t journalStart;
+    uint32_t journalBlocks;
+} superblock_t;
+
+#define FEATURE_JOURNAL 0x1
+#define FEATURE_SPARSE 0x2		// descriptors may be seeked past EOF, what a write skips stays a hole
+#define JOURNAL_BLOCKS 1024		// 1 MiB of metadata images, taken right after the inode table
+
+// one staged block of a file written through an FD_WRITE_BACK descriptor
+typedef struct cachedPage {
+    uint16_t logical;                   // block index within the file
+    uint8_t data[BLOCK_SIZE_BYTES];
+} cachedPage_t;
+
+// sequential-access detection for one descriptor
+typedef struct readahead {
+    size_t next;            // logical block a sequential reader asks for next
+    size_t window;          // blocks hinted ahead of the reader, 0 until a pattern shows
+    size_t hinted;          // logical blocks below this were already hinted
+    fs_advice_t advice;     // last fs_advise given to the descriptor
+} readahead_t;
+
+// dirty pages of one inode, no physical block is handed out for them until writeback
+typedef struct pageCache {
+    size_t fileSize;        // file size including the staged pages
+    size_t unmapped;        // staged pages that have no physical block yet
+    dyn_array_t * pages;    // cachedPage_t, sorted by logical
+} pageCache_t;
+
 
 struct F19FS {
     block_store_t * BlockStore_whole;
     block_store_t * BlockStore_inode;
     block_store_t * BlockStore_fd;
+
+    pageCache_t * cache[number_inodes];
+    size_t cached_pages;        // across every inode, bounded by FS_PAGE_CACHE_PAGES
+    size_t reserved_blocks;     // promised to unmapped pages, not yet taken from the free bitmap
+    bool writing_back;          // write_back_inode is allocating, it may take the promised blocks
+
+    readahead_t readahead[number_fd];
+
+    unsigned mount_flags;       // FS_MOUNT_* given to fs_mount_ex
+    superblock_t * sb;          // inside block 0 of the mapping
+    journal_t * journal;        // NULL unless the volume was formatted with FS_FORMAT_JOURNAL
+
+    // readers share, anything touching the bitmaps or the inode table is exclusive
+    pthread_rwlock_t lock;
+    fs_ring_t * ring;
 };
 
 
@@ -77,7 +185,7 @@ bool isValidFileName(const char *filename) {
     }
 
     // define invalid characters might be contained in filenames
-    char *invalidCharacters = "!@#$%^&*?\"";
+    char *invalidCharacters = "!@#$%^&*?\"/";
     int i = 0;
     int len = strlen(invalidCharacters);
     for( ; i < len; i++)
@@ -156,11 +264,13 @@ size_t getParentDirInodeID(F19FS_t* fs, char* parentPath) {
     // Default as the root rectory inode ID (e.g in "/new_file" case, we just get "/")
     size_t cur_inode_ID = 0;
     inode_t cur_dir_inode;
-    directoryFile_t* cur_dir_block = (directoryFile_t *)calloc(1, BLOCK_SIZE_BYTES);
+    // one block on the stack serves every level, nothing to free on the way out
+    uint8_t cur_dir_data[BLOCK_SIZE_BYTES];
+    directoryFile_t* cur_dir_block = (directoryFile_t *)cur_dir_data;
 
     while (currentDir) {
         // printf("%s\n", currentDir);
-        if (block_store_inode_read(fs->BlockStore_inode, cur_inode_ID, &cur_dir_inode) == 0) {
+        if (block_store_inode_read_inline(fs->BlockStore_inode, cur_inode_ID, &cur_dir_inode) == 0) {
             printf("return 1\n");
             return SIZE_MAX;
         }
@@ -168,82 +278,323 @@ size_t getParentDirInodeID(F19FS_t* fs, char* parentPath) {
             printf("return 2\n");
             return SIZE_MAX;
         }
-        if (block_store_read(fs->BlockStore_whole, cur_dir_inode.directPointer[0], cur_dir_block) == 0) {
+        if (block_store_read_inline(fs->BlockStore_whole, cur_dir_inode.directPointer[0], cur_dir_block) == 0) {
             printf("return 3\n");
             return SIZE_MAX;
         }
-        bitmap_t* entry_bm = bitmap_overlay(NUM_OF_ENTRIES, &(cur_dir_inode.vacantFile));
+        bitmap_view_t entry_bm_view;
+        bitmap_t* entry_bm = bitmap_view(&entry_bm_view, NUM_OF_ENTRIES, &(cur_dir_inode.vacantFile));
         bool isFound = false;
         for (size_t i = 0; i < NUM_OF_ENTRIES; i++) {
             // if current i entry is set and fileName equals to the given parentPath
             size_t maxLength = strlen((cur_dir_block + i)->filename) >= strlen(currentDir) ? strlen((cur_dir_block + i)->filename) : strlen(currentDir);
-            if (bitmap_test(entry_bm, i) && strncmp((cur_dir_block + i)->filename, currentDir, maxLength) == 0) {
+            if (bitmap_test_inline(entry_bm, i) && strncmp((cur_dir_block + i)->filename, currentDir, maxLength) == 0) {
                 inode_t next_inode;
-                if (block_store_inode_read(fs->BlockStore_inode, (cur_dir_block + i)->inodeNumber, &next_inode) != 0 && next_inode.fileType == 'd') {
+                if (block_store_inode_read_inline(fs->BlockStore_inode, (cur_dir_block + i)->inodeNumber, &next_inode) != 0 && next_inode.fileType == 'd') {
                     cur_inode_ID = next_inode.inodeNumber;
                     isFound = true;
                 }
             }
         }
-        bitmap_destroy(entry_bm);
 
         if (!isFound) {
             return SIZE_MAX;
         }
         currentDir = strtok(NULL, "/");
     }
-    free(cur_dir_block);
     return cur_inode_ID;
 }
 
 bool checkFileExist(F19FS_t* fs, size_t parentDirInodeID, char* fileName) {
     
     inode_t parentDirInode;
-    directoryFile_t* parentDir = (directoryFile_t *)calloc(1, BLOCK_SIZE_BYTES);
-    if (block_store_inode_read(fs->BlockStore_inode, parentDirInodeID, &parentDirInode) == 0 || block_store_read(fs->BlockStore_whole, parentDirInode.directPointer[0], parentDir) == 0) {
+    uint8_t parentDirData[BLOCK_SIZE_BYTES];
+    directoryFile_t* parentDir = (directoryFile_t *)parentDirData;
+    if (block_store_inode_read_inline(fs->BlockStore_inode, parentDirInodeID, &parentDirInode) == 0 || block_store_read_inline(fs->BlockStore_whole, parentDirInode.directPointer[0], parentDir) == 0) {
         return false;
     }
-    bitmap_t* parentBM = bitmap_overlay(NUM_OF_ENTRIES, &(parentDirInode.vacantFile));
+    bitmap_view_t parentBM_view;
+    bitmap_t* parentBM = bitmap_view(&parentBM_view, NUM_OF_ENTRIES, &(parentDirInode.vacantFile));
     for (size_t i = 0; i < NUM_OF_ENTRIES; i++) {
         size_t maxLength = strlen((parentDir + i)->filename) >= strlen(fileName) ? strlen((parentDir + i)->filename) : strlen(fileName); 
-        if (bitmap_test(parentBM, i) && strncmp((parentDir + i)->filename, fileName, maxLength) == 0) {
-            bitmap_destroy(parentBM);
+        if (bitmap_test_inline(parentBM, i) && strncmp((parentDir + i)->filename, fileName, maxLength) == 0) {
             return true;
         }
     }
-    bitmap_destroy(parentBM);
-    free(parentDir);
     return false;
 }
 
 size_t getFileInodeID(F19FS_t* fs, size_t parentDirInodeID, char* fileName) {
     inode_t parentDirInode;
-    directoryFile_t* parentDir = (directoryFile_t *)calloc(1, BLOCK_SIZE_BYTES);
-    if (block_store_inode_read(fs->BlockStore_inode, parentDirInodeID, &parentDirInode) == 0 || block_store_read(fs->BlockStore_whole, parentDirInode.directPointer[0], parentDir) == 0) {
+    uint8_t parentDirData[BLOCK_SIZE_BYTES];
+    directoryFile_t* parentDir = (directoryFile_t *)parentDirData;
+    if (block_store_inode_read_inline(fs->BlockStore_inode, parentDirInodeID, &parentDirInode) == 0 || block_store_read_inline(fs->BlockStore_whole, parentDirInode.directPointer[0], parentDir) == 0) {
         return 0;
     }
-    bitmap_t* parentBM = bitmap_overlay(NUM_OF_ENTRIES, &(parentDirInode.vacantFile));
+    bitmap_view_t parentBM_view;
+    bitmap_t* parentBM = bitmap_view(&parentBM_view, NUM_OF_ENTRIES, &(parentDirInode.vacantFile));
     for (size_t i = 0; i < NUM_OF_ENTRIES; i++) {
         size_t maxLength = strlen((parentDir + i)->filename) >= strlen(fileName) ? strlen((parentDir + i)->filename) : strlen(fileName); 
-        if (bitmap_test(parentBM, i) && strncmp((parentDir + i)->filename, fileName, maxLength) == 0) {
-            bitmap_destroy(parentBM);
+        if (bitmap_test_inline(parentBM, i) && strncmp((parentDir + i)->filename, fileName, maxLength) == 0) {
             return (parentDir + i)->inodeNumber;
         }
     }
-    bitmap_destroy(parentBM);
-    free(parentDir);
     return 0;
 }
 
+// the directory block entries of a directory inode, straight from the mapping
+const directoryFile_t* dirEntries(F19FS_t* fs, const inode_t* dirInode) {
+    return (const directoryFile_t*)(block_store_get_data(fs->BlockStore_whole) + dirInode->directPointer[0] * BLOCK_SIZE_BYTES);
+}
+
+// resolve the first size bytes of a path relative to the directory inodeID (held in inode) component
+//  by component, straight from the caller's string
+// fills inode with the inode the path names and returns its ID, SIZE_MAX if any component is missing
+size_t resolveSpan(F19FS_t* fs, size_t inodeID, const char* name, size_t size, inode_t* inode) {
+    const char* stop = name + size;
+    while (name < stop) {
+        const char* end = (const char*)memchr(name, '/', stop - name);
+        size_t length = end ? (size_t)(end - name) : (size_t)(stop - name);
+        // empty components ("//", a trailing '/') and over-long names never match
+        if (length == 0 || length >= FS_FNAME_MAX || (end && end + 1 == stop) || inode->fileType != 'd') {
+            return SIZE_MAX;
+        }
+        const directoryFile_t* entries = dirEntries(fs, inode);
+        uint32_t used = inode->vacantFile & ENTRY_BITS;
+        size_t next = SIZE_MAX;
+        while (used) {
+            unsigned entry = __builtin_ctz(used);
+            used &= used - 1;
+            if (strncmp(entries[entry].filename, name, length) == 0 && entries[entry].filename[length] == '\0') {
+                next = entries[entry].inodeNumber;
+                break;
+            }
+        }
+        if (next == SIZE_MAX || block_store_inode_read_inline(fs->BlockStore_inode, next, inode) == 0) {
+            return SIZE_MAX;
+        }
+        inodeID = next;
+        name += end ? length + 1 : length;
+    }
+    return inodeID;
+}
+
+// resolve a whole path relative to the directory inodeID
+size_t resolveFrom(F19FS_t* fs, size_t inodeID, const char* name, inode_t* inode) {
+    return resolveSpan(fs, inodeID, name, strlen(name), inode);
+}
+
+// resolve an absolute path from the root directory
+size_t resolvePath(F19FS_t* fs, const char* path, inode_t* inode) {
+    if (path == NULL || *path != '/' || block_store_inode_read_inline(fs->BlockStore_inode, 0, inode) == 0) {
+        return SIZE_MAX;
+    }
+    return resolveFrom(fs, 0, path + 1, inode);
+}
+
+fs_ring_t* fs_ring_create();
+void fs_ring_destroy(fs_ring_t* ring);
+int write_back_inode(F19FS_t* fs, size_t inodeID);
+size_t allocate_block(F19FS_t* fs);
+size_t allocate_run(F19FS_t* fs, size_t count, size_t* got);
+int write_back_all(F19FS_t* fs);
+void drop_page_cache(F19FS_t* fs, size_t inodeID);
+off_t getPreviosOffset(fileDescriptor_t* fileDescriptor);
+size_t findMappedBlock(F19FS_t* fs, const inode_t* inode, size_t logical, size_t end, bool mapped);
+void truncate_file_blocks(F19FS_t* fs, inode_t* fileInode, size_t keep);
+int truncate_inode(F19FS_t* fs, size_t inodeID, off_t size);
+bool openDir(F19FS_t* fs, const char* path, struct fs_dir* dir);
+dyn_array_t* listDir(F19FS_t* fs, const char* path, bool plus);
+size_t getFileSize(F19FS_t* fs, const inode_t* inode);
+size_t countFileBlocks(F19FS_t* fs, const inode_t* inode);
+int createInDir(F19FS_t* fs, size_t dirInodeID, inode_t* dirInode, const char *const *names, size_t count, file_t type, int *results);
+int removeFromDir(F19FS_t* fs, size_t dirInodeID, inode_t* dirInode, const char *const *names, size_t count, int *results);
+size_t lookupOrCreate(F19FS_t* fs, const char* path, unsigned flags, file_t type, inode_t* inode, int* error);
+size_t openedDir(const fs_dir_t* dir, inode_t* dirInode);
+// the public calls below run their body under the volume lock, most inside a journal transaction
+int fs_create_body(F19FS_t *fs, const char *path, file_t type);
+int fs_open2_body(F19FS_t *fs, const char *path, unsigned flags);
+ssize_t fs_write_body(F19FS_t* fs, int fd, const void* src, size_t nbyte);
+int fs_ftruncate_body(F19FS_t *fs, int fd, off_t size);
+int fs_truncate_body(F19FS_t *fs, const char *path, off_t size);
+int fs_fallocate_body(F19FS_t *fs, int fd, off_t offset, off_t len);
+int fs_remove_body(F19FS_t *fs, const char *path);
+int fs_create_many_body(F19FS_t *fs, const char *dir, const char *const *names, size_t count, file_t type, int *results);
+int fs_remove_many_body(F19FS_t *fs, const char *dir, const char *const *names, size_t count, int *results);
+int fs_move_body(F19FS_t *fs, const char *src, const char *dst);
+int fs_link_body(F19FS_t *fs, const char *src, const char *dst);
+int fs_close_body(F19FS_t *fs, int fd);
+int fs_open_by_handle_body(F19FS_t *fs, const fs_handle_t *handle);
+int fs_openat_body(fs_dir_t *dir, const char *path);
+int fs_stat_body(F19FS_t *fs, const char *path, fs_stat_t *stat);
+int fs_fstat_body(F19FS_t *fs, int fd, fs_stat_t *stat);
+int fs_statfs_body(F19FS_t *fs, fs_statfs_t *stat);
+int fs_set_buffered_body(F19FS_t *fs, int fd, bool buffered);
+int fs_fsync_body(F19FS_t *fs, int fd);
+int fs_sync_body(F19FS_t *fs);
+ssize_t fs_snapshot_body(F19FS_t *fs, int fd, uint64_t base, uint64_t *generation);
+ssize_t fs_read_body(F19FS_t *fs, int fd, void *dst, size_t nbyte);
+
+// write the superblock of a volume laid out by this build, counters are left to fs_unmount
+void init_superblock(superblock_t* sb, uint16_t staleInodeBlocks) {
+    memset(sb, 0, sizeof(superblock_t));
+    sb->magic = SUPERBLOCK_MAGIC;
+    sb->version = SUPERBLOCK_VERSION;
+    sb->staleInodeBlocks = staleInodeBlocks;
+    sb->blockCount = block_store_get_total_blocks();
+    sb->blockSize = BLOCK_SIZE_BYTES;
+    sb->inodeCount = number_inodes;
+    sb->inodeSize = inode_size;
+    sb->inodeBitmapBlock = INODE_BITMAP_BLOCK;
+    sb->inodeTableStart = INODE_TABLE_START;
+    sb->inodeTableBlocks = INODE_TABLE_BLOCKS;
+}
+
+bool superblock_matches(const superblock_t* sb) {
+    return sb->blockCount == block_store_get_total_blocks() && sb->blockSize == BLOCK_SIZE_BYTES
+        && sb->inodeCount == number_inodes && sb->inodeSize == inode_size
+        && sb->inodeBitmapBlock == INODE_BITMAP_BLOCK && sb->inodeTableStart == INODE_TABLE_START
+        && sb->inodeTableBlocks == INODE_TABLE_BLOCKS;
+}
+
+// metadata changes of one operation are journaled together, data blocks are not journaled
+void fs_tx_begin(F19FS_t* fs) {
+    if (fs && fs->journal) {
+        journal_begin(fs->journal);
+    }
+}
+
+void fs_tx_end(F19FS_t* fs) {
+    if (fs && fs->journal) {
+        journal_end(fs->journal);
+    }
+}
+
+// the public calls hold the volume lock around their body, the ring workers take the same lock
+void fs_lock(F19FS_t* fs, bool exclusive) {
+    if (fs) {
+        if (exclusive) {
+            pthread_rwlock_wrlock(&fs->lock);
+        } else {
+            pthread_rwlock_rdlock(&fs->lock);
+        }
+    }
+}
+
+void fs_unlock(F19FS_t* fs) {
+    if (fs) {
+        pthread_rwlock_unlock(&fs->lock);
+    }
+}
+
+// a public call that changes metadata runs alone on the volume, inside one journal transaction
+void fs_op_begin(F19FS_t* fs) {
+    fs_lock(fs, true);
+    fs_tx_begin(fs);
+}
+
+void fs_op_end(F19FS_t* fs) {
+    fs_tx_end(fs);
+    fs_unlock(fs);
+}
+
+// block store hook, bitmaps and inodes are about to change at addr
+void meta_hook(void* arg, const void* addr) {
+    F19FS_t* fs = (F19FS_t*)arg;
+    size_t blockID = ((const uint8_t*)addr - block_store_get_data(fs->BlockStore_whole)) / BLOCK_SIZE_BYTES;
+    block_store_mark_dirty(fs->BlockStore_whole, blockID, 1);
+    if (fs->journal) {
+        journal_touch(fs->journal, blockID);
+    }
+}
+
+// the superblock is written in place, tell the journal and the dirty tracking
+void touch_superblock(F19FS_t* fs) {
+    if (fs->journal) {
+        journal_touch(fs->journal, INODE_BITMAP_BLOCK);
+    }
+    block_store_mark_dirty(fs->BlockStore_whole, INODE_BITMAP_BLOCK, 1);
+}
+
+// write a directory, pointer or inode table block
+size_t write_meta_block(F19FS_t* fs, size_t blockID, const void* buffer) {
+    if (fs->journal) {
+        journal_touch(fs->journal, blockID);
+    }
+    return block_store_write(fs->BlockStore_whole, blockID, buffer);
+}
+
+// zero the inode table block holding inodeID if an in-place format left it stale
+void zero_inode_block(F19FS_t* fs, size_t inodeID) {
+    size_t tableBlock = inodeID * inode_size / BLOCK_SIZE_BYTES;
+    if ((fs->sb->staleInodeBlocks >> tableBlock) & 1) {
+        uint8_t zeros[BLOCK_SIZE_BYTES] = {0};
+        write_meta_block(fs, INODE_TABLE_START + tableBlock, zeros);
+        touch_superblock(fs);
+        fs->sb->staleInodeBlocks &= ~(1u << tableBlock);
+    }
+}
+
+// take a free inode, SIZE_MAX when they are used up
+size_t allocate_inode(F19FS_t* fs) {
+    size_t inodeID = block_store_allocate(fs->BlockStore_inode);
+    if (inodeID != SIZE_MAX) {
+        zero_inode_block(fs, inodeID);
+    }
+    return inodeID;
+}
+
+// the generation a new inode in this slot gets, release_inode left it there
+uint32_t slot_generation(F19FS_t* fs, size_t inodeID) {
+    inode_t slot;
+    block_store_inode_read_inline(fs->BlockStore_inode, inodeID, &slot);
+    return slot.generation;
+}
+
+// clear an inode and give its slot back, handles to the file it held go stale
+void release_inode(F19FS_t* fs, size_t inodeID, inode_t* inode) {
+    uint32_t generation = inode->generation + 1;
+    memset(inode, 0, sizeof(inode_t));
+    inode->generation = generation;
+    block_store_inode_write_inline(fs->BlockStore_inode, inodeID, inode);
+    block_store_release(fs->BlockStore_inode, inodeID);
+}
+
+// point a freshly allocated descriptor at the beginning of a file, usage takes the FD_* bits given
+void init_descriptor(F19FS_t* fs, size_t fd_ID, size_t inodeID, uint8_t usage) {
+    fileDescriptor_t fd;
+    memset(&fd, 0, sizeof(fileDescriptor_t));
+    fd.inodeNum = inodeID;
+    fd.usage = 1 | usage;
+    block_store_fd_write_inline(fs->BlockStore_fd, fd_ID, &fd);
+    memset(&fs->readahead[fd_ID], 0, sizeof(readahead_t));
+}
+
 /// Formats (and mounts) an F19FS file for use
 /// \param fname The file to format
 /// \return Mounted F19FS object, NULL on error
 ///
 F19FS_t *fs_format(const char *path) {
+    return fs_format_ex(path, 0);
+}
+
+F19FS_t *fs_format_ex(const char *path, unsigned flags) {
     if(path != NULL && strlen(path) != 0)
     {
         F19FS_t * ptr_F19FS = (F19FS_t *)calloc(1, sizeof(F19FS_t));	// get started
-        ptr_F19FS->BlockStore_whole = block_store_create(path);				// pointer to start of a large chunck of memory
+        ptr_F19FS->BlockStore_whole = block_store_create_ex(path, (flags & FS_FORMAT_IN_PLACE) ? BLOCK_STORE_IN_PLACE : 0);	// pointer to start of a large chunck of memory
+        if (ptr_F19FS->BlockStore_whole == NULL) {
+            free(ptr_F19FS);
+            return NULL;
+        }
+        if (flags & FS_FORMAT_IN_PLACE) {
+            // the old inode bitmap goes now, the old inode table as its blocks get used
+            uint8_t zeros[BLOCK_SIZE_BYTES] = {0};
+            block_store_write(ptr_F19FS->BlockStore_whole, 0, zeros);
+            block_store_discard(ptr_F19FS->BlockStore_whole, INODE_TABLE_START + INODE_TABLE_BLOCKS, BLOCK_STORE_AVAIL_BLOCKS - INODE_TABLE_START - INODE_TABLE_BLOCKS);
+        }
+        ptr_F19FS->sb = (superblock_t *)(block_store_Data_location(ptr_F19FS->BlockStore_whole) + SUPERBLOCK_OFFSET);
+        init_superblock(ptr_F19FS->sb, (flags & FS_FORMAT_IN_PLACE) ? (uint16_t)((1u << INODE_TABLE_BLOCKS) - 1) : 0);
 
         // reserve the 1st block for bitmap of inode
         size_t bitmap_ID = block_store_allocate(ptr_F19FS->BlockStore_whole);
@@ -258,11 +609,32 @@ F19FS_t *fs_format(const char *path) {
             //			printf("all the way with block %zu\n", block_store_allocate(ptr_F19FS->BlockStore_whole));
         }
 
+        if (flags & FS_FORMAT_JOURNAL) {
+            // the inode table was just taken, so the run starts right after it
+            size_t journalLength = 0;
+            size_t journalStart = block_store_allocate_run(ptr_F19FS->BlockStore_whole, JOURNAL_BLOCKS, &journalLength);
+            if (journalStart != SIZE_MAX && journalLength == JOURNAL_BLOCKS) {
+                ptr_F19FS->journal = journal_create(ptr_F19FS->BlockStore_whole, journalStart, JOURNAL_BLOCKS);
+            }
+            if (!ptr_F19FS->journal) {
+                block_store_destroy(ptr_F19FS->BlockStore_whole);
+                free(ptr_F19FS);
+                return NULL;
+            }
+            ptr_F19FS->sb->features |= FEATURE_JOURNAL;
+            ptr_F19FS->sb->journalStart = journalStart;
+            ptr_F19FS->sb->journalBlocks = JOURNAL_BLOCKS;
+        }
+        if (flags & FS_FORMAT_SPARSE) {
+            ptr_F19FS->sb->features |= FEATURE_SPARSE;
+        }
+
         // install inode block store inside the whole block store
         ptr_F19FS->BlockStore_inode = block_store_inode_create(block_store_Data_location(ptr_F19FS->BlockStore_whole) + bitmap_ID * BLOCK_SIZE_BYTES, block_store_Data_location(ptr_F19FS->BlockStore_whole) + inode_start_block * BLOCK_SIZE_BYTES);
+        block_store_set_used_blocks(ptr_F19FS->BlockStore_inode, 0);
 
         // the first inode is reserved for root dir
-        block_store_sub_allocate(ptr_F19FS->BlockStore_inode);
+        allocate_inode(ptr_F19FS);
         //		printf("first inode ID = %zu\n", block_store_sub_allocate(ptr_F19FS->BlockStore_inode));
 
         // update the root inode info.
@@ -274,12 +646,18 @@ F19FS_t *fs_format(const char *path) {
         root_inode->inodeNumber = root_inode_ID;
         root_inode->linkCount = 1;
         //		root_inode->directPointer[0] = root_data_ID;	// not allocate date block for it until it has a sub-folder or file
-        block_store_inode_write(ptr_F19FS->BlockStore_inode, root_inode_ID, root_inode);		
+        block_store_inode_write_inline(ptr_F19FS->BlockStore_inode, root_inode_ID, root_inode);		
         free(root_inode);
 
         // now allocate space for the file descriptors
         ptr_F19FS->BlockStore_fd = block_store_fd_create();
 
+        block_store_set_hook(ptr_F19FS->BlockStore_whole, meta_hook, ptr_F19FS);
+        block_store_set_hook(ptr_F19FS->BlockStore_inode, meta_hook, ptr_F19FS);
+
+        pthread_rwlock_init(&ptr_F19FS->lock, NULL);
+        ptr_F19FS->ring = fs_ring_create();
+
         return ptr_F19FS;
     }
 
@@ -296,23 +674,111 @@ F19FS_t *fs_format(const char *path) {
 
 ///
 F19FS_t *fs_mount(const char *path) {
+    return fs_mount_ex(path, 0);
+}
+
+// keep a directory block resident when the volume was mounted with FS_MOUNT_MLOCK_META
+bool pin_dir_block(F19FS_t *fs, size_t blockID) {
+    return !(fs->mount_flags & FS_MOUNT_MLOCK_META) || block_store_lock(fs->BlockStore_whole, blockID, 1);
+}
+
+// lock the bitmaps, the inode table and every directory block in memory
+bool pin_metadata(F19FS_t *fs) {
+    if (!block_store_lock(fs->BlockStore_whole, 0, 1 + number_inodes * inode_size / BLOCK_SIZE_BYTES)
+        || !block_store_lock(fs->BlockStore_whole, BLOCK_STORE_AVAIL_BLOCKS, BLOCK_STORE_NUM_BLOCKS - BLOCK_STORE_AVAIL_BLOCKS)) {
+        return false;
+    }
+    inode_t inode;
+    for (size_t i = 0; i < number_inodes; i++) {
+        if (!block_store_sub_test(fs->BlockStore_inode, i)) {
+            continue;
+        }
+        block_store_inode_read_inline(fs->BlockStore_inode, i, &inode);
+        if (inode.fileType == 'd' && inode.directPointer[0] != 0 && !pin_dir_block(fs, inode.directPointer[0])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+F19FS_t *fs_mount_ex(const char *path, unsigned flags) {
     if(path != NULL && strlen(path) != 0)
     {
         F19FS_t * ptr_F19FS = (F19FS_t *)calloc(1, sizeof(F19FS_t));	// get started
-        ptr_F19FS->BlockStore_whole = block_store_open(path);	// get the chunck of data	
+        unsigned bs_flags = 0;
+        if (flags & FS_MOUNT_POPULATE) {
+            bs_flags |= BLOCK_STORE_POPULATE;
+        }
+        if (flags & FS_MOUNT_HUGEPAGE) {
+            bs_flags |= BLOCK_STORE_HUGEPAGE;
+        }
+        ptr_F19FS->BlockStore_whole = block_store_open_ex(path, bs_flags);	// get the chunck of data	
+        if (ptr_F19FS->BlockStore_whole == NULL) {
+            free(ptr_F19FS);
+            return NULL;
+        }
+        ptr_F19FS->mount_flags = flags;
+        superblock_t * sb = (superblock_t *)(block_store_Data_location(ptr_F19FS->BlockStore_whole) + SUPERBLOCK_OFFSET);
+        ptr_F19FS->sb = sb;
+        if (sb->magic != SUPERBLOCK_MAGIC || sb->version < SUPERBLOCK_VERSION) {
+            // volumes formatted before the superblock (or its geometry) existed all share this layout,
+            //  their counters were never saved
+            init_superblock(sb, sb->magic == SUPERBLOCK_MAGIC ? sb->staleInodeBlocks : 0);
+        } else if (sb->version > SUPERBLOCK_VERSION || !superblock_matches(sb)) {
+            block_store_destroy(ptr_F19FS->BlockStore_whole);
+            free(ptr_F19FS);
+            return NULL;
+        }
 
         // the bitmap block should be the 1st one
-        size_t bitmap_ID = 0;
+        size_t bitmap_ID = sb->inodeBitmapBlock;
 
         // the inode blocks start with the 2nd block, and goes around until the 17th block, 16 in total
-        size_t inode_start_block = 1;
+        size_t inode_start_block = sb->inodeTableStart;
 
         // attach the bitmaps to their designated place
         ptr_F19FS->BlockStore_inode = block_store_inode_create(block_store_Data_location(ptr_F19FS->BlockStore_whole) + bitmap_ID * BLOCK_SIZE_BYTES, block_store_Data_location(ptr_F19FS->BlockStore_whole) + inode_start_block * BLOCK_SIZE_BYTES);
 
+        if (sb->features & FEATURE_JOURNAL) {
+            ptr_F19FS->journal = journal_open(ptr_F19FS->BlockStore_whole, sb->journalStart, sb->journalBlocks);
+            // after a crash the bitmaps only agree with the rest once the journal is applied
+            if (!ptr_F19FS->journal || journal_replay(ptr_F19FS->journal) < 0) {
+                journal_close(ptr_F19FS->journal);
+                block_store_inode_destroy(ptr_F19FS->BlockStore_inode);
+                block_store_destroy(ptr_F19FS->BlockStore_whole);
+                free(ptr_F19FS);
+                return NULL;
+            }
+        }
+        block_store_set_hook(ptr_F19FS->BlockStore_whole, meta_hook, ptr_F19FS);
+        block_store_set_hook(ptr_F19FS->BlockStore_inode, meta_hook, ptr_F19FS);
+
+        if (sb->clean) {
+            // nothing ran since fs_unmount saved the counters, no need to look at the bitmaps
+            block_store_set_used_blocks(ptr_F19FS->BlockStore_whole, sb->usedBlocks);
+            block_store_set_used_blocks(ptr_F19FS->BlockStore_inode, sb->usedInodes);
+        } else {
+            // crashed (or never unmounted by this version), rebuild the counters from the bitmaps
+            block_store_set_used_blocks(ptr_F19FS->BlockStore_whole, SIZE_MAX);
+            block_store_set_used_blocks(ptr_F19FS->BlockStore_inode, SIZE_MAX);
+        }
+        sb->clean = 0;
+        touch_superblock(ptr_F19FS);
+
+        if ((flags & FS_MOUNT_MLOCK_META) && !pin_metadata(ptr_F19FS)) {
+            journal_close(ptr_F19FS->journal);
+            block_store_inode_destroy(ptr_F19FS->BlockStore_inode);
+            block_store_destroy(ptr_F19FS->BlockStore_whole);
+            free(ptr_F19FS);
+            return NULL;
+        }
+
         // since file descriptors are allocated outside of the whole blocks, we can simply reallocate space for it.
         ptr_F19FS->BlockStore_fd = block_store_fd_create();
 
+        pthread_rwlock_init(&ptr_F19FS->lock, NULL);
+        ptr_F19FS->ring = fs_ring_create();
+
         return ptr_F19FS;
     }
 
@@ -330,13 +796,30 @@ F19FS_t *fs_mount(const char *path) {
 int fs_unmount(F19FS_t *fs) {
     if(fs != NULL)
     {	
+        // let the workers drain whatever is still queued before the mapping goes away
+        fs_ring_destroy(fs->ring);
+        bool flushed = write_back_all(fs) == 0;
+        pthread_rwlock_destroy(&fs->lock);
+        // pages that found no room are lost with the mount, the result says so
+        for (size_t i = 0; i < number_inodes; i++) {
+            drop_page_cache(fs, i);
+        }
+
+        // the counters are only trusted by the next mount if nothing can change after them
+        fs->sb->usedBlocks = block_store_get_used_blocks(fs->BlockStore_whole);
+        fs->sb->usedInodes = block_store_get_used_blocks(fs->BlockStore_inode);
+        fs->sb->clean = flushed;
+        touch_superblock(fs);
+        // writes everything back, so the flag and the counters are durable with the rest
+        journal_close(fs->journal);
+
         block_store_inode_destroy(fs->BlockStore_inode);
 
         block_store_destroy(fs->BlockStore_whole);
         block_store_fd_destroy(fs->BlockStore_fd);
 
         free(fs);
-        return 0;
+        return flushed ? 0 : -2;
     }
     return -1;
 }
@@ -388,26 +871,25 @@ int fs_create2(F19FS_t *fs, const char *path, file_t type) {
     }
     inode_t parentDirInode;
     directoryFile_t* parentDir = calloc(1, BLOCK_SIZE_BYTES);
-    if (block_store_inode_read(fs->BlockStore_inode, parentDirInodeID, &parentDirInode) == 0 || block_store_read(fs->BlockStore_whole, parentDirInode.directPointer[0], parentDir) == 0) {
+    if (block_store_inode_read_inline(fs->BlockStore_inode, parentDirInodeID, &parentDirInode) == 0 || block_store_read_inline(fs->BlockStore_whole, parentDirInode.directPointer[0], parentDir) == 0) {
         free(parentDir);
         return -8;
     }
-    bitmap_t* entry_bm = bitmap_overlay(NUM_OF_ENTRIES, &(parentDirInode.vacantFile));
-    size_t total_set = bitmap_total_set(entry_bm);
-    if (total_set == NUM_OF_ENTRIES) {
-        bitmap_destroy(entry_bm);
+    if ((parentDirInode.vacantFile & ENTRY_BITS) == ENTRY_BITS) {
         free(parentDir);
         return -9;
     }
+    bitmap_view_t entry_bm_view;
+    bitmap_t* entry_bm = bitmap_view(&entry_bm_view, NUM_OF_ENTRIES, &(parentDirInode.vacantFile));
     size_t next_entry = bitmap_ffz(entry_bm);
-    bitmap_set(entry_bm, next_entry);
-    bitmap_destroy(entry_bm);
+    bitmap_set_inline(entry_bm, next_entry);
 
-    size_t fileInodeID = block_store_allocate(fs->BlockStore_inode);
+    size_t fileInodeID = allocate_inode(fs);
     inode_t fileInode;
 
     fileInode.linkCount = 1;
     fileInode.inodeNumber = fileInodeID;
+    fileInode.generation = slot_generation(fs, fileInodeID);
     // printf("new inodeID: %lu\n", fileInodeID);
 
     if (type == FS_DIRECTORY) {
@@ -416,14 +898,22 @@ int fs_create2(F19FS_t *fs, const char *path, file_t type) {
         strncpy(fileInode.owner, owner, strlen(owner));
         fileInode.fileType = 'd';						
 
-        size_t first_free_blocks = block_store_allocate(fs->BlockStore_whole); 
+        size_t first_free_blocks = allocate_block(fs);
         if (first_free_blocks == SIZE_MAX) {
+            block_store_release(fs->BlockStore_inode, fileInodeID);
             free(parentDir);
             return -10;
         }
+        // under FS_MOUNT_MLOCK_META an unpinned directory block is an error, not a silent fallback
+        if (!pin_dir_block(fs, first_free_blocks)) {
+            block_store_release(fs->BlockStore_whole, first_free_blocks);
+            block_store_release(fs->BlockStore_inode, fileInodeID);
+            free(parentDir);
+            return -13;
+        }
         fileInode.directPointer[0] = first_free_blocks;
         directoryFile_t* newDB = init_db();
-        block_store_write(fs->BlockStore_whole, first_free_blocks, newDB);
+        write_meta_block(fs, first_free_blocks, newDB);
         free(newDB);
         fileInode.fileSize = BLOCK_SIZE_BYTES;
     }
@@ -437,12 +927,12 @@ int fs_create2(F19FS_t *fs, const char *path, file_t type) {
         fileInode.doubleIndirectPointer = 0x0000;
     }
     // printf("inodeID: %lu\n", fileInodeID);
-    if (block_store_inode_write(fs->BlockStore_inode, fileInodeID, &fileInode) != inode_size) {
+    if (block_store_inode_write_inline(fs->BlockStore_inode, fileInodeID, &fileInode) != inode_size) {
         free(parentDir);
         return -11;
     }
     // we have change the parentInode's entry, so rewrite it
-    if (block_store_inode_write(fs->BlockStore_inode, parentDirInodeID, &parentDirInode) != inode_size) {
+    if (block_store_inode_write_inline(fs->BlockStore_inode, parentDirInodeID, &parentDirInode) != inode_size) {
         free(parentDir);
         return -12;
     }
@@ -450,7 +940,7 @@ int fs_create2(F19FS_t *fs, const char *path, file_t type) {
     strcpy((parentDir + next_entry)->filename, fileName);
     (parentDir + next_entry)->inodeNumber = fileInodeID;
 
-    if (block_store_write(fs->BlockStore_whole, parentDirInode.directPointer[0], parentDir) != BLOCK_SIZE_BYTES) {
+    if (write_meta_block(fs, parentDirInode.directPointer[0], parentDir) != BLOCK_SIZE_BYTES) {
         return -13;
         free(parentDir);
     }
@@ -467,204 +957,63 @@ int fs_create2(F19FS_t *fs, const char *path, file_t type) {
 /// \return 0 on success, < 0 on failure
 ///
 int fs_create(F19FS_t *fs, const char *path, file_t type) {
-    if(fs != NULL && path != NULL && strlen(path) != 0 && (type == FS_REGULAR || type == FS_DIRECTORY))
-    {
-        char* copy_path = (char*)calloc(1, 65535);
-        strcpy(copy_path, path);
-        char** tokens;		// tokens are the directory names along the path. The last one is the name for the new file or dir
-        size_t count = 0;
-        tokens = str_split(copy_path, '/', &count);
-        free(copy_path);
-        if(tokens == NULL)
-        {
-            return -1;
-        }
-
-        // let's check if the filenames are valid or not
-        for(size_t n = 0; n < count; n++)
-        {	
-            if(isValidFileName(*(tokens + n)) == false)
-            {
-                // before any return, we need to free tokens, otherwise memory leakage
-                for (size_t i = 0; i < count; i++)
-                {
-                    free(*(tokens + i));
-                }
-                free(tokens);
-                return -1;
-            }
-        }
-
-        size_t parent_inode_ID = 0;	// start from the 1st inode, ie., the inode for root directory
-        // first, let's find the parent dir
-        size_t indicator = 0;
-
-        // we declare parent_inode and parent_data here since it will still be used after the for loop
-        directoryFile_t * parent_data = (directoryFile_t *)calloc(1, BLOCK_SIZE_BYTES);
-        inode_t * parent_inode = (inode_t *) calloc(1, sizeof(inode_t));	
-
-        for(size_t i = 0; i < count - 1; i++)
-        {
-            block_store_inode_read(fs->BlockStore_inode, parent_inode_ID, parent_inode);	// read out the parent inode
-            // in case file and dir has the same name
-            if(parent_inode->fileType == 'd')
-            {
-                block_store_read(fs->BlockStore_whole, parent_inode->directPointer[0], parent_data);
-
-                for(int j = 0; j < folder_number_entries; j++)
-                {
-                    if( ((parent_inode->vacantFile >> j) & 1) == 1 && strcmp((parent_data + j) -> filename, *(tokens + i)) == 0 )
-                    {
-                        parent_inode_ID = (parent_data + j) -> inodeNumber;
-                        indicator++;
-                    }					
-                }
-            }					
-        }
-        //		printf("indicator = %zu\n", indicator);
-        //		printf("parent_inode_ID = %lu\n", parent_inode_ID);
-
-        // read out the parent inode
-        block_store_inode_read(fs->BlockStore_inode, parent_inode_ID, parent_inode);
-        if(indicator == count - 1 && parent_inode->fileType == 'd')
-        {
-            // same file or dir name in the same path is intolerable
-            for(int m = 0; m < folder_number_entries; m++)
-            {
-                // rid out the case of existing same file or dir name
-                if( ((parent_inode->vacantFile >> m) & 1) == 1)
-                {
-                    // before read out parent_data, we need to make sure it does exist!
-                    block_store_read(fs->BlockStore_whole, parent_inode->directPointer[0], parent_data);
-                    if( strcmp((parent_data + m) -> filename, *(tokens + count - 1)) == 0 )
-                    {
-                        free(parent_data);
-                        free(parent_inode);	
-                        // before any return, we need to free tokens, otherwise memory leakage
-                        for (size_t i = 0; i < count; i++)
-                        {
-                            free(*(tokens + i));
-                        }
-                        free(tokens);
-                        return -1;											
-                    }
-                }
-            }	
-
-            // cannot declare k inside for loop, since it will be used later.
-            int k = 0;
-            for( ; k < folder_number_entries; k++)
-            {
-                if( ((parent_inode->vacantFile >> k) & 1) == 0 )
-                    break;
-            }
-
-            // if k == 0, then we have to declare a new parent data block
-            //			printf("k = %d\n", k);
-            if(k == 0)
-            {
-                size_t parent_data_ID = block_store_allocate(fs->BlockStore_whole);
-                //					printf("parent_data_ID = %zu\n", parent_data_ID);
-                if(parent_data_ID < BLOCK_STORE_AVAIL_BLOCKS)
-                {
-                    parent_inode->directPointer[0] = parent_data_ID;
-                }
-                else
-                {
-                    free(parent_inode);
-                    free(parent_data);
-                    // before any return, we need to free tokens, otherwise memory leakage
-                    for (size_t i = 0; i < count; i++)
-                    {
-                        free(*(tokens + i));
-                    }
-                    free(tokens);
-                    return -1;												
-                }
-            }
-
-            if(k < folder_number_entries)	// k == folder_number_entries means this directory is full
-            {
-                size_t child_inode_ID = block_store_allocate(fs->BlockStore_inode);
-                // printf("new child_inode_ID = %zu\n", child_inode_ID);
-                // ugh, inodes are used up
-                if(child_inode_ID == SIZE_MAX)
-                {
-                    free(parent_data);
-                    free(parent_inode);
-                    // before any return, we need to free tokens, otherwise memory leakage
-                    for (size_t i = 0; i < count; i++)
-                    {
-                        free(*(tokens + i));
-                    }
-                    free(tokens);
-                    return -1;	
-                }
-
-                // wow, at last, we make it!				
-                // update the parent inode
-                parent_inode->vacantFile |= (1 << k);
-                // in the following cases, we should allocate parent data first: 
-                // 1)the parent dir is not the root dir; 
-                // 2)the file or dir to create is to be the 1st in the parent dir
-
-                block_store_inode_write(fs->BlockStore_inode, parent_inode_ID, parent_inode);	
-
-                // update the parent directory file block
-                block_store_read(fs->BlockStore_whole, parent_inode->directPointer[0], parent_data);
-                strcpy((parent_data + k)->filename, *(tokens + count - 1));
-                //				printf("the newly created file's name is: %s\n", (parent_data + k)->filename);
-                (parent_data + k)->inodeNumber = child_inode_ID;
-                block_store_write(fs->BlockStore_whole, parent_inode->directPointer[0], parent_data);
-
-                // update the newly created inode
-                inode_t * child_inode = (inode_t *) calloc(1, sizeof(inode_t));
-                child_inode->vacantFile = 0;
-                if(type == FS_REGULAR)
-                {
-                    child_inode->fileType = 'r';
-                }
-                else if(type == FS_DIRECTORY)
-                {
-                    child_inode->fileType = 'd';
-                }	
-
-                child_inode->inodeNumber = child_inode_ID;
-                // printf("new_inode: %lu\n", child_inode_ID);
-                child_inode->fileSize = 0;
-                child_inode->linkCount = 1;
-                block_store_inode_write(fs->BlockStore_inode, child_inode_ID, child_inode);
-
-                //				printf("after creation, parent_inode->vacantFile = %d\n", parent_inode->vacantFile);
-
-
+    fs_op_begin(fs);
+    int result = fs_create_body(fs, path, type);
+    fs_op_end(fs);
+    return result;
+}
 
-                // free the temp space
-                free(parent_inode);
-                free(parent_data);
-                free(child_inode);
-                // before any return, we need to free tokens, otherwise memory leakage
-                for (size_t i = 0; i < count; i++)
-                {
-                    free(*(tokens + i));
-                }
-                free(tokens);					
-                return 0;
-            }				
-        }
-        // before any return, we need to free tokens, otherwise memory leakage
-        for (size_t i = 0; i < count; i++)
-        {
-            free(*(tokens + i));
-        }
-        free(tokens); 
-        free(parent_inode);	
-        free(parent_data);
+int fs_create_body(F19FS_t *fs, const char *path, file_t type) {
+    if (fs == NULL || !(type == FS_REGULAR || type == FS_DIRECTORY)) {
+        return -1;
     }
-    return -1;
+    inode_t inode;
+    int error;
+    return lookupOrCreate(fs, path, FS_OPEN_CREATE | FS_OPEN_EXCL, type, &inode, &error) == SIZE_MAX ? -1 : 0;
 }
 
-
+// the shared core of fs_create and fs_open2: one walk to the parent directory, then the name is
+//  looked up in it and, with FS_OPEN_CREATE, created in the same block
+// fills inode and returns its ID, SIZE_MAX with the fs_open2 error code in error otherwise
+size_t lookupOrCreate(F19FS_t* fs, const char* path, unsigned flags, file_t type, inode_t* inode, int* error) {
+    *error = -1;
+    if (path == NULL || *path != '/') {
+        return SIZE_MAX;
+    }
+    const char* name = strrchr(path, '/') + 1;
+    if (*name == '\0' || strlen(name) >= FS_FNAME_MAX) {
+        return SIZE_MAX;
+    }
+    // the parent is the path up to its last '/', walked in place
+    size_t parentLength = name - path - 1;
+    inode_t dirInode;
+    size_t dirInodeID = SIZE_MAX;
+    if (block_store_inode_read_inline(fs->BlockStore_inode, 0, &dirInode) != 0) {
+        dirInodeID = resolveSpan(fs, 0, path + 1, parentLength ? parentLength - 1 : 0, &dirInode);
+    }
+    *error = -2;
+    if (dirInodeID == SIZE_MAX || dirInode.fileType != 'd') {
+        return SIZE_MAX;
+    }
+    *inode = dirInode;
+    size_t inodeID = resolveFrom(fs, dirInodeID, name, inode);
+    if (inodeID != SIZE_MAX) {
+        *error = -3;
+        return (flags & FS_OPEN_CREATE) && (flags & FS_OPEN_EXCL) ? SIZE_MAX : inodeID;
+    }
+    if ((flags & FS_OPEN_CREATE) == 0) {
+        return SIZE_MAX;
+    }
+    int result = -4;
+    createInDir(fs, dirInodeID, &dirInode, &name, 1, type, &result);
+    *error = -4;
+    if (result < 0) {
+        return SIZE_MAX;
+    }
+    // only the parent's block is searched again
+    *inode = dirInode;
+    return resolveFrom(fs, dirInodeID, name, inode);
+}
 
 ///
 /// Opens the specified file for use
@@ -675,116 +1024,45 @@ int fs_create(F19FS_t *fs, const char *path, file_t type) {
 /// \return file descriptor to the requested file, < 0 on error
 ///
 int fs_open(F19FS_t *fs, const char *path) {
-    if(fs != NULL && path != NULL && strlen(path) != 0)
-    {
-        char* copy_path = (char*)calloc(1, 65535);
-        strcpy(copy_path, path);
-        char** tokens;		// tokens are the directory names along the path. The last one is the name for the new file or dir
-        size_t count = 0;
-        tokens = str_split(copy_path, '/', &count);
-        free(copy_path);
-        if(tokens == NULL)
-        {
-            return -1;
-        }
-
-        // let's check if the filenames are valid or not
-        for(size_t n = 0; n < count; n++)
-        {	
-            if(isValidFileName(*(tokens + n)) == false)
-            {
-                // before any return, we need to free tokens, otherwise memory leakage
-                for (size_t i = 0; i < count; i++)
-                {
-                    free(*(tokens + i));
-                }
-                free(tokens);
-                return -1;
-            }
-        }	
+    return fs_open2(fs, path, 0);
+}
 
-        size_t parent_inode_ID = 0;	// start from the 1st inode, ie., the inode for root directory
-        // first, let's find the parent dir
-        size_t indicator = 0;
-
-        inode_t * parent_inode = (inode_t *) calloc(1, sizeof(inode_t));
-        directoryFile_t * parent_data = (directoryFile_t *)calloc(1, BLOCK_SIZE_BYTES);			
-
-        // locate the file
-        for(size_t i = 0; i < count; i++)
-        {		
-            block_store_inode_read(fs->BlockStore_inode, parent_inode_ID, parent_inode);	// read out the parent inode
-            if(parent_inode->fileType == 'd')
-            {
-                block_store_read(fs->BlockStore_whole, parent_inode->directPointer[0], parent_data);
-                //printf("parent_inode->vacantFile = %d\n", parent_inode->vacantFile);
-                for(int j = 0; j < folder_number_entries; j++)
-                {
-                    //printf("(parent_data + j) -> filename = %s\n", (parent_data + j) -> filename);
-                    if( ((parent_inode->vacantFile >> j) & 1) == 1 && strcmp((parent_data + j) -> filename, *(tokens + i)) == 0 )
-                    {
-                        parent_inode_ID = (parent_data + j) -> inodeNumber;
-                        indicator++;
-                    }					
-                }
-            }					
-        }		
-        free(parent_data);			
-        free(parent_inode);	
-        //printf("indicator = %zu\n", indicator);
-        //printf("count = %zu\n", count);
-        // now let's open the file
-        if(indicator == count)
-        {
-            size_t fd_ID = block_store_sub_allocate(fs->BlockStore_fd);
-            //printf("fd_ID = %zu\n", fd_ID);
-            // it could be possible that fd runs out
-            if(fd_ID < number_fd)
-            {
-                size_t file_inode_ID = parent_inode_ID;
-                inode_t * file_inode = (inode_t *) calloc(1, sizeof(inode_t));
-                block_store_inode_read(fs->BlockStore_inode, file_inode_ID, file_inode);	// read out the file inode	
-
-                // it's too bad if file to be opened is a dir 
-                if(file_inode->fileType == 'd')
-                {
-                    free(file_inode);
-                    // before any return, we need to free tokens, otherwise memory leakage
-                    for (size_t i = 0; i < count; i++)
-                    {
-                        free(*(tokens + i));
-                    }
-                    free(tokens);
-                    return -1;
-                }
+int fs_open2(F19FS_t *fs, const char *path, unsigned flags) {
+    // a plain open changes nothing on the device, only creating or truncating needs a transaction
+    if ((flags & (FS_OPEN_CREATE | FS_OPEN_TRUNC)) == 0) {
+        fs_lock(fs, true);
+        int result = fs_open2_body(fs, path, flags);
+        fs_unlock(fs);
+        return result;
+    }
+    fs_op_begin(fs);
+    int result = fs_open2_body(fs, path, flags);
+    fs_op_end(fs);
+    return result;
+}
 
-                // assign a file descriptor ID to the open behavior
-                fileDescriptor_t * fd = (fileDescriptor_t *)calloc(1, sizeof(fileDescriptor_t));
-                fd->inodeNum = file_inode_ID;
-                fd->usage = 1;
-                fd->locate_order = 0; // R/W position is set to the beginning of the file (BOF)
-                fd->locate_offset = 0;
-                block_store_fd_write(fs->BlockStore_fd, fd_ID, fd);
-
-                free(file_inode);
-                free(fd);
-                // before any return, we need to free tokens, otherwise memory leakage
-                for (size_t i = 0; i < count; i++)
-                {
-                    free(*(tokens + i));
-                }
-                free(tokens);			
-                return fd_ID;
-            }	
-        }
-        // before any return, we need to free tokens, otherwise memory leakage
-        for (size_t i = 0; i < count; i++)
-        {
-            free(*(tokens + i));
-        }
-        free(tokens);
+int fs_open2_body(F19FS_t *fs, const char *path, unsigned flags) {
+    if (fs == NULL || (flags & ~(FS_OPEN_CREATE | FS_OPEN_EXCL | FS_OPEN_TRUNC | FS_OPEN_APPEND))) {
+        return -1;
     }
-    return -1;
+    // take the descriptor first, running out of them must not leave a new file behind
+    size_t fd_ID = block_store_sub_allocate(fs->BlockStore_fd);
+    if (fd_ID >= number_fd) {
+        return -6;
+    }
+    inode_t inode;
+    int error;
+    size_t inodeID = lookupOrCreate(fs, path, flags, FS_REGULAR, &inode, &error);
+    if (inodeID == SIZE_MAX || inode.fileType == 'd') {
+        block_store_sub_release(fs->BlockStore_fd, fd_ID);
+        return inodeID == SIZE_MAX ? error : -5;
+    }
+    init_descriptor(fs, fd_ID, inodeID, (flags & FS_OPEN_APPEND) ? FD_APPEND : 0);
+    if ((flags & FS_OPEN_TRUNC) && getFileSize(fs, &inode) != 0 && fs_ftruncate_body(fs, fd_ID, 0) < 0) {
+        block_store_sub_release(fs->BlockStore_fd, fd_ID);
+        return -7;
+    }
+    return fd_ID;
 }
 
 ///
@@ -794,13 +1072,24 @@ int fs_open(F19FS_t *fs, const char *path) {
 /// \return 0 on success, < 0 on failure
 ///
 int fs_close(F19FS_t *fs, int fd) {
+    fs_lock(fs, true);
+    int result = fs_close_body(fs, fd);
+    fs_unlock(fs);
+    return result;
+}
+
+int fs_close_body(F19FS_t *fs, int fd) {
     if(fs != NULL && fd >=0 && fd < number_fd)
     {
         // first, make sure this fd is in use
         if(block_store_sub_test(fs->BlockStore_fd, fd))
         {
+            // staged pages of the file reach the device no later than close
+            fileDescriptor_t fileDescriptor;
+            block_store_fd_read_inline(fs->BlockStore_fd, fd, &fileDescriptor);
+            int result = write_back_inode(fs, fileDescriptor.inodeNum);
             block_store_sub_release(fs->BlockStore_fd, fd);
-            return 0;
+            return result;
         }	
     }
     return -1;
@@ -808,179 +1097,413 @@ int fs_close(F19FS_t *fs, int fd) {
 
 ///
 /// Populates a dyn_array with information about the files in a directory
-///   Array contains up to 15 file_record_t structures
+///   Array contains up to 31 file_record_t structures, in the order fs_readdir yields them
 /// \param fs The F19FS containing the file
 /// \param path Absolute path to the directory to inspect
 /// \return dyn_array of file records, NULL on error
 ///
 dyn_array_t *fs_get_dir(F19FS_t *fs, const char *path) {
-    if(fs != NULL && path != NULL && strlen(path) != 0)
-    {	
-        char* copy_path = (char*)malloc(200);
-        strcpy(copy_path, path);
-        char** tokens;		// tokens are the directory names along the path. The last one is the name for the new file or dir
-        size_t count = 0;
-        tokens = str_split(copy_path, '/', &count);
-        free(copy_path);
-
-        if(strlen(*tokens) == 0)
-        {
-            // a spcial case: only a slash, no dir names
-            count -= 1;
-        }
-        else
-        {
-            for(size_t n = 0; n < count; n++)
-            {	
-                if(isValidFileName(*(tokens + n)) == false)
-                {
-                    // before any return, we need to free tokens, otherwise memory leakage
-                    for (size_t i = 0; i < count; i++)
-                    {
-                        free(*(tokens + i));
-                    }
-                    free(tokens);		
-                    return NULL;
-                }
-            }			
-        }		
-
-        // search along the path and find the deepest dir
-        size_t parent_inode_ID = 0;	// start from the 1st inode, ie., the inode for root directory
-        // first, let's find the parent dir
-        size_t indicator = 0;
+    return listDir(fs, path, false);
+}
 
-        inode_t * parent_inode = (inode_t *) calloc(1, sizeof(inode_t));
-        directoryFile_t * parent_data = (directoryFile_t *)calloc(1, BLOCK_SIZE_BYTES);
-        for(size_t i = 0; i < count; i++)
-        {
-            block_store_inode_read(fs->BlockStore_inode, parent_inode_ID, parent_inode);	// read out the parent inode
-            // in case file and dir has the same name. But from the test cases we can see, this case would not happen
-            if(parent_inode->fileType == 'd')
-            {			
-                block_store_read(fs->BlockStore_whole, parent_inode->directPointer[0], parent_data);
-                for(int j = 0; j < folder_number_entries; j++)
-                {
-                    if( ((parent_inode->vacantFile >> j) & 1) == 1 && strcmp((parent_data + j) -> filename, *(tokens + i)) == 0 )
-                    {
-                        parent_inode_ID = (parent_data + j) -> inodeNumber;
-                        indicator++;
-                    }					
-                }	
-            }					
-        }	
-        free(parent_data);
-        free(parent_inode);	
+dyn_array_t *fs_get_dir_plus(F19FS_t *fs, const char *path) {
+    return listDir(fs, path, true);
+}
 
-        // now let's enumerate the files/dir in it
-        if(indicator == count)
-        {
-            inode_t * dir_inode = (inode_t *) calloc(1, sizeof(inode_t));
-            block_store_inode_read(fs->BlockStore_inode, parent_inode_ID, dir_inode);	// read out the file inode			
-            if(dir_inode->fileType == 'd')
-            {
-                // prepare the data to be read out
-                directoryFile_t * dir_data = (directoryFile_t *)calloc(1, BLOCK_SIZE_BYTES);
-                block_store_read(fs->BlockStore_whole, dir_inode->directPointer[0], dir_data);
-
-                // prepare the dyn_array to hold the data
-                dyn_array_t * dynArray = dyn_array_create(15, sizeof(file_record_t), NULL);
-
-                for(int j = 0; j < folder_number_entries; j++)
-                {
-                    if( ((dir_inode->vacantFile >> j) & 1) == 1 )
-                    {
-                        file_record_t* fileRec = (file_record_t *)calloc(1, sizeof(file_record_t));
-                        strcpy(fileRec->name, (dir_data + j) -> filename);
-
-                        // to know fileType of the member in this dir, we have to refer to its inode
-                        inode_t * member_inode = (inode_t *) calloc(1, sizeof(inode_t));
-                        block_store_inode_read(fs->BlockStore_inode, (dir_data + j) -> inodeNumber, member_inode);
-                        if(member_inode->fileType == 'd')
-                        {
-                            fileRec->type = FS_DIRECTORY;
-                        }
-                        else if(member_inode->fileType == 'f')
-                        {
-                            fileRec->type = FS_REGULAR;
-                        }
-
-                        // now insert the file record into the dyn_array
-                        dyn_array_push_front(dynArray, fileRec);
-                        free(fileRec);
-                        free(member_inode);
-                    }					
-                }
-                free(dir_data);
-                free(dir_inode);
-                // before any return, we need to free tokens, otherwise memory leakage
-                if(strlen(*tokens) == 0)
-                {
-                    // a spcial case: only a slash, no dir names
-                    count += 1;
-                }
-                for (size_t i = 0; i < count; i++)
-                {
-                    free(*(tokens + i));
-                }
-                free(tokens);	
-                return(dynArray);
-            }
-            free(dir_inode);
-        }
-        // before any return, we need to free tokens, otherwise memory leakage
-        if(strlen(*tokens) == 0)
-        {
-            // a spcial case: only a slash, no dir names
-            count += 1;
-        }
-        for (size_t i = 0; i < count; i++)
-        {
-            free(*(tokens + i));
+// every entry of the directory at path in one pass, as file_record_t or with plus as file_record_plus_t
+dyn_array_t* listDir(F19FS_t* fs, const char* path, bool plus) {
+    struct fs_dir dir;
+    if (openDir(fs, path, &dir) == false) {
+        return NULL;
+    }
+    dyn_array_t *records = dyn_array_create(NUM_OF_ENTRIES, plus ? sizeof(file_record_plus_t) : sizeof(file_record_t), NULL);
+    union {
+        file_record_t record;
+        file_record_plus_t recordPlus;
+    } entry;
+    int next = 0;
+    while (records && (next = plus ? fs_readdirplus(&dir, &entry.recordPlus) : fs_readdir(&dir, &entry.record)) > 0) {
+        if (dyn_array_push_back(records, &entry) == false) {
+            next = -1;
+            break;
         }
-        free(tokens);	
     }
-    return NULL;
+    if (next < 0) {
+        dyn_array_destroy(records);
+        return NULL;
+    }
+    return records;
 }
 
-size_t allocate_indirectPtr_block(F19FS_t* fs) {
-    uint16_t indirectPtr_block_buffer[NUM_INDIRECT_PTR];
-    size_t blockID = block_store_allocate(fs->BlockStore_whole);
-    if (blockID == SIZE_MAX) {
-        return SIZE_MAX;
+bool openDir(F19FS_t* fs, const char* path, struct fs_dir* dir) {
+    inode_t dirInode;
+    if (fs == NULL || dir == NULL) {
+        return false;
     }
-    memset(indirectPtr_block_buffer, '\0', BLOCK_SIZE_BYTES);
-    block_store_write(fs->BlockStore_whole, blockID, indirectPtr_block_buffer);
-    return blockID;
+    size_t dirInodeID = resolvePath(fs, path, &dirInode);
+    if (dirInodeID == SIZE_MAX || dirInode.fileType != 'd') {
+        return false;
+    }
+    dir->fs = fs;
+    dir->inodeID = dirInodeID;
+    dir->generation = dirInode.generation;
+    dir->cookie = 0;
+    return true;
 }
 
-ssize_t write_direct_block(F19FS_t* fs, inode_t* inode, uint16_t fd_locator, uint16_t fd_offset, const void* src, size_t nbyte) {
-    // 0 <= fd->locate_order <= 5
-
-    // prepare the write buffer
-    uint8_t currentBlock[BLOCK_SIZE_BYTES];
-    memset(currentBlock, '\0', BLOCK_SIZE_BYTES);
+fs_dir_t *fs_opendir(F19FS_t *fs, const char *path) {
+    struct fs_dir dir;
+    if (openDir(fs, path, &dir) == false) {
+        return NULL;
+    }
+    fs_dir_t *handle = (fs_dir_t *)malloc(sizeof(fs_dir_t));
+    if (handle) {
+        *handle = dir;
+    }
+    return handle;
+}
 
-    // calcute the blankSpace that are avaliable to write in this block
-    // if the blankspace is larger than the nbyte, we just need to write this nbyte
-    size_t blankSpace = BLOCK_SIZE_BYTES - fd_offset;
-    if (blankSpace > nbyte) {
-        blankSpace = nbyte;
+// the next entry of a listing: its name and inode, 1 when there is one, 0 at the end, < 0 on error
+// the inode of the entry after it is prefetched, a listing touches them one after the other
+int readNextEntry(fs_dir_t* dir, char* name, inode_t* memberInode) {
+    inode_t dirInode;
+    if (openedDir(dir, &dirInode) == SIZE_MAX) {
+        return -2;
     }
-    
-    // write the src to write buffer
-    size_t blockID;
-    if (inode->directPointer[fd_locator] == 0) {
-        blockID = block_store_allocate(fs->BlockStore_whole);
-        if (blockID == SIZE_MAX) {
-            printf("file block run out\n");
+    // the entries still in use at or after the cookie, the next one is the lowest of them
+    uint32_t left = dirInode.vacantFile & ENTRY_BITS & (UINT32_MAX << dir->cookie);
+    if (left == 0) {
+        dir->cookie = NUM_OF_ENTRIES;
+        return 0;
+    }
+    unsigned entry = __builtin_ctz(left);
+    const directoryFile_t* entries = dirEntries(dir->fs, &dirInode);
+    left &= left - 1;
+    if (left) {
+        __builtin_prefetch(block_store_get_data(dir->fs->BlockStore_inode) + entries[__builtin_ctz(left)].inodeNumber * inode_size);
+    }
+    if (block_store_inode_read_inline(dir->fs->BlockStore_inode, entries[entry].inodeNumber, memberInode) == 0) {
+        return -3;
+    }
+    strncpy(name, entries[entry].filename, FS_FNAME_MAX - 1);
+    name[FS_FNAME_MAX - 1] = '\0';
+    dir->cookie = entry + 1;
+    return 1;
+}
+
+int fs_readdir(fs_dir_t *dir, file_record_t *record) {
+    if (dir == NULL || record == NULL) {
+        return -1;
+    }
+    inode_t memberInode;
+    int next = readNextEntry(dir, record->name, &memberInode);
+    if (next > 0) {
+        record->type = memberInode.fileType == 'd' ? FS_DIRECTORY : FS_REGULAR;
+    }
+    return next;
+}
+
+// the attributes fs_stat reports for an inode
+void fillStat(F19FS_t* fs, const inode_t* inode, fs_stat_t* stat) {
+    stat->type = inode->fileType == 'd' ? FS_DIRECTORY : FS_REGULAR;
+    stat->inode = inode->inodeNumber;
+    stat->size = getFileSize(fs, inode);
+    stat->links = inode->linkCount;
+    stat->blocks = countFileBlocks(fs, inode);
+    stat->generation = inode->generation;
+}
+
+int fs_readdirplus(fs_dir_t *dir, file_record_plus_t *record) {
+    if (dir == NULL || record == NULL) {
+        return -1;
+    }
+    inode_t memberInode;
+    int next = readNextEntry(dir, record->name, &memberInode);
+    if (next > 0) {
+        fillStat(dir->fs, &memberInode, &record->stat);
+    }
+    return next;
+}
+
+uint64_t fs_telldir(const fs_dir_t *dir) {
+    return dir ? dir->cookie : 0;
+}
+
+int fs_seekdir(fs_dir_t *dir, uint64_t cookie) {
+    if (dir == NULL || cookie > NUM_OF_ENTRIES) {
+        return -1;
+    }
+    dir->cookie = cookie;
+    return 0;
+}
+
+void fs_closedir(fs_dir_t *dir) {
+    free(dir);
+}
+
+int fs_stat(F19FS_t *fs, const char *path, fs_stat_t *stat) {
+    fs_lock(fs, false);
+    int result = fs_stat_body(fs, path, stat);
+    fs_unlock(fs);
+    return result;
+}
+
+int fs_stat_body(F19FS_t *fs, const char *path, fs_stat_t *stat) {
+    if (fs == NULL || stat == NULL) {
+        return -1;
+    }
+    inode_t inode;
+    if (resolvePath(fs, path, &inode) == SIZE_MAX) {
+        return -2;
+    }
+    fillStat(fs, &inode, stat);
+    return 0;
+}
+
+int fs_fstat(F19FS_t *fs, int fd, fs_stat_t *stat) {
+    fs_lock(fs, false);
+    int result = fs_fstat_body(fs, fd, stat);
+    fs_unlock(fs);
+    return result;
+}
+
+int fs_fstat_body(F19FS_t *fs, int fd, fs_stat_t *stat) {
+    if (fs == NULL || stat == NULL || fd < 0 || fd >= number_fd) {
+        return -1;
+    }
+    if (!block_store_sub_test(fs->BlockStore_fd, fd)) {
+        return -2;
+    }
+    fileDescriptor_t fileDescriptor;
+    inode_t inode;
+    block_store_fd_read_inline(fs->BlockStore_fd, fd, &fileDescriptor);
+    block_store_inode_read_inline(fs->BlockStore_inode, fileDescriptor.inodeNum, &inode);
+    fillStat(fs, &inode, stat);
+    return 0;
+}
+
+int fs_statfs(F19FS_t *fs, fs_statfs_t *stat) {
+    fs_lock(fs, false);
+    int result = fs_statfs_body(fs, stat);
+    fs_unlock(fs);
+    return result;
+}
+
+int fs_statfs_body(F19FS_t *fs, fs_statfs_t *stat) {
+    if (fs == NULL || stat == NULL) {
+        return -1;
+    }
+    // both counters are kept up to date by the block stores, nothing is recounted here
+    size_t freeBlocks = block_store_get_free_blocks(fs->BlockStore_whole);
+    stat->block_size = BLOCK_SIZE_BYTES;
+    stat->total_blocks = block_store_get_total_blocks();
+    stat->free_blocks = freeBlocks > fs->reserved_blocks ? freeBlocks - fs->reserved_blocks : 0;
+    stat->total_inodes = number_inodes;
+    stat->free_inodes = block_store_get_free_blocks(fs->BlockStore_inode);
+    stat->name_max = FS_FNAME_MAX - 1;
+    return 0;
+}
+
+// the inode a handle names, SIZE_MAX once that file is gone
+size_t resolveHandle(F19FS_t* fs, const fs_handle_t* handle, inode_t* inode) {
+    if (handle->inode >= number_inodes || !block_store_sub_test(fs->BlockStore_inode, handle->inode)) {
+        return SIZE_MAX;
+    }
+    block_store_inode_read_inline(fs->BlockStore_inode, handle->inode, inode);
+    return inode->generation == handle->generation ? handle->inode : SIZE_MAX;
+}
+
+int fs_get_handle(F19FS_t *fs, const char *path, fs_handle_t *handle) {
+    if (fs == NULL || handle == NULL) {
+        return -1;
+    }
+    inode_t inode;
+    if (resolvePath(fs, path, &inode) == SIZE_MAX) {
+        return -2;
+    }
+    handle->inode = inode.inodeNumber;
+    handle->generation = inode.generation;
+    return 0;
+}
+
+int fs_open_by_handle(F19FS_t *fs, const fs_handle_t *handle) {
+    fs_lock(fs, true);
+    int result = fs_open_by_handle_body(fs, handle);
+    fs_unlock(fs);
+    return result;
+}
+
+int fs_open_by_handle_body(F19FS_t *fs, const fs_handle_t *handle) {
+    if (fs == NULL || handle == NULL) {
+        return -1;
+    }
+    inode_t inode;
+    size_t inodeID = resolveHandle(fs, handle, &inode);
+    if (inodeID == SIZE_MAX) {
+        return -2;
+    }
+    if (inode.fileType == 'd') {
+        return -3;
+    }
+    size_t fd_ID = block_store_sub_allocate(fs->BlockStore_fd);
+    if (fd_ID >= number_fd) {
+        return -4;
+    }
+    init_descriptor(fs, fd_ID, inodeID, 0);
+    return fd_ID;
+}
+
+int fs_stat_by_handle(F19FS_t *fs, const fs_handle_t *handle, fs_stat_t *stat) {
+    if (fs == NULL || handle == NULL || stat == NULL) {
+        return -1;
+    }
+    inode_t inode;
+    if (resolveHandle(fs, handle, &inode) == SIZE_MAX) {
+        return -2;
+    }
+    fillStat(fs, &inode, stat);
+    return 0;
+}
+
+// the directory an fs_opendir handle stands for, SIZE_MAX once it was removed
+size_t openedDir(const fs_dir_t* dir, inode_t* dirInode) {
+    fs_handle_t handle = {dir->inodeID, dir->generation};
+    size_t dirInodeID = resolveHandle(dir->fs, &handle, dirInode);
+    return dirInodeID != SIZE_MAX && dirInode->fileType == 'd' ? dirInodeID : SIZE_MAX;
+}
+
+int fs_openat(fs_dir_t *dir, const char *path) {
+    F19FS_t* fs = dir ? dir->fs : NULL;
+    fs_lock(fs, true);
+    int result = fs_openat_body(dir, path);
+    fs_unlock(fs);
+    return result;
+}
+
+int fs_openat_body(fs_dir_t *dir, const char *path) {
+    if (dir == NULL || path == NULL || *path == '\0' || *path == '/') {
+        return -1;
+    }
+    inode_t inode;
+    size_t dirInodeID = openedDir(dir, &inode);
+    if (dirInodeID == SIZE_MAX) {
+        return -2;
+    }
+    size_t inodeID = resolveFrom(dir->fs, dirInodeID, path, &inode);
+    if (inodeID == SIZE_MAX) {
+        return -3;
+    }
+    if (inode.fileType == 'd') {
+        return -4;
+    }
+    size_t fd_ID = block_store_sub_allocate(dir->fs->BlockStore_fd);
+    if (fd_ID >= number_fd) {
+        return -5;
+    }
+    init_descriptor(dir->fs, fd_ID, inodeID, 0);
+    return fd_ID;
+}
+
+int fs_createat(fs_dir_t *dir, const char *name, file_t type) {
+    if (dir == NULL || name == NULL || !(type == FS_REGULAR || type == FS_DIRECTORY)) {
+        return -1;
+    }
+    int result = -6;
+    fs_op_begin(dir->fs);
+    inode_t dirInode;
+    size_t dirInodeID = openedDir(dir, &dirInode);
+    if (dirInodeID != SIZE_MAX) {
+        createInDir(dir->fs, dirInodeID, &dirInode, &name, 1, type, &result);
+    }
+    fs_op_end(dir->fs);
+    return result;
+}
+
+int fs_removeat(fs_dir_t *dir, const char *name) {
+    if (dir == NULL || name == NULL) {
+        return -1;
+    }
+    int result = -4;
+    fs_op_begin(dir->fs);
+    inode_t dirInode;
+    size_t dirInodeID = openedDir(dir, &dirInode);
+    if (dirInodeID != SIZE_MAX) {
+        removeFromDir(dir->fs, dirInodeID, &dirInode, &name, 1, &result);
+    }
+    fs_op_end(dir->fs);
+    return result;
+}
+
+// blocks anything but a write-back has to leave free: one per page staged without a block, and
+//  a pointer block per NUM_INDIRECT_PTR of them, as write_to_cache promised them
+size_t promised_blocks(F19FS_t* fs) {
+    if (fs->writing_back || fs->reserved_blocks == 0) {
+        return 0;
+    }
+    return fs->reserved_blocks + fs->reserved_blocks / NUM_INDIRECT_PTR + 2;
+}
+
+// take a free block, leaving the ones promised to staged pages alone
+size_t allocate_block(F19FS_t* fs) {
+    size_t promised = promised_blocks(fs);
+    if (promised && block_store_get_free_blocks(fs->BlockStore_whole) <= promised) {
+        return SIZE_MAX;
+    }
+    return block_store_allocate(fs->BlockStore_whole);
+}
+
+// take a run of up to count free blocks, leaving the ones promised to staged pages alone
+size_t allocate_run(F19FS_t* fs, size_t count, size_t* got) {
+    size_t promised = promised_blocks(fs);
+    if (promised) {
+        size_t freeBlocks = block_store_get_free_blocks(fs->BlockStore_whole);
+        if (freeBlocks <= promised) {
+            return SIZE_MAX;
+        }
+        count = count < freeBlocks - promised ? count : freeBlocks - promised;
+    }
+    return block_store_allocate_run(fs->BlockStore_whole, count, got);
+}
+
+size_t allocate_indirectPtr_block(F19FS_t* fs) {
+    uint16_t indirectPtr_block_buffer[NUM_INDIRECT_PTR];
+    size_t blockID = allocate_block(fs);
+    if (blockID == SIZE_MAX) {
+        return SIZE_MAX;
+    }
+    memset(indirectPtr_block_buffer, '\0', BLOCK_SIZE_BYTES);
+    write_meta_block(fs, blockID, indirectPtr_block_buffer);
+    return blockID;
+}
+
+ssize_t write_direct_block(F19FS_t* fs, inode_t* inode, uint16_t fd_locator, uint16_t fd_offset, const void* src, size_t nbyte) {
+    // 0 <= fd->locate_order <= 5
+
+    // prepare the write buffer
+    uint8_t currentBlock[BLOCK_SIZE_BYTES];
+    memset(currentBlock, '\0', BLOCK_SIZE_BYTES);
+
+    // calcute the blankSpace that are avaliable to write in this block
+    // if the blankspace is larger than the nbyte, we just need to write this nbyte
+    size_t blankSpace = BLOCK_SIZE_BYTES - fd_offset;
+    if (blankSpace > nbyte) {
+        blankSpace = nbyte;
+    }
+    
+    // write the src to write buffer
+    size_t blockID;
+    if (inode->directPointer[fd_locator] == 0) {
+        blockID = allocate_block(fs);
+        if (blockID == SIZE_MAX) {
+            printf("file block run out\n");
             return 0;
         }
         inode->directPointer[fd_locator] = blockID;
-        memcpy(currentBlock, src, BLOCK_SIZE_BYTES);
+        // a new block reads as zeros around what is written, like the hole it replaces
+        memcpy(currentBlock + fd_offset, src, blankSpace);
     } else {
         blockID = inode->directPointer[fd_locator];
-        block_store_read(fs->BlockStore_whole, blockID, currentBlock);
+        block_store_read_inline(fs->BlockStore_whole, blockID, currentBlock);
         memcpy(currentBlock + fd_offset, src, blankSpace);
     }
 
@@ -1014,7 +1537,7 @@ ssize_t write_direct_block(F19FS_t* fs, inode_t* inode, uint16_t fd_locator, uin
 ssize_t write_indirect_block(F19FS_t* fs, inode_t* inode, uint16_t fd_locator, uint16_t fd_offset, const void* src, size_t nbyte, size_t indirectBlockID) {
     // prepare the indirect pointer buffer
     uint16_t indirectPtrBuffer[NUM_INDIRECT_PTR];
-    block_store_read(fs->BlockStore_whole, indirectBlockID, indirectPtrBuffer);
+    block_store_read_inline(fs->BlockStore_whole, indirectBlockID, indirectPtrBuffer);
 
     // get the index of current indirectPtr
     uint16_t indirectPtrID = (fd_locator - NUM_DIRECT_PTR) % NUM_DOUBLE_DIRECT_PTR;
@@ -1025,10 +1548,11 @@ ssize_t write_indirect_block(F19FS_t* fs, inode_t* inode, uint16_t fd_locator, u
     while (indirectPtrID < NUM_INDIRECT_PTR && nbyte > 0) {
         // get or default the written block
         size_t blockID;
-        if (indirectPtrBuffer[indirectPtrID] == 0) {
-            blockID = block_store_allocate(fs->BlockStore_whole);
+        bool newBlock = indirectPtrBuffer[indirectPtrID] == 0;
+        if (newBlock) {
+            blockID = allocate_block(fs);
             if (blockID == SIZE_MAX) {
-                block_store_write(fs->BlockStore_whole, indirectBlockID, indirectPtrBuffer);
+                write_meta_block(fs, indirectBlockID, indirectPtrBuffer);
                 return sumOfWrittenByte; 
             }
             indirectPtrBuffer[indirectPtrID] = blockID;
@@ -1043,9 +1567,13 @@ ssize_t write_indirect_block(F19FS_t* fs, inode_t* inode, uint16_t fd_locator, u
             blankSpace = nbyte;
         }
         
-        // prepare the file block write buffer
+        // prepare the file block write buffer, a new block holds whatever its last owner left
         uint8_t fileBlock_writeBuffer[BLOCK_SIZE_BYTES];
-        block_store_read(fs->BlockStore_whole, blockID, fileBlock_writeBuffer);
+        if (newBlock) {
+            memset(fileBlock_writeBuffer, 0, BLOCK_SIZE_BYTES);
+        } else {
+            block_store_read_inline(fs->BlockStore_whole, blockID, fileBlock_writeBuffer);
+        }
 
         // copy the src + offset to the writeBuffer and write back to block store
         memcpy(fileBlock_writeBuffer + fd_offset, src, blankSpace);
@@ -1061,7 +1589,7 @@ ssize_t write_indirect_block(F19FS_t* fs, inode_t* inode, uint16_t fd_locator, u
         fd_offset = 0;
     }
 
-    block_store_write(fs->BlockStore_whole, indirectBlockID, indirectPtrBuffer);
+    write_meta_block(fs, indirectBlockID, indirectPtrBuffer);
 
     if (nbyte == 0) {
         return sumOfWrittenByte;
@@ -1085,18 +1613,18 @@ ssize_t write_double_direct_block(F19FS_t* fs, inode_t* inode, uint16_t fd_locat
 
     // prepare the doubke direct pointer buffer
     uint16_t doubleDirectPtrBuffer[NUM_DOUBLE_DIRECT_PTR];
-    block_store_read(fs->BlockStore_whole, double_direct_block_ID, doubleDirectPtrBuffer);
+    block_store_read_inline(fs->BlockStore_whole, double_direct_block_ID, doubleDirectPtrBuffer);
 
     int index = (fd_locator - (NUM_DIRECT_PTR + NUM_INDIRECT_PTR)) / NUM_DOUBLE_DIRECT_PTR;
 
     size_t indirectBlockID;
     if (doubleDirectPtrBuffer[index] == 0) {
-        indirectBlockID = block_store_allocate(fs->BlockStore_whole);
+        indirectBlockID = allocate_indirectPtr_block(fs);
         if (indirectBlockID == SIZE_MAX) {
             return 0;
         }
         doubleDirectPtrBuffer[index] = indirectBlockID;
-        block_store_write(fs->BlockStore_whole, double_direct_block_ID, doubleDirectPtrBuffer);
+        write_meta_block(fs, double_direct_block_ID, doubleDirectPtrBuffer);
     } else {
         indirectBlockID = doubleDirectPtrBuffer[index];
     }
@@ -1123,24 +1651,745 @@ void updateFD(fileDescriptor_t* fileDescriptor, ssize_t nbyte) {
     }
 }
 
+// physical block behind logical block n of a file, 0 if it has none
+uint16_t getBlockID(F19FS_t* fs, const inode_t* inode, size_t logical) {
+    if (logical < NUM_DIRECT_PTR) {
+        return inode->directPointer[logical];
+    }
+    uint16_t ptrBuffer[NUM_INDIRECT_PTR];
+    logical -= NUM_DIRECT_PTR;
+    if (logical < NUM_INDIRECT_PTR) {
+        if (inode->indirectPointer[0] == 0) {
+            return 0;
+        }
+        block_store_read_inline(fs->BlockStore_whole, inode->indirectPointer[0], ptrBuffer);
+        return ptrBuffer[logical];
+    }
+    logical -= NUM_INDIRECT_PTR;
+    if (logical >= (size_t)NUM_DOUBLE_DIRECT_PTR * NUM_INDIRECT_PTR || inode->doubleIndirectPointer == 0) {
+        return 0;
+    }
+    block_store_read_inline(fs->BlockStore_whole, inode->doubleIndirectPointer, ptrBuffer);
+    uint16_t indirectBlockID = ptrBuffer[logical / NUM_INDIRECT_PTR];
+    if (indirectBlockID == 0) {
+        return 0;
+    }
+    block_store_read_inline(fs->BlockStore_whole, indirectBlockID, ptrBuffer);
+    return ptrBuffer[logical % NUM_INDIRECT_PTR];
+}
+
+// point logical block n of a file at blockID, allocating the pointer blocks on the way
+// the inode is only updated in memory, false when pointer blocks run out
+bool setBlockID(F19FS_t* fs, inode_t* inode, size_t logical, uint16_t blockID) {
+    if (logical < NUM_DIRECT_PTR) {
+        inode->directPointer[logical] = blockID;
+        return true;
+    }
+    uint16_t ptrBuffer[NUM_INDIRECT_PTR];
+    size_t indirectBlockID;
+    logical -= NUM_DIRECT_PTR;
+    if (logical < NUM_INDIRECT_PTR) {
+        if (inode->indirectPointer[0] == 0) {
+            if ((indirectBlockID = allocate_indirectPtr_block(fs)) == SIZE_MAX) {
+                return false;
+            }
+            inode->indirectPointer[0] = indirectBlockID;
+        }
+        indirectBlockID = inode->indirectPointer[0];
+    } else {
+        logical -= NUM_INDIRECT_PTR;
+        if (logical >= (size_t)NUM_DOUBLE_DIRECT_PTR * NUM_INDIRECT_PTR) {
+            return false;
+        }
+        if (inode->doubleIndirectPointer == 0) {
+            size_t doubleBlockID = allocate_indirectPtr_block(fs);
+            if (doubleBlockID == SIZE_MAX) {
+                return false;
+            }
+            inode->doubleIndirectPointer = doubleBlockID;
+        }
+        block_store_read_inline(fs->BlockStore_whole, inode->doubleIndirectPointer, ptrBuffer);
+        indirectBlockID = ptrBuffer[logical / NUM_INDIRECT_PTR];
+        if (indirectBlockID == 0) {
+            if ((indirectBlockID = allocate_indirectPtr_block(fs)) == SIZE_MAX) {
+                return false;
+            }
+            ptrBuffer[logical / NUM_INDIRECT_PTR] = indirectBlockID;
+            write_meta_block(fs, inode->doubleIndirectPointer, ptrBuffer);
+        }
+        logical %= NUM_INDIRECT_PTR;
+    }
+    block_store_read_inline(fs->BlockStore_whole, indirectBlockID, ptrBuffer);
+    ptrBuffer[logical] = blockID;
+    write_meta_block(fs, indirectBlockID, ptrBuffer);
+    return true;
+}
+
+// size of a file as readers should see it, staged pages included
+size_t getFileSize(F19FS_t* fs, const inode_t* inode) {
+    pageCache_t* cache = fs->cache[inode->inodeNumber];
+    if (cache && cache->fileSize > inode->fileSize) {
+        return cache->fileSize;
+    }
+    return inode->fileSize;
+}
+
+// binary search for the page caching logical, *position is where it is or would be inserted
+cachedPage_t* findCachedPage(pageCache_t* cache, size_t logical, size_t* position) {
+    size_t low = 0, high = dyn_array_size(cache->pages);
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        cachedPage_t* page = (cachedPage_t*)dyn_array_at(cache->pages, mid);
+        if (page->logical == logical) {
+            *position = mid;
+            return page;
+        }
+        if (page->logical < logical) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    *position = low;
+    return NULL;
+}
+
+void drop_page_cache(F19FS_t* fs, size_t inodeID) {
+    pageCache_t* cache = fs->cache[inodeID];
+    if (!cache) {
+        return;
+    }
+    fs->cached_pages -= dyn_array_size(cache->pages);
+    fs->reserved_blocks -= cache->unmapped;
+    dyn_array_destroy(cache->pages);
+    free(cache);
+    fs->cache[inodeID] = NULL;
+}
+
+///
+/// Allocates and writes every staged page of an inode, then drops its cache
+///   The allocator is asked for all the missing blocks at once so it can hand out contiguous runs
+/// \return 0 on success, < 0 when the device ran out of blocks (pages that fit are still written,
+///   the rest stay staged for the next write-back)
+///
+int write_back_inode(F19FS_t* fs, size_t inodeID) {
+    pageCache_t* cache = inodeID < number_inodes ? fs->cache[inodeID] : NULL;
+    if (!cache) {
+        return 0;
+    }
+    fs_tx_begin(fs);
+    inode_t inode;
+    block_store_inode_read_inline(fs->BlockStore_inode, inodeID, &inode);
+
+    size_t needed = 0;
+    for (size_t i = 0; i < dyn_array_size(cache->pages); i++) {
+        if (getBlockID(fs, &inode, ((cachedPage_t*)dyn_array_at(cache->pages, i))->logical) == 0) {
+            needed++;
+        }
+    }
+
+    int result = 0;
+    size_t runStart = 0, runLeft = 0;
+    size_t fileSize = cache->fileSize;
+    size_t written = 0;
+    // these are the pages the promised blocks were kept for
+    fs->writing_back = true;
+    for (size_t i = 0; i < dyn_array_size(cache->pages); i++, written++) {
+        cachedPage_t* page = (cachedPage_t*)dyn_array_at(cache->pages, i);
+        uint16_t blockID = getBlockID(fs, &inode, page->logical);
+        if (blockID == 0) {
+            if (runLeft == 0) {
+                runStart = block_store_allocate_run(fs->BlockStore_whole, needed, &runLeft);
+            }
+            if (runStart == SIZE_MAX || !setBlockID(fs, &inode, page->logical, runStart)) {
+                // out of space, the file ends where its data does
+                fileSize = (size_t)page->logical * BLOCK_SIZE_BYTES;
+                result = -1;
+                break;
+            }
+            blockID = runStart++;
+            runLeft--;
+            needed--;
+        }
+        block_store_write(fs->BlockStore_whole, blockID, page->data);
+    }
+    fs->writing_back = false;
+    while (runLeft > 0) {
+        block_store_release(fs->BlockStore_whole, runStart++);
+        runLeft--;
+    }
+
+    if (fileSize > inode.fileSize) {
+        inode.fileSize = fileSize;
+    }
+    block_store_inode_write_inline(fs->BlockStore_inode, inodeID, &inode);
+    if (result == 0) {
+        drop_page_cache(fs, inodeID);
+    } else {
+        // only the written pages leave the cache, the size it reports still covers the rest
+        for (size_t i = 0; i < written; i++) {
+            dyn_array_pop_front(cache->pages);
+        }
+        fs->cached_pages -= written;
+        size_t unmapped = 0;
+        for (size_t i = 0; i < dyn_array_size(cache->pages); i++) {
+            if (getBlockID(fs, &inode, ((cachedPage_t*)dyn_array_at(cache->pages, i))->logical) == 0) {
+                unmapped++;
+            }
+        }
+        fs->reserved_blocks -= cache->unmapped - unmapped;
+        cache->unmapped = unmapped;
+    }
+    fs_tx_end(fs);
+    return result;
+}
+
+// set the bit of every block the file owns, data and pointer blocks alike
+void collect_file_blocks(F19FS_t* fs, const inode_t* inode, bitmap_t* blocks) {
+    uint16_t ptrBuffer[NUM_INDIRECT_PTR];
+    uint16_t indirectBuffer[NUM_INDIRECT_PTR];
+    for (size_t i = 0; i < NUM_DIRECT_PTR; i++) {
+        if (inode->directPointer[i] != 0) {
+            bitmap_set_inline(blocks, inode->directPointer[i]);
+        }
+    }
+    if (inode->indirectPointer[0] != 0) {
+        bitmap_set_inline(blocks, inode->indirectPointer[0]);
+        block_store_read_inline(fs->BlockStore_whole, inode->indirectPointer[0], ptrBuffer);
+        for (size_t i = 0; i < NUM_INDIRECT_PTR; i++) {
+            if (ptrBuffer[i] != 0) {
+                bitmap_set_inline(blocks, ptrBuffer[i]);
+            }
+        }
+    }
+    if (inode->doubleIndirectPointer != 0) {
+        bitmap_set_inline(blocks, inode->doubleIndirectPointer);
+        block_store_read_inline(fs->BlockStore_whole, inode->doubleIndirectPointer, ptrBuffer);
+        for (size_t i = 0; i < NUM_DOUBLE_DIRECT_PTR; i++) {
+            if (ptrBuffer[i] == 0) {
+                continue;
+            }
+            bitmap_set_inline(blocks, ptrBuffer[i]);
+            block_store_read_inline(fs->BlockStore_whole, ptrBuffer[i], indirectBuffer);
+            for (size_t j = 0; j < NUM_INDIRECT_PTR; j++) {
+                if (indirectBuffer[j] != 0) {
+                    bitmap_set_inline(blocks, indirectBuffer[j]);
+                }
+            }
+        }
+    }
+}
+
+// blocks the file holds on the device, pointer blocks included, counted straight from the mapping
+size_t countFileBlocks(F19FS_t* fs, const inode_t* inode) {
+    const uint8_t* data = block_store_get_data(fs->BlockStore_whole);
+    size_t count = 0;
+    for (size_t i = 0; i < NUM_DIRECT_PTR; i++) {
+        count += inode->directPointer[i] != 0;
+    }
+    if (inode->indirectPointer[0] != 0) {
+        const uint16_t* ptrs = (const uint16_t*)(data + inode->indirectPointer[0] * BLOCK_SIZE_BYTES);
+        count++;
+        for (size_t i = 0; i < NUM_INDIRECT_PTR; i++) {
+            count += ptrs[i] != 0;
+        }
+    }
+    if (inode->doubleIndirectPointer != 0) {
+        const uint16_t* outer = (const uint16_t*)(data + inode->doubleIndirectPointer * BLOCK_SIZE_BYTES);
+        count++;
+        for (size_t i = 0; i < NUM_DOUBLE_DIRECT_PTR; i++) {
+            if (outer[i] == 0) {
+                continue;
+            }
+            const uint16_t* ptrs = (const uint16_t*)(data + outer[i] * BLOCK_SIZE_BYTES);
+            count++;
+            for (size_t j = 0; j < NUM_INDIRECT_PTR; j++) {
+                count += ptrs[j] != 0;
+            }
+        }
+    }
+    return count;
+}
+
+int write_back_all(F19FS_t* fs) {
+    int result = 0;
+    for (size_t i = 0; i < number_inodes; i++) {
+        if (write_back_inode(fs, i) < 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+// the page cache of an inode, started empty on first use, NULL when out of memory
+pageCache_t* open_page_cache(F19FS_t* fs, size_t inodeID) {
+    pageCache_t* cache = fs->cache[inodeID];
+    if (!cache) {
+        cache = (pageCache_t*)calloc(1, sizeof(pageCache_t));
+        if (!cache || !(cache->pages = dyn_array_create(16, sizeof(cachedPage_t), NULL))) {
+            free(cache);
+            return NULL;
+        }
+        inode_t inode;
+        block_store_inode_read_inline(fs->BlockStore_inode, inodeID, &inode);
+        cache->fileSize = inode.fileSize;
+        fs->cache[inodeID] = cache;
+    }
+    return cache;
+}
+
+// stage nbyte of src at position in the page cache of the inode, nothing is allocated on the device
+ssize_t write_to_cache(F19FS_t* fs, size_t inodeID, size_t position, const void* src, size_t nbyte) {
+    pageCache_t* cache = open_page_cache(fs, inodeID);
+    if (!cache) {
+        return -4;
+    }
+
+    size_t written = 0;
+    while (written < nbyte) {
+        size_t logical = (position + written) / BLOCK_SIZE_BYTES;
+        size_t offset = (position + written) % BLOCK_SIZE_BYTES;
+        if (logical >= UINT16_MAX) {
+            break;
+        }
+        size_t index;
+        cachedPage_t* page = findCachedPage(cache, logical, &index);
+        if (!page) {
+            if (fs->cached_pages >= FS_PAGE_CACHE_PAGES) {
+                // memory pressure, push everything staged so far out to the device; pages that
+                //  found no block stay staged, when none left the write ends short
+                size_t before = fs->cached_pages;
+                write_back_all(fs);
+                if (fs->cached_pages >= before || !(cache = open_page_cache(fs, inodeID))) {
+                    break;
+                }
+                continue;
+            }
+            inode_t inode;
+            block_store_inode_read_inline(fs->BlockStore_inode, inodeID, &inode);
+            uint16_t blockID = getBlockID(fs, &inode, logical);
+            if (blockID == 0) {
+                // keep room for this page and a pointer block per NUM_INDIRECT_PTR of them
+                size_t promised = fs->reserved_blocks + 1;
+                if (promised + promised / NUM_INDIRECT_PTR + 2 > block_store_get_free_blocks(fs->BlockStore_whole)) {
+                    break;
+                }
+            }
+            cachedPage_t newPage;
+            newPage.logical = logical;
+            if (blockID == 0) {
+                memset(newPage.data, 0, BLOCK_SIZE_BYTES);
+            } else {
+                block_store_read_inline(fs->BlockStore_whole, blockID, newPage.data);
+            }
+            if (!dyn_array_insert(cache->pages, index, &newPage)) {
+                break;
+            }
+            if (blockID == 0) {
+                cache->unmapped++;
+                fs->reserved_blocks++;
+            }
+            fs->cached_pages++;
+            page = (cachedPage_t*)dyn_array_at(cache->pages, index);
+        }
+        size_t chunk = BLOCK_SIZE_BYTES - offset;
+        if (chunk > nbyte - written) {
+            chunk = nbyte - written;
+        }
+        memcpy(page->data + offset, (const uint8_t*)src + written, chunk);
+        written += chunk;
+        // kept current, a write-back under memory pressure takes the size from here
+        if (position + written > cache->fileSize) {
+            cache->fileSize = position + written;
+        }
+    }
+    return written;
+}
+
+// read nbyte at position of a file with staged pages, device blocks fill whatever is not cached
+ssize_t read_through_cache(F19FS_t* fs, pageCache_t* cache, const inode_t* inode, size_t position, void* dst, size_t nbyte) {
+    size_t done = 0;
+    uint8_t blockBuffer[BLOCK_SIZE_BYTES];
+    while (done < nbyte) {
+        size_t logical = (position + done) / BLOCK_SIZE_BYTES;
+        size_t offset = (position + done) % BLOCK_SIZE_BYTES;
+        size_t chunk = BLOCK_SIZE_BYTES - offset;
+        if (chunk > nbyte - done) {
+            chunk = nbyte - done;
+        }
+        size_t index;
+        cachedPage_t* page = findCachedPage(cache, logical, &index);
+        if (page) {
+            memcpy((uint8_t*)dst + done, page->data + offset, chunk);
+        } else {
+            uint16_t blockID = getBlockID(fs, inode, logical);
+            if (blockID == 0) {
+                memset((uint8_t*)dst + done, 0, chunk);
+            } else {
+                block_store_read_inline(fs->BlockStore_whole, blockID, blockBuffer);
+                memcpy((uint8_t*)dst + done, blockBuffer + offset, chunk);
+            }
+        }
+        done += chunk;
+    }
+    return done;
+}
+
+int fs_set_buffered(F19FS_t *fs, int fd, bool buffered) {
+    fs_lock(fs, true);
+    int result = fs_set_buffered_body(fs, fd, buffered);
+    fs_unlock(fs);
+    return result;
+}
+
+int fs_set_buffered_body(F19FS_t *fs, int fd, bool buffered) {
+    if (!fs || fd < 0 || fd >= number_fd) {
+        return -1;
+    }
+    if (!block_store_sub_test(fs->BlockStore_fd, fd)) {
+        return -2;
+    }
+    fileDescriptor_t fileDescriptor;
+    block_store_fd_read_inline(fs->BlockStore_fd, fd, &fileDescriptor);
+    if (buffered) {
+        fileDescriptor.usage |= FD_WRITE_BACK;
+    } else {
+        fileDescriptor.usage &= ~FD_WRITE_BACK;
+    }
+    block_store_fd_write_inline(fs->BlockStore_fd, fd, &fileDescriptor);
+    return buffered ? 0 : write_back_inode(fs, fileDescriptor.inodeNum);
+}
+
+int fs_fsync(F19FS_t *fs, int fd) {
+    fs_lock(fs, true);
+    int result = fs_fsync_body(fs, fd);
+    fs_unlock(fs);
+    return result;
+}
+
+int fs_fsync_body(F19FS_t *fs, int fd) {
+    if (!fs || fd < 0 || fd >= number_fd) {
+        return -1;
+    }
+    if (!block_store_sub_test(fs->BlockStore_fd, fd)) {
+        return -2;
+    }
+    fileDescriptor_t fileDescriptor;
+    block_store_fd_read_inline(fs->BlockStore_fd, fd, &fileDescriptor);
+    if (write_back_inode(fs, fileDescriptor.inodeNum) < 0) {
+        return -3;
+    }
+    // one msync of the journal covers every operation committed so far, from any thread
+    if (fs->journal && journal_sync(fs->journal) < 0) {
+        return -4;
+    }
+    // then only the file's own blocks, its inode and the bitmaps, whatever else is dirty can wait
+    bitmap_t* only = bitmap_create(BLOCK_STORE_NUM_BLOCKS);
+    if (!only) {
+        return -5;
+    }
+    inode_t inode;
+    block_store_inode_read_inline(fs->BlockStore_inode, fileDescriptor.inodeNum, &inode);
+    collect_file_blocks(fs, &inode, only);
+    bitmap_set_inline(only, INODE_BITMAP_BLOCK);
+    bitmap_set_inline(only, INODE_TABLE_START + fileDescriptor.inodeNum * inode_size / BLOCK_SIZE_BYTES);
+    for (size_t i = BLOCK_STORE_AVAIL_BLOCKS; i < BLOCK_STORE_NUM_BLOCKS; i++) {
+        bitmap_set_inline(only, i);
+    }
+    bool synced = block_store_sync_dirty(fs->BlockStore_whole, only);
+    bitmap_destroy(only);
+    return synced ? 0 : -6;
+}
+
+int fs_sync(F19FS_t *fs) {
+    fs_lock(fs, true);
+    int result = fs_sync_body(fs);
+    fs_unlock(fs);
+    return result;
+}
+
+int fs_sync_body(F19FS_t *fs) {
+    if (!fs) {
+        return -1;
+    }
+    if (write_back_all(fs) < 0) {
+        return -2;
+    }
+    if (fs->journal && journal_sync(fs->journal) < 0) {
+        return -3;
+    }
+    return block_store_sync_dirty(fs->BlockStore_whole, NULL) ? 0 : -4;
+}
+
+ssize_t fs_snapshot(F19FS_t *fs, int fd, uint64_t base, uint64_t *generation) {
+    fs_lock(fs, true);
+    ssize_t result = fs_snapshot_body(fs, fd, base, generation);
+    fs_unlock(fs);
+    return result;
+}
+
+ssize_t fs_snapshot_body(F19FS_t *fs, int fd, uint64_t base, uint64_t *generation) {
+    if (!fs || fd < 0) {
+        return -1;
+    }
+    // staged pages have no blocks yet, they would be missing from the snapshot
+    if (write_back_all(fs) < 0) {
+        return -2;
+    }
+    size_t written = block_store_snapshot(fs->BlockStore_whole, fd, base, generation);
+    return written ? (ssize_t)written : -3;
+}
+
+F19FS_t *fs_restore(const char *source, const char *path) {
+    if (!source || !path || strlen(path) == 0 || !block_store_restore(source, path)) {
+        return NULL;
+    }
+    // counters saved by an earlier unmount of the target don't describe blocks a delta brought in
+    block_store_t* bs = block_store_open(path);
+    if (!bs) {
+        return NULL;
+    }
+    superblock_t* sb = (superblock_t*)(block_store_Data_location(bs) + SUPERBLOCK_OFFSET);
+    if (sb->magic == SUPERBLOCK_MAGIC) {
+        sb->clean = 0;
+    }
+    block_store_destroy(bs);
+    return fs_mount(path);
+}
+
+// largest file a descriptor can address, write_to_cache stops at the same block
+#define MAX_FILE_SIZE ((off_t)UINT16_MAX * BLOCK_SIZE_BYTES)
+
+int fs_ftruncate(F19FS_t *fs, int fd, off_t size) {
+    fs_op_begin(fs);
+    int result = fs_ftruncate_body(fs, fd, size);
+    fs_op_end(fs);
+    return result;
+}
+
+int fs_ftruncate_body(F19FS_t *fs, int fd, off_t size) {
+    if (!fs || fd < 0 || fd >= number_fd) {
+        return -1;
+    }
+    if (!block_store_sub_test(fs->BlockStore_fd, fd)) {
+        return -2;
+    }
+    if (size < 0 || size > MAX_FILE_SIZE) {
+        return -3;
+    }
+    fileDescriptor_t fileDescriptor;
+    block_store_fd_read_inline(fs->BlockStore_fd, fd, &fileDescriptor);
+    return truncate_inode(fs, fileDescriptor.inodeNum, size);
+}
+
+// set the size of a regular file, shared by the descriptor and path calls
+int truncate_inode(F19FS_t* fs, size_t inodeID, off_t size) {
+    if (write_back_inode(fs, inodeID) < 0) {
+        return -4;
+    }
+    inode_t inode;
+    block_store_inode_read_inline(fs->BlockStore_inode, inodeID, &inode);
+    if ((size_t)size < inode.fileSize) {
+        size_t keep = ((size_t)size + BLOCK_SIZE_BYTES - 1) / BLOCK_SIZE_BYTES;
+        truncate_file_blocks(fs, &inode, keep);
+        // growing the file again has to read zeros past the new end
+        uint16_t lastBlockID = size % BLOCK_SIZE_BYTES ? getBlockID(fs, &inode, keep - 1) : 0;
+        if (lastBlockID != 0) {
+            uint8_t block[BLOCK_SIZE_BYTES];
+            block_store_read_inline(fs->BlockStore_whole, lastBlockID, block);
+            memset(block + size % BLOCK_SIZE_BYTES, 0, BLOCK_SIZE_BYTES - size % BLOCK_SIZE_BYTES);
+            block_store_write(fs->BlockStore_whole, lastBlockID, block);
+        }
+    }
+    // a larger size leaves a hole up to it
+    inode.fileSize = size;
+    block_store_inode_write_inline(fs->BlockStore_inode, inodeID, &inode);
+    return 0;
+}
+
+int fs_truncate(F19FS_t *fs, const char *path, off_t size) {
+    fs_op_begin(fs);
+    int result = fs_truncate_body(fs, path, size);
+    fs_op_end(fs);
+    return result;
+}
+
+int fs_truncate_body(F19FS_t *fs, const char *path, off_t size) {
+    if (!fs) {
+        return -1;
+    }
+    inode_t inode;
+    size_t inodeID = resolvePath(fs, path, &inode);
+    if (inodeID == SIZE_MAX || inode.fileType == 'd') {
+        return -1;
+    }
+    if (size < 0 || size > MAX_FILE_SIZE) {
+        return -3;
+    }
+    return truncate_inode(fs, inodeID, size);
+}
+
+int fs_fallocate(F19FS_t *fs, int fd, off_t offset, off_t len) {
+    fs_op_begin(fs);
+    int result = fs_fallocate_body(fs, fd, offset, len);
+    fs_op_end(fs);
+    return result;
+}
+
+int fs_fallocate_body(F19FS_t *fs, int fd, off_t offset, off_t len) {
+    if (!fs || fd < 0 || fd >= number_fd) {
+        return -1;
+    }
+    if (!block_store_sub_test(fs->BlockStore_fd, fd)) {
+        return -2;
+    }
+    if (offset < 0 || len <= 0 || len > MAX_FILE_SIZE - offset) {
+        return -3;
+    }
+    fileDescriptor_t fileDescriptor;
+    block_store_fd_read_inline(fs->BlockStore_fd, fd, &fileDescriptor);
+    if (write_back_inode(fs, fileDescriptor.inodeNum) < 0) {
+        return -4;
+    }
+    inode_t inode;
+    block_store_inode_read_inline(fs->BlockStore_inode, fileDescriptor.inodeNum, &inode);
+
+    // count the holes first, a request that can't be met takes nothing
+    size_t first = offset / BLOCK_SIZE_BYTES;
+    size_t last = (offset + len + BLOCK_SIZE_BYTES - 1) / BLOCK_SIZE_BYTES;
+    size_t needed = 0;
+    bitmap_t* holes = bitmap_create(last - first);
+    if (!holes) {
+        return -6;
+    }
+    for (size_t hole = findMappedBlock(fs, &inode, first, last, false); hole < last;) {
+        size_t data = findMappedBlock(fs, &inode, hole, last, true);
+        bitmap_set_range(holes, hole - first, data - hole);
+        needed += data - hole;
+        hole = findMappedBlock(fs, &inode, data, last, false);
+    }
+    if (needed + needed / NUM_INDIRECT_PTR + 2 + fs->reserved_blocks > block_store_get_free_blocks(fs->BlockStore_whole)) {
+        bitmap_destroy(holes);
+        return -5;
+    }
+    // the estimate above can come up short on pointer blocks, keep what a rollback needs
+    inode_t before = inode;
+    uint16_t doubleBefore[NUM_DOUBLE_DIRECT_PTR];
+    memset(doubleBefore, 0, sizeof(doubleBefore));
+    if (inode.doubleIndirectPointer != 0) {
+        block_store_read_inline(fs->BlockStore_whole, inode.doubleIndirectPointer, doubleBefore);
+    }
+
+    int result = 0;
+    for (size_t logical = findMappedBlock(fs, &inode, first, last, false); logical < last && result == 0;) {
+        size_t end = findMappedBlock(fs, &inode, logical, last, true);
+        while (logical < end) {
+            size_t got = 0;
+            size_t runStart = allocate_run(fs, end - logical, &got);
+            if (runStart == SIZE_MAX) {
+                result = -5;
+                break;
+            }
+            // whatever the blocks held before reads as zeros now, without writing them
+            block_store_discard(fs->BlockStore_whole, runStart, got);
+            size_t linked = 0;
+            while (linked < got && setBlockID(fs, &inode, logical + linked, runStart + linked)) {
+                linked++;
+            }
+            logical += linked;
+            if (linked < got) {
+                block_store_release_run(fs->BlockStore_whole, runStart + linked, got - linked);
+                result = -5;
+                break;
+            }
+        }
+        logical = findMappedBlock(fs, &inode, logical, last, false);
+    }
+    if (result < 0) {
+        // ran out part way, give back every block this call linked so the file is as it was
+        for (size_t bit = bitmap_next_set(holes, 0); bit != SIZE_MAX; bit = bitmap_next_set(holes, bit + 1)) {
+            uint16_t blockID = getBlockID(fs, &inode, first + bit);
+            if (blockID != 0) {
+                setBlockID(fs, &inode, first + bit, 0);
+                block_store_release(fs->BlockStore_whole, blockID);
+            }
+        }
+        if (before.indirectPointer[0] == 0 && inode.indirectPointer[0] != 0) {
+            block_store_release(fs->BlockStore_whole, inode.indirectPointer[0]);
+            inode.indirectPointer[0] = 0;
+        }
+        if (inode.doubleIndirectPointer != 0) {
+            uint16_t doubleNow[NUM_DOUBLE_DIRECT_PTR];
+            block_store_read_inline(fs->BlockStore_whole, inode.doubleIndirectPointer, doubleNow);
+            bool changed = false;
+            for (size_t i = 0; i < NUM_DOUBLE_DIRECT_PTR; i++) {
+                if (doubleNow[i] != 0 && doubleBefore[i] == 0) {
+                    block_store_release(fs->BlockStore_whole, doubleNow[i]);
+                    doubleNow[i] = 0;
+                    changed = true;
+                }
+            }
+            if (before.doubleIndirectPointer == 0) {
+                block_store_release(fs->BlockStore_whole, inode.doubleIndirectPointer);
+                inode.doubleIndirectPointer = 0;
+            } else if (changed) {
+                write_meta_block(fs, inode.doubleIndirectPointer, doubleNow);
+            }
+        }
+    } else if ((size_t)(offset + len) > inode.fileSize) {
+        inode.fileSize = offset + len;
+    }
+    bitmap_destroy(holes);
+    block_store_inode_write_inline(fs->BlockStore_inode, fileDescriptor.inodeNum, &inode);
+    return result;
+}
+
 ssize_t fs_write(F19FS_t* fs, int fd, const void* src, size_t nbyte) {
+    fs_op_begin(fs);
+    ssize_t result = fs_write_body(fs, fd, src, nbyte);
+    fs_op_end(fs);
+    return result;
+}
+
+ssize_t fs_write_body(F19FS_t* fs, int fd, const void* src, size_t nbyte) {
     if (!fs || fd < 0 || fd >= number_fd || !src) {
         return -1;
     }
-    if(!bitmap_test(block_store_get_bm(fs->BlockStore_fd), fd)) { 
+    if(!bitmap_test_inline(block_store_get_bm(fs->BlockStore_fd), fd)) { 
         return -2; 
     }
     // printf("total num of write data: %lu\n", nbyte);
     // prepare file descrptor
     fileDescriptor_t fileDescriptor;
-    block_store_fd_read(fs->BlockStore_fd, fd, &fileDescriptor);
+    block_store_fd_read_inline(fs->BlockStore_fd, fd, &fileDescriptor);
+    if (fileDescriptor.usage & FD_APPEND) {
+        // wherever the descriptor was left, an append starts at the end of file
+        inode_t fileInode;
+        block_store_inode_read_inline(fs->BlockStore_inode, fileDescriptor.inodeNum, &fileInode);
+        fileDescriptor.locate_order = 0;
+        fileDescriptor.locate_offset = 0;
+        updateFD(&fileDescriptor, getFileSize(fs, &fileInode));
+    }
     uint16_t fd_locator = fileDescriptor.locate_order;
     uint16_t fd_offset = fileDescriptor.locate_offset;
+
+    if (fileDescriptor.usage & FD_WRITE_BACK) {
+        ssize_t staged = write_to_cache(fs, fileDescriptor.inodeNum, getPreviosOffset(&fileDescriptor), src, nbyte);
+        if (staged > 0) {
+            updateFD(&fileDescriptor, staged);
+            block_store_fd_write_inline(fs->BlockStore_fd, fd, &fileDescriptor);
+        }
+        return staged;
+    }
+    // a write-through must not be overwritten later by older staged pages
+    if (write_back_inode(fs, fileDescriptor.inodeNum) < 0) {
+        return -3;
+    }
     // printf("before write - inode number: %d, locator: %d, offset: %d\n", fileDescriptor.inodeNum, fd_locator, fd_offset);
 
     // get inode
     inode_t inode;
-    block_store_inode_read(fs->BlockStore_inode, fileDescriptor.inodeNum, &inode);
+    block_store_inode_read_inline(fs->BlockStore_inode, fileDescriptor.inodeNum, &inode);
     // printf("inode NUM: %lu\n", inode.inodeNumber);
 
     ssize_t sumOfWrittenByte = 0;
@@ -1170,38 +2419,130 @@ ssize_t fs_write(F19FS_t* fs, int fd, const void* src, size_t nbyte) {
     updateFD(&fileDescriptor, sumOfWrittenByte);
     // printf("after write - inode number: %d, locator: %d, offset: %d\n", fileDescriptor.inodeNum, fileDescriptor.locate_order, fileDescriptor.locate_offset);
 
-    block_store_fd_write(fs->BlockStore_fd, fd, &fileDescriptor);
+    block_store_fd_write_inline(fs->BlockStore_fd, fd, &fileDescriptor);
 
-    //update inode
-    inode.fileSize += sumOfWrittenByte;
+    //update inode, overwriting inside the file does not grow it
+    if ((size_t)getPreviosOffset(&fileDescriptor) > inode.fileSize) {
+        inode.fileSize = getPreviosOffset(&fileDescriptor);
+    }
     
-    block_store_inode_write(fs->BlockStore_inode, fileDescriptor.inodeNum, &inode);
+    block_store_inode_write_inline(fs->BlockStore_inode, fileDescriptor.inodeNum, &inode);
 
     return sumOfWrittenByte;
 }
 int getFileIndexInDir(inode_t* parentDirInode, directoryFile_t* parentDir, char* fileName) {
-    bitmap_t* parentBM = bitmap_overlay(NUM_OF_ENTRIES, &(parentDirInode->vacantFile));
+    bitmap_view_t parentBM_view;
+    bitmap_t* parentBM = bitmap_view(&parentBM_view, NUM_OF_ENTRIES, &(parentDirInode->vacantFile));
     for (size_t i = 0; i < NUM_OF_ENTRIES; i++) {
-        if (bitmap_test(parentBM, i) && strncmp((parentDir + i)->filename, fileName, strlen(fileName)) == 0) {
-            bitmap_destroy(parentBM);
+        if (bitmap_test_inline(parentBM, i) && strncmp((parentDir + i)->filename, fileName, strlen(fileName)) == 0) {
             return i;
         }
     }
-    bitmap_destroy(parentBM);
     return -1;
 }
 
 bool isDirectoryEmpty(inode_t* directoryInode) {
-    bitmap_t* directoryBM = bitmap_overlay(NUM_OF_ENTRIES, &(directoryInode->vacantFile));
-    if (bitmap_total_set(directoryBM) != 0) {
-        bitmap_destroy(directoryBM);
-        return false;
+    return (directoryInode->vacantFile & ENTRY_BITS) == 0;
+}
+
+// a run of blocks queued for release, neighbours go back to the device together
+typedef struct blockRun {
+    size_t start;
+    size_t length;
+} blockRun_t;
+
+void release_flush(F19FS_t* fs, blockRun_t* run) {
+    if (run->length > 0) {
+        block_store_release_run(fs->BlockStore_whole, run->start, run->length);
+        run->length = 0;
     }
-    bitmap_destroy(directoryBM);
-    return true;
+}
+
+void release_queue(F19FS_t* fs, blockRun_t* run, size_t blockID) {
+    if (run->length > 0 && blockID == run->start + run->length) {
+        run->length++;
+        return;
+    }
+    release_flush(fs, run);
+    run->start = blockID;
+    run->length = 1;
+}
+
+// queue the blocks a pointer block lists from entry first on, the pointer block is rewritten if it stays
+void release_pointer_entries(F19FS_t* fs, blockRun_t* run, uint16_t ptrBlockID, size_t first) {
+    uint16_t ptrs[NUM_INDIRECT_PTR];
+    block_store_read_inline(fs->BlockStore_whole, ptrBlockID, ptrs);
+    bool changed = false;
+    for (size_t i = first; i < NUM_INDIRECT_PTR; i++) {
+        if (ptrs[i] != 0) {
+            release_queue(fs, run, ptrs[i]);
+            ptrs[i] = 0;
+            changed = true;
+        }
+    }
+    if (first > 0 && changed) {
+        write_meta_block(fs, ptrBlockID, ptrs);
+    }
+}
+
+// free every block of the file from logical block keep on, and the pointer blocks left empty
+//  the inode is only updated in memory
+void truncate_file_blocks(F19FS_t* fs, inode_t* fileInode, size_t keep) {
+    blockRun_t run = {0, 0};
+    for (size_t i = keep; i < NUM_DIRECT_PTR; i++) {
+        if (fileInode->directPointer[i] != 0) {
+            release_queue(fs, &run, fileInode->directPointer[i]);
+            fileInode->directPointer[i] = 0;
+        }
+    }
+    size_t first = keep > NUM_DIRECT_PTR ? keep - NUM_DIRECT_PTR : 0;
+    if (fileInode->indirectPointer[0] != 0 && first < NUM_INDIRECT_PTR) {
+        release_pointer_entries(fs, &run, fileInode->indirectPointer[0], first);
+        if (first == 0) {
+            release_queue(fs, &run, fileInode->indirectPointer[0]);
+            fileInode->indirectPointer[0] = 0;
+        }
+    }
+    first = keep > NUM_DIRECT_PTR + NUM_INDIRECT_PTR ? keep - NUM_DIRECT_PTR - NUM_INDIRECT_PTR : 0;
+    if (fileInode->doubleIndirectPointer != 0) {
+        uint16_t doubleIndirectPtrs[NUM_DOUBLE_DIRECT_PTR];
+        block_store_read_inline(fs->BlockStore_whole, fileInode->doubleIndirectPointer, doubleIndirectPtrs);
+        bool changed = false;
+        for (size_t i = first / NUM_INDIRECT_PTR; i < NUM_DOUBLE_DIRECT_PTR; i++) {
+            if (doubleIndirectPtrs[i] == 0) {
+                continue;
+            }
+            size_t from = i == first / NUM_INDIRECT_PTR ? first % NUM_INDIRECT_PTR : 0;
+            release_pointer_entries(fs, &run, doubleIndirectPtrs[i], from);
+            if (from == 0) {
+                release_queue(fs, &run, doubleIndirectPtrs[i]);
+                doubleIndirectPtrs[i] = 0;
+                changed = true;
+            }
+        }
+        if (first == 0) {
+            release_queue(fs, &run, fileInode->doubleIndirectPointer);
+            fileInode->doubleIndirectPointer = 0;
+        } else if (changed) {
+            write_meta_block(fs, fileInode->doubleIndirectPointer, doubleIndirectPtrs);
+        }
+    }
+    release_flush(fs, &run);
+}
+
+// give back every data block and pointer block reachable from a regular file's inode
+void release_file_blocks(F19FS_t* fs, inode_t* fileInode) {
+    truncate_file_blocks(fs, fileInode, 0);
 }
 
 int fs_remove(F19FS_t *fs, const char *path) {
+    fs_op_begin(fs);
+    int result = fs_remove_body(fs, path);
+    fs_op_end(fs);
+    return result;
+}
+
+int fs_remove_body(F19FS_t *fs, const char *path) {
     if (!fs || !path || strlen(path) == 0) {
         return -1;
     }
@@ -1231,60 +2572,23 @@ int fs_remove(F19FS_t *fs, const char *path) {
 
     inode_t* parentDirInode = (inode_t*)calloc(1, sizeof(inode_t));
     directoryFile_t* parentDir = (directoryFile_t *)calloc(1, BLOCK_SIZE_BYTES);
-    if (block_store_inode_read(fs->BlockStore_inode, dirInodeID, parentDirInode) == 0 || block_store_read(fs->BlockStore_whole, parentDirInode->directPointer[0], parentDir) == 0) {
+    if (block_store_inode_read_inline(fs->BlockStore_inode, dirInodeID, parentDirInode) == 0 || block_store_read_inline(fs->BlockStore_whole, parentDirInode->directPointer[0], parentDir) == 0) {
         return -6;
     }
 
     inode_t* fileInode = (inode_t*)calloc(1, sizeof(inode_t));
-    if (block_store_inode_read(fs->BlockStore_inode, fileInodeID, fileInode) == 0) {
+    if (block_store_inode_read_inline(fs->BlockStore_inode, fileInodeID, fileInode) == 0) {
         return -7;
     }
 
     if (fileInode->fileType == 'r') {
         if (fileInode->linkCount > 1) {
             fileInode->linkCount -= 1;
-            block_store_inode_write(fs->BlockStore_inode, fileInodeID, fileInode);
+            block_store_inode_write_inline(fs->BlockStore_inode, fileInodeID, fileInode);
             return 0;
         }
-        // delete all the file block
-        for(int i = 0; i< NUM_DIRECT_PTR; i++){
-            if(fileInode->directPointer[i] != 0){
-                block_store_release(fs->BlockStore_whole, fileInode->directPointer[i]);
-            }
-        }
-        // delete all the indirect related block
-        if(fileInode->indirectPointer[0] != 0){
-            uint16_t indirectPtrs[NUM_INDIRECT_PTR];
-            block_store_read(fs->BlockStore_whole, fileInode->indirectPointer[0], indirectPtrs);
-
-            for(int i = 0; i < NUM_INDIRECT_PTR; i++){
-                if(indirectPtrs[i] != 0){
-                    block_store_release(fs->BlockStore_whole, indirectPtrs[i]);
-                }
-            }
-            block_store_release(fs->BlockStore_whole, fileInode->indirectPointer[0]);
-        }
-        // delete all the double indirect related block
-        if(fileInode->doubleIndirectPointer != 0){
-
-            uint16_t doubleIndirectPtrs[NUM_DOUBLE_DIRECT_PTR];
-            block_store_read(fs->BlockStore_whole, fileInode->doubleIndirectPointer, doubleIndirectPtrs);
-
-            for(int i = 0; i < NUM_DOUBLE_DIRECT_PTR; i++){
-                if(doubleIndirectPtrs[i] != 0){
-                    uint16_t indirectPtrs[NUM_INDIRECT_PTR];
-                    block_store_read(fs->BlockStore_whole, doubleIndirectPtrs[i], indirectPtrs);
-                    for(int j = 0; j < NUM_INDIRECT_PTR; j++){
-                        if(indirectPtrs[j] != 0) {
-                            block_store_release(fs->BlockStore_whole, indirectPtrs[j]);
-                        }
-                    }
-                    block_store_release(fs->BlockStore_whole, doubleIndirectPtrs[i]);
-                }
-            }
-            block_store_release(fs->BlockStore_whole, fileInode->doubleIndirectPointer);
-        }
-
+        drop_page_cache(fs, fileInodeID);
+        release_file_blocks(fs, fileInode);
     } else {
         if (isDirectoryEmpty(fileInode) == false) {
             free(parentDirInode);
@@ -1294,7 +2598,7 @@ int fs_remove(F19FS_t *fs, const char *path) {
         }
         // get the current directory inode's directory block
         directoryFile_t* currentDir = (directoryFile_t *)calloc(1, BLOCK_SIZE_BYTES);
-        if (block_store_read(fs->BlockStore_whole, fileInode->directPointer[0], currentDir) == 0) {
+        if (block_store_read_inline(fs->BlockStore_whole, fileInode->directPointer[0], currentDir) == 0) {
             free(parentDirInode);
             free(parentDir);
             free(fileInode);
@@ -1303,15 +2607,13 @@ int fs_remove(F19FS_t *fs, const char *path) {
         }
         // free the current directory
         memset(currentDir, 0, sizeof(directoryFile_t));
-        block_store_write(fs->BlockStore_whole, fileInode->directPointer[0], currentDir);
+        write_meta_block(fs, fileInode->directPointer[0], currentDir);
         block_store_release(fs->BlockStore_whole, fileInode->directPointer[0]);
         free(currentDir);
     }
 
     // clear the inode itself
-    memset(fileInode, 0, sizeof(inode_t));
-    block_store_inode_write(fs->BlockStore_inode, fileInodeID, fileInode);
-    block_store_release(fs->BlockStore_inode, fileInodeID);
+    release_inode(fs, fileInodeID, fileInode);
     free(fileInode);
 
     // update the parent directory
@@ -1321,20 +2623,277 @@ int fs_remove(F19FS_t *fs, const char *path) {
     }
     (parentDir + entryIndex)->inodeNumber = 0;
     memset((parentDir + entryIndex)->filename, '\0', FS_FNAME_MAX);
-    block_store_write(fs->BlockStore_whole, parentDirInode->directPointer[0], parentDir);
+    write_meta_block(fs, parentDirInode->directPointer[0], parentDir);
 
     // update the directory inode
-    bitmap_t* parentBM = bitmap_overlay(NUM_OF_ENTRIES, &(parentDirInode->vacantFile));
-    bitmap_reset(parentBM, entryIndex);
-    bitmap_destroy(parentBM);
-    block_store_inode_write(fs->BlockStore_inode, dirInodeID, parentDirInode);
+    bitmap_view_t parentBM_view;
+    bitmap_t* parentBM = bitmap_view(&parentBM_view, NUM_OF_ENTRIES, &(parentDirInode->vacantFile));
+    bitmap_reset_inline(parentBM, entryIndex);
+    block_store_inode_write_inline(fs->BlockStore_inode, dirInodeID, parentDirInode);
 
     free(parentDir);
     free(parentDirInode);
     return 0;
 }
 
-off_t cutBoundary(int fileSize, off_t offset){
+// resolve the directory every name of a batch lives in, SIZE_MAX if it is missing or not a directory
+size_t getBatchDirInodeID(F19FS_t* fs, const char* dir, inode_t* dirInode) {
+    if (strcmp(dir, "/") != 0 && !isValidPath(dir)) {
+        return SIZE_MAX;
+    }
+    size_t dirInodeID = resolvePath(fs, dir, dirInode);
+    if (dirInodeID == SIZE_MAX || dirInode->fileType != 'd') {
+        return SIZE_MAX;
+    }
+    return dirInodeID;
+}
+
+// run a batch over the directory dirInodeID a stretch of names at a time: bare names share one pass
+//  over its block, a name holding a '/' is a path relative to it and goes to its own parent alone
+int batchInDir(F19FS_t* fs, size_t dirInodeID, inode_t* dirInode, const char *const *names, size_t count, bool create, file_t type, int *results) {
+    int done = 0;
+    for (size_t n = 0; n < count;) {
+        size_t run = n;
+        while (run < count && !(names[run] && strchr(names[run], '/'))) {
+            run++;
+        }
+        if (run > n) {
+            int result = create ? createInDir(fs, dirInodeID, dirInode, names + n, run - n, type, results ? results + n : NULL)
+                                : removeFromDir(fs, dirInodeID, dirInode, names + n, run - n, results ? results + n : NULL);
+            if (result < 0) {
+                return result;
+            }
+            done += result;
+            n = run;
+            continue;
+        }
+        const char* leaf = strrchr(names[n], '/') + 1;
+        inode_t parentInode = *dirInode;
+        size_t parentInodeID = names[n][0] == '/' ? SIZE_MAX : resolveSpan(fs, dirInodeID, names[n], leaf - names[n] - 1, &parentInode);
+        int result = -1;
+        if (parentInodeID != SIZE_MAX && parentInode.fileType == 'd') {
+            if (create) {
+                createInDir(fs, parentInodeID, &parentInode, &leaf, 1, type, &result);
+            } else {
+                removeFromDir(fs, parentInodeID, &parentInode, &leaf, 1, &result);
+            }
+        }
+        done += result == 0;
+        if (results) {
+            results[n] = result;
+        }
+        n++;
+    }
+    return done;
+}
+
+// index of the entry called fileName in an already loaded directory block, -1 if there is none
+int findEntryInDir(const inode_t* dirInode, const directoryFile_t* dirBlock, const char* fileName) {
+    for (int i = 0; i < NUM_OF_ENTRIES; i++) {
+        if (((dirInode->vacantFile >> i) & 1) == 1 && strncmp((dirBlock + i)->filename, fileName, FS_FNAME_MAX) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// first unused entry of a directory, -1 when all NUM_OF_ENTRIES are taken
+int firstFreeEntry(uint32_t vacantFile) {
+    for (int i = 0; i < NUM_OF_ENTRIES; i++) {
+        if (((vacantFile >> i) & 1) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+///
+/// Creates every name in names inside the directory dir
+///   The directory is resolved, read and written back once for the whole batch; a name
+///   holding a '/' is a path relative to dir and is created in its own parent on its own
+/// \param fs The F19FS containing the directory
+/// \param dir Absolute path to the parent directory
+/// \param names File names, or paths relative to dir, to create
+/// \param count Number of names
+/// \param type Type of the files to create (regular/directory)
+/// \param results Optional, receives 0 or < 0 for each name
+/// \return number of files created, < 0 on error
+///
+int fs_create_many(F19FS_t *fs, const char *dir, const char *const *names, size_t count, file_t type, int *results) {
+    fs_op_begin(fs);
+    int result = fs_create_many_body(fs, dir, names, count, type, results);
+    fs_op_end(fs);
+    return result;
+}
+
+int fs_create_many_body(F19FS_t *fs, const char *dir, const char *const *names, size_t count, file_t type, int *results) {
+    if (!fs || !dir || strlen(dir) == 0 || (!names && count) || !(type == FS_REGULAR || type == FS_DIRECTORY)) {
+        return -1;
+    }
+    inode_t dirInode;
+    size_t dirInodeID = getBatchDirInodeID(fs, dir, &dirInode);
+    if (dirInodeID == SIZE_MAX) {
+        return -2;
+    }
+    return batchInDir(fs, dirInodeID, &dirInode, names, count, true, type, results);
+}
+
+// create every name in names in the directory dirInodeID, its block is read and written once
+int createInDir(F19FS_t* fs, size_t dirInodeID, inode_t* dirInode, const char *const *names, size_t count, file_t type, int *results) {
+    uint8_t dirBuffer[BLOCK_SIZE_BYTES];
+    directoryFile_t* dirBlock = (directoryFile_t*)dirBuffer;
+    bool newBlock = false;
+    if (dirInode->directPointer[0] == 0) {
+        // first entries of this directory, it has no data block yet
+        memset(dirBlock, 0, BLOCK_SIZE_BYTES);
+        newBlock = true;
+    } else if (block_store_read_inline(fs->BlockStore_whole, dirInode->directPointer[0], dirBlock) == 0) {
+        return -3;
+    }
+
+    int created = 0;
+    for (size_t n = 0; n < count; n++) {
+        int result = 0;
+        int slot = -1;
+        size_t childInodeID = SIZE_MAX;
+        if (!isValidFileName(names[n]) || strlen(names[n]) >= FS_FNAME_MAX) {
+            result = -1;
+        } else if (findEntryInDir(dirInode, dirBlock, names[n]) != -1) {
+            result = -2;
+        } else if ((slot = firstFreeEntry(dirInode->vacantFile)) == -1) {
+            result = -3;
+        } else if ((childInodeID = allocate_inode(fs)) == SIZE_MAX) {
+            result = -4;
+        } else if (newBlock && created == 0) {
+            size_t dirBlockID = allocate_block(fs);
+            if (dirBlockID == SIZE_MAX) {
+                block_store_release(fs->BlockStore_inode, childInodeID);
+                result = -5;
+            } else if (!pin_dir_block(fs, dirBlockID)) {
+                block_store_release(fs->BlockStore_whole, dirBlockID);
+                block_store_release(fs->BlockStore_inode, childInodeID);
+                result = -6;
+            } else {
+                dirInode->directPointer[0] = dirBlockID;
+            }
+        }
+        if (result == 0) {
+            // same layout fs_create gives a new file, directories get their block on first use
+            inode_t childInode;
+            memset(&childInode, 0, sizeof(inode_t));
+            childInode.fileType = type == FS_DIRECTORY ? 'd' : 'r';
+            childInode.inodeNumber = childInodeID;
+            childInode.generation = slot_generation(fs, childInodeID);
+            childInode.linkCount = 1;
+            block_store_inode_write_inline(fs->BlockStore_inode, childInodeID, &childInode);
+
+            dirInode->vacantFile |= (1 << slot);
+            strncpy((dirBlock + slot)->filename, names[n], FS_FNAME_MAX);
+            (dirBlock + slot)->inodeNumber = childInodeID;
+            created++;
+        }
+        if (results) {
+            results[n] = result;
+        }
+    }
+
+    if (created) {
+        write_meta_block(fs, dirInode->directPointer[0], dirBlock);
+        block_store_inode_write_inline(fs->BlockStore_inode, dirInodeID, dirInode);
+    }
+    return created;
+}
+
+///
+/// Removes every name in names from the directory dir
+///   The directory is resolved, read and written back once for the whole batch
+///   Directories can only be removed when empty; a name holding a '/' is a path relative
+///   to dir and is removed from its own parent on its own
+/// \param fs The F19FS containing the directory
+/// \param dir Absolute path to the parent directory
+/// \param names File names, or paths relative to dir, to remove
+/// \param count Number of names
+/// \param results Optional, receives 0 or < 0 for each name
+/// \return number of files removed, < 0 on error
+///
+int fs_remove_many(F19FS_t *fs, const char *dir, const char *const *names, size_t count, int *results) {
+    fs_op_begin(fs);
+    int result = fs_remove_many_body(fs, dir, names, count, results);
+    fs_op_end(fs);
+    return result;
+}
+
+int fs_remove_many_body(F19FS_t *fs, const char *dir, const char *const *names, size_t count, int *results) {
+    if (!fs || !dir || strlen(dir) == 0 || (!names && count)) {
+        return -1;
+    }
+    inode_t dirInode;
+    size_t dirInodeID = getBatchDirInodeID(fs, dir, &dirInode);
+    if (dirInodeID == SIZE_MAX) {
+        return -2;
+    }
+    return batchInDir(fs, dirInodeID, &dirInode, names, count, false, FS_REGULAR, results);
+}
+
+// remove every name in names from the directory dirInodeID, its block is read and written once
+int removeFromDir(F19FS_t* fs, size_t dirInodeID, inode_t* dirInode, const char *const *names, size_t count, int *results) {
+    if (dirInode->directPointer[0] == 0) {
+        // nothing was ever created in here
+        for (size_t n = 0; results && n < count; n++) {
+            results[n] = -1;
+        }
+        return 0;
+    }
+    uint8_t dirBuffer[BLOCK_SIZE_BYTES];
+    directoryFile_t* dirBlock = (directoryFile_t*)dirBuffer;
+    if (block_store_read_inline(fs->BlockStore_whole, dirInode->directPointer[0], dirBlock) == 0) {
+        return -3;
+    }
+
+    int removed = 0;
+    for (size_t n = 0; n < count; n++) {
+        int result = 0;
+        int slot = names[n] ? findEntryInDir(dirInode, dirBlock, names[n]) : -1;
+        inode_t fileInode;
+        size_t fileInodeID = slot == -1 ? 0 : (dirBlock + slot)->inodeNumber;
+        if (slot == -1) {
+            result = -1;
+        } else if (block_store_inode_read_inline(fs->BlockStore_inode, fileInodeID, &fileInode) == 0) {
+            result = -2;
+        } else if (fileInode.fileType == 'd' && fileInode.vacantFile != 0) {
+            result = -3;
+        }
+        if (result == 0) {
+            if (fileInode.fileType == 'r' && fileInode.linkCount > 1) {
+                // other names still point at it, only this entry goes away
+                fileInode.linkCount -= 1;
+                block_store_inode_write_inline(fs->BlockStore_inode, fileInodeID, &fileInode);
+            } else {
+                if (fileInode.fileType == 'r') {
+                    drop_page_cache(fs, fileInodeID);
+                    release_file_blocks(fs, &fileInode);
+                } else if (fileInode.directPointer[0] != 0) {
+                    block_store_release(fs->BlockStore_whole, fileInode.directPointer[0]);
+                }
+                release_inode(fs, fileInodeID, &fileInode);
+            }
+            dirInode->vacantFile &= ~(1 << slot);
+            memset(dirBlock + slot, 0, sizeof(directoryFile_t));
+            removed++;
+        }
+        if (results) {
+            results[n] = result;
+        }
+    }
+
+    if (removed) {
+        write_meta_block(fs, dirInode->directPointer[0], dirBlock);
+        block_store_inode_write_inline(fs->BlockStore_inode, dirInodeID, dirInode);
+    }
+    return removed;
+}
+
+off_t cutBoundary(off_t fileSize, off_t offset){
     if(offset <= 0){
         return 0;
     }else if(offset > fileSize){
@@ -1344,60 +2903,109 @@ off_t cutBoundary(int fileSize, off_t offset){
     }
 }
 
-off_t getPreviosOffset(fileDescriptor_t* fileDescriptor) {
-    off_t result = 0;
-    uint16_t location = fileDescriptor->locate_order;
-    uint16_t offset = fileDescriptor->locate_offset;
-    if (location == 0) {
-        return offset;
-    }
-    if (offset != 0) {
-        result += (location - 1) * BLOCK_SIZE_BYTES;
-        result += offset;
-    } else {
-        result += location * BLOCK_SIZE_BYTES;
+// first logical block in [logical, end) that has (mapped true) or lacks (mapped false) data, end if none
+//  staged pages count as data, each pointer block is read once
+size_t findMappedBlock(F19FS_t* fs, const inode_t* inode, size_t logical, size_t end, bool mapped) {
+    pageCache_t* cache = fs->cache[inode->inodeNumber];
+    uint16_t ptrBuffer[NUM_INDIRECT_PTR];
+    uint16_t doubleBuffer[NUM_DOUBLE_DIRECT_PTR];
+    bool doubleLoaded = false;
+    uint16_t loadedID = 0;	// pointer block held by ptrBuffer
+    for (; logical < end; logical++) {
+        size_t index;
+        bool hasData = cache && findCachedPage(cache, logical, &index);
+        if (!hasData && logical < NUM_DIRECT_PTR) {
+            hasData = inode->directPointer[logical] != 0;
+        } else if (!hasData) {
+            size_t rest = logical - NUM_DIRECT_PTR;
+            uint16_t ptrID = inode->indirectPointer[0];
+            if (rest >= NUM_INDIRECT_PTR) {
+                rest -= NUM_INDIRECT_PTR;
+                ptrID = 0;
+                if (inode->doubleIndirectPointer != 0) {
+                    if (!doubleLoaded) {
+                        block_store_read_inline(fs->BlockStore_whole, inode->doubleIndirectPointer, doubleBuffer);
+                        doubleLoaded = true;
+                    }
+                    ptrID = doubleBuffer[rest / NUM_INDIRECT_PTR];
+                }
+                rest %= NUM_INDIRECT_PTR;
+            }
+            if (ptrID != 0 && ptrID != loadedID) {
+                block_store_read_inline(fs->BlockStore_whole, ptrID, ptrBuffer);
+                loadedID = ptrID;
+            }
+            hasData = ptrID != 0 && ptrBuffer[rest] != 0;
+        }
+        if (hasData == mapped) {
+            return logical;
+        }
     }
-    return result; 
+    return end;
+}
+
+off_t getPreviosOffset(fileDescriptor_t* fileDescriptor) {
+    // inverse of updateFD: locate_order whole blocks, then locate_offset into the next one
+    return (off_t)fileDescriptor->locate_order * BLOCK_SIZE_BYTES + fileDescriptor->locate_offset;
 }
 
 off_t fs_seek(F19FS_t *fs, int fd, off_t offset, seek_t whence) {
     if (!fs || fd < 0 || fd >= number_fd) {
         return -1;
     }
-    if(!bitmap_test(block_store_get_bm(fs->BlockStore_fd), fd)) { 
+    if(!bitmap_test_inline(block_store_get_bm(fs->BlockStore_fd), fd)) { 
         return -2; 
     }
-    if (!(whence == FS_SEEK_CUR || whence == FS_SEEK_END || whence == FS_SEEK_SET)) {
+    if (!(whence == FS_SEEK_CUR || whence == FS_SEEK_END || whence == FS_SEEK_SET || whence == FS_SEEK_DATA || whence == FS_SEEK_HOLE)) {
         return -3;
     }
     // prepare the file Descriptor
     fileDescriptor_t fileDescriptor;
-    block_store_fd_read(fs->BlockStore_fd, fd, &fileDescriptor);
+    block_store_fd_read_inline(fs->BlockStore_fd, fd, &fileDescriptor);
 
     // printf("[Before SEEK] fd: %d, location: %d, offset: %d\n", fd, fileDescriptor.locate_order, fileDescriptor.locate_offset);
 
     // prepre the file Inode
     size_t fileInodeID = fileDescriptor.inodeNum;
     inode_t fileInode;
-    block_store_inode_read(fs->BlockStore_inode, fileInodeID, &fileInode);
+    block_store_inode_read_inline(fs->BlockStore_inode, fileInodeID, &fileInode);
 
-    size_t fileSize = fileInode.fileSize;
+    size_t fileSize = getFileSize(fs, &fileInode);
+    // on a sparse volume the position may pass EOF, up to the last block a descriptor can address
+    off_t limit = (fs->sb->features & FEATURE_SPARSE) ? (off_t)UINT16_MAX * BLOCK_SIZE_BYTES - 1 : (off_t)fileSize;
 
     if (whence == FS_SEEK_SET) {
-        offset = cutBoundary(fileSize, offset);
+        offset = cutBoundary(limit, offset);
     } else if (whence == FS_SEEK_CUR) {
         off_t headToCurrent = getPreviosOffset(&fileDescriptor);
         // printf("the head to current size: %lu\n", headToCurrent);
-        offset = cutBoundary(fileSize, offset + headToCurrent);
+        offset = cutBoundary(limit, offset + headToCurrent);
         // printf("offset after cut boundary: %lu\n", offset);
     } else if (whence == FS_SEEK_END) {
-        offset = cutBoundary(fileSize, offset + fileSize);
-    } 
+        offset = cutBoundary(limit, offset + fileSize);
+    } else {
+        // like lseek, there is no data at or past EOF and EOF is the hole every file ends in
+        if (offset < 0 || (size_t)offset >= fileSize) {
+            return -4;
+        }
+        size_t first = offset / BLOCK_SIZE_BYTES;
+        size_t fileBlocks = (fileSize + BLOCK_SIZE_BYTES - 1) / BLOCK_SIZE_BYTES;
+        size_t found = findMappedBlock(fs, &fileInode, first, fileBlocks, whence == FS_SEEK_DATA);
+        if (whence == FS_SEEK_DATA && found == fileBlocks) {
+            return -4;
+        }
+        if (found != first) {
+            offset = found * BLOCK_SIZE_BYTES;
+        }
+        if ((size_t)offset > fileSize) {
+            offset = fileSize;
+        }
+    }
 
     fileDescriptor.locate_order = 0;
     fileDescriptor.locate_offset = 0;
     updateFD(&fileDescriptor, offset);
-    block_store_fd_write(fs->BlockStore_fd, fd, &fileDescriptor);
+    block_store_fd_write_inline(fs->BlockStore_fd, fd, &fileDescriptor);
 
     // printf("[After  SEEK] fd: %d, location: %d, offset: %d\n", fd, fileDescriptor.locate_order, fileDescriptor.locate_offset);
     
@@ -1406,17 +3014,19 @@ off_t fs_seek(F19FS_t *fs, int fd, off_t offset, seek_t whence) {
 
 ssize_t read_direct_block(F19FS_t* fs, inode_t* inode, uint16_t fd_locator, uint16_t fd_offset, void* dst, size_t nbyte) {
     uint16_t blockId = inode->directPointer[fd_locator];
-    if (blockId == 0) {
-        return 0;
-    } 
     size_t blankSpace = BLOCK_SIZE_BYTES - fd_offset;
     if (blankSpace > nbyte) {
         blankSpace = nbyte;
     }
     
-    uint8_t fileBlock[BLOCK_SIZE_BYTES];
-    block_store_read(fs->BlockStore_whole, blockId, fileBlock);
-    memcpy(dst, fileBlock + fd_offset, blankSpace);
+    if (blockId == 0) {
+        // a hole, fs_read already stopped nbyte at EOF
+        memset(dst, 0, blankSpace);
+    } else {
+        uint8_t fileBlock[BLOCK_SIZE_BYTES];
+        block_store_read_inline(fs->BlockStore_whole, blockId, fileBlock);
+        memcpy(dst, fileBlock + fd_offset, blankSpace);
+    }
 
     nbyte -= blankSpace;
     if (nbyte == 0) {
@@ -1431,12 +3041,13 @@ ssize_t read_direct_block(F19FS_t* fs, inode_t* inode, uint16_t fd_locator, uint
 }
 
 ssize_t read_indirect_block(F19FS_t* fs, inode_t* inode, uint16_t fd_locator, uint16_t fd_offset, void* dst, size_t nbyte, uint16_t indirectBlockID) {
+    // prepare the indirect pointer buffer, without a pointer block all its blocks are holes
+    uint16_t indirectPtrBuffer[NUM_INDIRECT_PTR];
     if (indirectBlockID == 0) {
-        return 0;
+        memset(indirectPtrBuffer, 0, BLOCK_SIZE_BYTES);
+    } else {
+        block_store_read_inline(fs->BlockStore_whole, indirectBlockID, indirectPtrBuffer);
     }
-    // prepare the indirect pointer buffer
-    uint16_t indirectPtrBuffer[NUM_INDIRECT_PTR];
-    block_store_read(fs->BlockStore_whole, indirectBlockID, indirectPtrBuffer);
 
     // get the index of current indirectPtr
     uint16_t indirectPtrID = (fd_locator - NUM_DIRECT_PTR) % NUM_DOUBLE_DIRECT_PTR;
@@ -1445,18 +3056,18 @@ ssize_t read_indirect_block(F19FS_t* fs, inode_t* inode, uint16_t fd_locator, ui
 
     while (indirectPtrID < NUM_INDIRECT_PTR && nbyte > 0) {
         size_t blockID = indirectPtrBuffer[indirectPtrID];
-        if (blockID == 0) {
-            return sumOfReadByte;
-        }
-        uint8_t blockBuffer[BLOCK_SIZE_BYTES];
-        block_store_read(fs->BlockStore_whole, blockID, blockBuffer);
-
         size_t blankSpace = BLOCK_SIZE_BYTES - fd_offset;
         if (blankSpace > nbyte) {
             blankSpace = nbyte;
         }
 
-        memcpy(dst, blockBuffer + fd_offset, blankSpace);
+        if (blockID == 0) {
+            memset(dst, 0, blankSpace);
+        } else {
+            uint8_t blockBuffer[BLOCK_SIZE_BYTES];
+            block_store_read_inline(fs->BlockStore_whole, blockID, blockBuffer);
+            memcpy(dst, blockBuffer + fd_offset, blankSpace);
+        }
 
         // update the global variable
         nbyte -= blankSpace;
@@ -1475,24 +3086,111 @@ ssize_t read_indirect_block(F19FS_t* fs, inode_t* inode, uint16_t fd_locator, ui
 }
 
 ssize_t read_doubleDirect_block(F19FS_t* fs, inode_t* inode, uint16_t fd_locator, uint16_t fd_offset, void* dst, size_t nbyte) {
+    int index = (fd_locator - (NUM_DIRECT_PTR + NUM_INDIRECT_PTR)) / NUM_DOUBLE_DIRECT_PTR; 
     if (inode->doubleIndirectPointer == 0) {
-        return 0;
+        return read_indirect_block(fs, inode, fd_locator, fd_offset, dst, nbyte, 0);
     }
     uint16_t doubleDirectPtrBuffer[NUM_DOUBLE_DIRECT_PTR];
-    block_store_read(fs->BlockStore_whole, inode->doubleIndirectPointer, doubleDirectPtrBuffer);
+    block_store_read_inline(fs->BlockStore_whole, inode->doubleIndirectPointer, doubleDirectPtrBuffer);
+    return read_indirect_block(fs, inode, fd_locator, fd_offset, dst, nbyte, doubleDirectPtrBuffer[index]);
+}
 
-    int index = (fd_locator - (NUM_DIRECT_PTR + NUM_INDIRECT_PTR)) / NUM_DOUBLE_DIRECT_PTR; 
-    if (doubleDirectPtrBuffer[index] == 0) {
+// pass an madvise hint for logical blocks [first, last) of a file, one call per physical run
+bool advise_file_blocks(F19FS_t* fs, const inode_t* inode, size_t first, size_t last, int advice) {
+    bool result = true;
+    size_t runStart = 0, runLength = 0;
+    for (size_t logical = first; logical <= last; logical++) {
+        uint16_t blockID = logical < last ? getBlockID(fs, inode, logical) : 0;
+        if (blockID != 0 && runLength > 0 && blockID == runStart + runLength) {
+            runLength++;
+            continue;
+        }
+        if (runLength > 0 && !block_store_advise(fs->BlockStore_whole, runStart, runLength, advice)) {
+            result = false;
+        }
+        runStart = blockID;
+        runLength = blockID != 0;
+    }
+    return result;
+}
+
+// grow the descriptor's window while reads stay sequential and prefetch the blocks past the reader
+void readahead_on_read(F19FS_t* fs, int fd, const inode_t* inode, size_t position, size_t nbyte, size_t fileSize) {
+    readahead_t* ra = &fs->readahead[fd];
+    if (ra->advice == FS_ADV_RANDOM) {
+        return;
+    }
+    size_t first = position / BLOCK_SIZE_BYTES;
+    size_t last = (position + nbyte - 1) / BLOCK_SIZE_BYTES;
+    if (first == ra->next || first + 1 == ra->next) {
+        ra->window = ra->window ? ra->window * 2 : FS_READAHEAD_MIN;
+    } else {
+        ra->window = 0;
+        ra->hinted = 0;
+    }
+    if (ra->advice == FS_ADV_SEQUENTIAL || ra->window > FS_READAHEAD_MAX) {
+        ra->window = FS_READAHEAD_MAX;
+    }
+    ra->next = last + 1;
+
+    size_t end = ra->next + ra->window;
+    size_t fileBlocks = (fileSize + BLOCK_SIZE_BYTES - 1) / BLOCK_SIZE_BYTES;
+    if (end > fileBlocks) {
+        end = fileBlocks;
+    }
+    size_t start = ra->hinted > ra->next ? ra->hinted : ra->next;
+    if (ra->window == 0 || start >= end) {
+        return;
+    }
+    advise_file_blocks(fs, inode, start, end, POSIX_MADV_WILLNEED);
+    ra->hinted = end;
+}
+
+int fs_advise(F19FS_t *fs, int fd, off_t offset, size_t len, fs_advice_t advice) {
+    if (!fs || fd < 0 || fd >= number_fd || offset < 0 || advice > FS_ADV_DONTNEED) {
+        return -1;
+    }
+    if (!block_store_sub_test(fs->BlockStore_fd, fd)) {
+        return -2;
+    }
+    fileDescriptor_t fileDescriptor;
+    block_store_fd_read_inline(fs->BlockStore_fd, fd, &fileDescriptor);
+    inode_t fileInode;
+    block_store_inode_read_inline(fs->BlockStore_inode, fileDescriptor.inodeNum, &fileInode);
+
+    static const int posixAdvice[] = {
+        POSIX_MADV_NORMAL, POSIX_MADV_SEQUENTIAL, POSIX_MADV_RANDOM, POSIX_MADV_WILLNEED, POSIX_MADV_DONTNEED
+    };
+    readahead_t* ra = &fs->readahead[fd];
+    if (advice <= FS_ADV_RANDOM) {
+        // access pattern hints stick to the descriptor, one-off hints do not
+        ra->advice = advice;
+        ra->window = advice == FS_ADV_SEQUENTIAL ? FS_READAHEAD_MAX : 0;
+        ra->hinted = 0;
+    }
+
+    size_t fileSize = getFileSize(fs, &fileInode);
+    size_t end = (len == 0 || (size_t)offset + len > fileSize) ? fileSize : (size_t)offset + len;
+    if ((size_t)offset >= end) {
         return 0;
     }
-    return read_indirect_block(fs, inode, fd_locator, fd_offset, dst, nbyte, doubleDirectPtrBuffer[index]);
+    size_t first = offset / BLOCK_SIZE_BYTES;
+    size_t last = (end + BLOCK_SIZE_BYTES - 1) / BLOCK_SIZE_BYTES;
+    return advise_file_blocks(fs, &fileInode, first, last, posixAdvice[advice]) ? 0 : -3;
 }
 
 ssize_t fs_read(F19FS_t *fs, int fd, void *dst, size_t nbyte) {
+    fs_lock(fs, false);
+    ssize_t result = fs_read_body(fs, fd, dst, nbyte);
+    fs_unlock(fs);
+    return result;
+}
+
+ssize_t fs_read_body(F19FS_t *fs, int fd, void *dst, size_t nbyte) {
     if (!fs || fd < 0 || fd >= number_fd || !dst) {
         return -1;
     }
-    if(!bitmap_test(block_store_get_bm(fs->BlockStore_fd), fd)) { 
+    if(!bitmap_test_inline(block_store_get_bm(fs->BlockStore_fd), fd)) { 
         return -2; 
     }
     if(nbyte == 0){
@@ -1501,7 +3199,7 @@ ssize_t fs_read(F19FS_t *fs, int fd, void *dst, size_t nbyte) {
 
     // prepare the file descriptor
     fileDescriptor_t fileDescriptor;
-    block_store_fd_read(fs->BlockStore_fd, fd, &fileDescriptor);
+    block_store_fd_read_inline(fs->BlockStore_fd, fd, &fileDescriptor);
     uint16_t fd_locator = fileDescriptor.locate_order;
     uint16_t fd_offset = fileDescriptor.locate_offset;
     // printf("[Before READ] fd: %d, location: %d, offset: %d\n", fd, fd_locator, fd_offset);
@@ -1509,15 +3207,24 @@ ssize_t fs_read(F19FS_t *fs, int fd, void *dst, size_t nbyte) {
     // prepare file inode
     uint8_t fileInodeID = fileDescriptor.inodeNum;
     inode_t fileInode;
-    block_store_inode_read(fs->BlockStore_inode, fileInodeID, &fileInode);
+    block_store_inode_read_inline(fs->BlockStore_inode, fileInodeID, &fileInode);
 
     off_t headToCurrent = getPreviosOffset(&fileDescriptor);
-    if(headToCurrent + nbyte > fileInode.fileSize) {
-        nbyte = fileInode.fileSize - headToCurrent;;
+    size_t fileSize = getFileSize(fs, &fileInode);
+    if ((size_t)headToCurrent >= fileSize) {
+        return 0;
+    }
+    if(headToCurrent + nbyte > fileSize) {
+        nbyte = fileSize - headToCurrent;
     }
 
+    readahead_on_read(fs, fd, &fileInode, headToCurrent, nbyte, fileSize);
+
     ssize_t sumOfReadByte = 0;
-    if (fd_locator < NUM_DIRECT_PTR) {
+    if (fs->cache[fileInodeID]) {
+        // staged pages are newer than the device
+        sumOfReadByte = read_through_cache(fs, fs->cache[fileInodeID], &fileInode, headToCurrent, dst, nbyte);
+    } else if (fd_locator < NUM_DIRECT_PTR) {
         sumOfReadByte = read_direct_block(fs, &fileInode, fd_locator, fd_offset, dst, nbyte);
     } else if (fd_locator >= NUM_DIRECT_PTR && fd_locator < NUM_INDIRECT_PTR + NUM_DIRECT_PTR) {
         sumOfReadByte = read_indirect_block(fs, &fileInode, fd_locator, fd_offset, dst, nbyte, fileInode.indirectPointer[0]);
@@ -1526,7 +3233,7 @@ ssize_t fs_read(F19FS_t *fs, int fd, void *dst, size_t nbyte) {
     }
 
     updateFD(&fileDescriptor, sumOfReadByte);
-    block_store_fd_write(fs->BlockStore_fd, fd, &fileDescriptor);
+    block_store_fd_write_inline(fs->BlockStore_fd, fd, &fileDescriptor);
 
     // printf("[After  READ] fd: %d, location: %d, offset: %d\n", fd, fileDescriptor.locate_order, fileDescriptor.locate_offset);
 
@@ -1534,6 +3241,13 @@ ssize_t fs_read(F19FS_t *fs, int fd, void *dst, size_t nbyte) {
 }
 
 int fs_move(F19FS_t *fs, const char *src, const char *dst) {
+    fs_op_begin(fs);
+    int result = fs_move_body(fs, src, dst);
+    fs_op_end(fs);
+    return result;
+}
+
+int fs_move_body(F19FS_t *fs, const char *src, const char *dst) {
     if (!fs || !src || !dst) {
         return -1;
     }
@@ -1617,10 +3331,10 @@ int fs_move(F19FS_t *fs, const char *src, const char *dst) {
     }
 
     inode_t src_parentDirInode;
-    block_store_inode_read(fs->BlockStore_inode, src_parentDirInodeID, &src_parentDirInode);
+    block_store_inode_read_inline(fs->BlockStore_inode, src_parentDirInodeID, &src_parentDirInode);
 
     inode_t dst_parentDirInode;
-    block_store_inode_read(fs->BlockStore_inode, dst_parentDirInodeID, &dst_parentDirInode);
+    block_store_inode_read_inline(fs->BlockStore_inode, dst_parentDirInodeID, &dst_parentDirInode);
 
     size_t src_fileInodeId = getFileInodeID(fs, src_parentDirInodeID, src_fileName);
     if (src_fileInodeId == SIZE_MAX) {
@@ -1636,10 +3350,10 @@ int fs_move(F19FS_t *fs, const char *src, const char *dst) {
     // printf("dst_filename: %s, dst_fileInodeID: %lu\n", dst_fileName, dst_fileInodeId);
 
     inode_t src_fileInode;
-    block_store_inode_read(fs->BlockStore_inode, src_fileInodeId, &src_fileInode);
+    block_store_inode_read_inline(fs->BlockStore_inode, src_fileInodeId, &src_fileInode);
 
     inode_t dst_fileInode;
-    block_store_inode_read(fs->BlockStore_inode, dst_fileInodeId, &dst_fileInode);
+    block_store_inode_read_inline(fs->BlockStore_inode, dst_fileInodeId, &dst_fileInode);
 
     // condition 2: src: /folder/file1  dst: folder => in same folder, do nothing
     if (src_parentDirInodeID == dst_fileInodeId) {
@@ -1648,7 +3362,7 @@ int fs_move(F19FS_t *fs, const char *src, const char *dst) {
 
     // condition 3: src: /folder/with_folder dst: /folder2
     directoryFile_t* src_dir_block = (directoryFile_t *)calloc(1, BLOCK_SIZE_BYTES);
-    block_store_read(fs->BlockStore_whole, src_parentDirInode.directPointer[0], src_dir_block);
+    block_store_read_inline(fs->BlockStore_whole, src_parentDirInode.directPointer[0], src_dir_block);
 
 
     int src_fileIndex = getFileIndexInDir(&src_parentDirInode, src_dir_block, src_fileName);
@@ -1658,26 +3372,26 @@ int fs_move(F19FS_t *fs, const char *src, const char *dst) {
     // remove the directory File Entry
     (src_dir_block + src_fileIndex)->inodeNumber = 0;
     memset((src_dir_block + src_fileIndex)->filename, '\0', FS_FNAME_MAX);
-    block_store_write(fs->BlockStore_whole, src_parentDirInode.directPointer[0], src_dir_block);
+    write_meta_block(fs, src_parentDirInode.directPointer[0], src_dir_block);
     free(src_dir_block);
 
     // update the src directory inode
-    bitmap_t* parentBM = bitmap_overlay(NUM_OF_ENTRIES, &(src_parentDirInode.vacantFile));
-    bitmap_reset(parentBM, src_fileIndex);
-    bitmap_destroy(parentBM);
-    block_store_inode_write(fs->BlockStore_inode, src_parentDirInodeID, &src_parentDirInode);
+    bitmap_view_t parentBM_view;
+    bitmap_t* parentBM = bitmap_view(&parentBM_view, NUM_OF_ENTRIES, &(src_parentDirInode.vacantFile));
+    bitmap_reset_inline(parentBM, src_fileIndex);
+    block_store_inode_write_inline(fs->BlockStore_inode, src_parentDirInodeID, &src_parentDirInode);
 
     //get the dst directory file block
     directoryFile_t* dst_dir_block = (directoryFile_t *)calloc(1, BLOCK_SIZE_BYTES);
-    block_store_read(fs->BlockStore_whole, dst_fileInode.directPointer[0], dst_dir_block);
+    block_store_read_inline(fs->BlockStore_whole, dst_fileInode.directPointer[0], dst_dir_block);
     
     // update the dst directory file block
-    bitmap_t* dst_file_BM = bitmap_overlay(NUM_OF_ENTRIES, &(dst_fileInode.vacantFile));
+    bitmap_view_t dst_file_BM_view;
+    bitmap_t* dst_file_BM = bitmap_view(&dst_file_BM_view, NUM_OF_ENTRIES, &(dst_fileInode.vacantFile));
     size_t location = bitmap_ffz(dst_file_BM);
     (dst_dir_block + location)->inodeNumber = src_fileInodeId;
     strncpy((dst_dir_block + location)->filename, src_fileName, strlen(src_fileName));
-    bitmap_destroy(dst_file_BM);
-    block_store_write(fs->BlockStore_whole, dst_fileInode.directPointer[0], dst_dir_block);
+    write_meta_block(fs, dst_fileInode.directPointer[0], dst_dir_block);
     free(dst_dir_block);
     // printf("-----------------\n");
     return 0;
@@ -1685,6 +3399,13 @@ int fs_move(F19FS_t *fs, const char *src, const char *dst) {
 
 // 
 int fs_link(F19FS_t *fs, const char *src, const char *dst) {
+    fs_op_begin(fs);
+    int result = fs_link_body(fs, src, dst);
+    fs_op_end(fs);
+    return result;
+}
+
+int fs_link_body(F19FS_t *fs, const char *src, const char *dst) {
     if (!fs || !src || !dst) {
         return -1;
     }
@@ -1752,18 +3473,17 @@ int fs_link(F19FS_t *fs, const char *src, const char *dst) {
     // printf("dst_path: %s, dst_parentDirInodeID: %lu\n", dst_dirPath, dst_parentDirInodeID);
 
     inode_t src_parentDirInode;
-    block_store_inode_read(fs->BlockStore_inode, src_parentDirInodeID, &src_parentDirInode);
+    block_store_inode_read_inline(fs->BlockStore_inode, src_parentDirInodeID, &src_parentDirInode);
 
     inode_t dst_parentDirInode;
-    block_store_inode_read(fs->BlockStore_inode, dst_parentDirInodeID, &dst_parentDirInode);
+    block_store_inode_read_inline(fs->BlockStore_inode, dst_parentDirInodeID, &dst_parentDirInode);
 
     directoryFile_t* dst_directoryFile = calloc(1, BLOCK_SIZE_BYTES);
-    block_store_read(fs->BlockStore_whole, dst_parentDirInode.directPointer[0], dst_directoryFile);
-    bitmap_t* dirBM = bitmap_overlay(NUM_OF_ENTRIES, &(dst_parentDirInode.vacantFile));
-    if (bitmap_total_set(dirBM) == NUM_OF_ENTRIES) {
+    block_store_read_inline(fs->BlockStore_whole, dst_parentDirInode.directPointer[0], dst_directoryFile);
+    if ((dst_parentDirInode.vacantFile & ENTRY_BITS) == ENTRY_BITS) {
+        free(dst_directoryFile);
         return -13;
     }
-    bitmap_destroy(dirBM);
 
     size_t src_fileInodeId = getFileInodeID(fs, src_parentDirInodeID, src_fileName);
     if (src_fileInodeId == SIZE_MAX) {
@@ -1779,19 +3499,19 @@ int fs_link(F19FS_t *fs, const char *src, const char *dst) {
     // printf("dst_filename: %s, dst_fileInodeID: %lu\n", dst_fileName, dst_fileInodeId);
 
     inode_t src_fileInode;
-    block_store_inode_read(fs->BlockStore_inode, src_fileInodeId, &src_fileInode);
+    block_store_inode_read_inline(fs->BlockStore_inode, src_fileInodeId, &src_fileInode);
 
     if (src_fileInode.linkCount >= 255) {
         return -14;
     }
 
     inode_t dst_fileInode;
-    block_store_inode_read(fs->BlockStore_inode, dst_fileInodeId, &dst_fileInode);
+    block_store_inode_read_inline(fs->BlockStore_inode, dst_fileInodeId, &dst_fileInode);
 
-    bitmap_t* dst_dirBM = bitmap_overlay(NUM_OF_ENTRIES, &(dst_parentDirInode.vacantFile));
+    bitmap_view_t dst_dirBM_view;
+    bitmap_t* dst_dirBM = bitmap_view(&dst_dirBM_view, NUM_OF_ENTRIES, &(dst_parentDirInode.vacantFile));
     size_t index = bitmap_ffz(dst_dirBM);
-    bitmap_set(dst_dirBM, index);
-    bitmap_destroy(dst_dirBM);
+    bitmap_set_inline(dst_dirBM, index);
 
     (dst_directoryFile + index)->inodeNumber = src_fileInodeId;
     strncpy((dst_directoryFile + index)->filename, dst_fileName, FS_FNAME_MAX);
@@ -1801,12 +3521,239 @@ int fs_link(F19FS_t *fs, const char *src, const char *dst) {
         src_fileInode.linkCount += 1;
     }
 
-    block_store_inode_write(fs->BlockStore_inode, src_fileInodeId, &src_fileInode);
-    block_store_inode_write(fs->BlockStore_inode, dst_parentDirInodeID, &dst_parentDirInode);
-    block_store_write(fs->BlockStore_whole, dst_parentDirInode.directPointer[0], dst_directoryFile);
+    block_store_inode_write_inline(fs->BlockStore_inode, src_fileInodeId, &src_fileInode);
+    block_store_inode_write_inline(fs->BlockStore_inode, dst_parentDirInodeID, &dst_parentDirInode);
+    write_meta_block(fs, dst_parentDirInode.directPointer[0], dst_directoryFile);
 
     free(dst_directoryFile);
     return 0;
 }
 
+fs_ring_t* fs_ring_create() {
+    fs_ring_t* ring = (fs_ring_t*)calloc(1, sizeof(fs_ring_t));
+    if (!ring) {
+        return NULL;
+    }
+    pthread_mutex_init(&ring->mutex, NULL);
+    pthread_cond_init(&ring->submitted, NULL);
+    pthread_cond_init(&ring->completed, NULL);
+    return ring;
+}
+
+void fs_ring_destroy(fs_ring_t* ring) {
+    if (!ring) {
+        return;
+    }
+    pthread_mutex_lock(&ring->mutex);
+    ring->stopping = true;
+    pthread_cond_broadcast(&ring->submitted);
+    pthread_mutex_unlock(&ring->mutex);
+    for (size_t i = 0; i < ring->nr_workers; i++) {
+        pthread_join(ring->workers[i], NULL);
+    }
+    pthread_cond_destroy(&ring->completed);
+    pthread_cond_destroy(&ring->submitted);
+    pthread_mutex_destroy(&ring->mutex);
+    free(ring);
+}
+
+// take [*offset, *offset + nbyte) of a write-through descriptor and move the descriptor past it, at the
+//  end of file for FD_APPEND and at the R/W position otherwise; the holes in the range are mapped and
+//  zeroed and the size covers it before anything is copied
+// 1 when reserved, 0 when the write has to run the usual way (buffered, or the range can't be
+//  mapped whole and a short write is due), < 0 on error
+int reserve_write(F19FS_t* fs, int fd, size_t nbyte, size_t* inodeID, size_t* offset, uint32_t* generation) {
+    if (fd < 0 || fd >= number_fd || !block_store_sub_test(fs->BlockStore_fd, fd)) {
+        return 0;
+    }
+    fileDescriptor_t fileDescriptor;
+    block_store_fd_read_inline(fs->BlockStore_fd, fd, &fileDescriptor);
+    if ((fileDescriptor.usage & FD_WRITE_BACK) || nbyte == 0) {
+        return 0;
+    }
+    if (write_back_inode(fs, fileDescriptor.inodeNum) < 0) {
+        return -3;
+    }
+    inode_t inode;
+    block_store_inode_read_inline(fs->BlockStore_inode, fileDescriptor.inodeNum, &inode);
+    *inodeID = fileDescriptor.inodeNum;
+    *offset = (fileDescriptor.usage & FD_APPEND) ? inode.fileSize : (size_t)getPreviosOffset(&fileDescriptor);
+    *generation = inode.generation;
+    fs_tx_begin(fs);
+    int result = fs_fallocate_body(fs, fd, *offset, nbyte);
+    fs_tx_end(fs);
+    if (result < 0) {
+        return 0;
+    }
+    fileDescriptor.locate_order = 0;
+    fileDescriptor.locate_offset = 0;
+    updateFD(&fileDescriptor, *offset + nbyte);
+    block_store_fd_write_inline(fs->BlockStore_fd, fd, &fileDescriptor);
+    return 1;
+}
+
+// copy a reserved range into its blocks through the mapping, nothing but the data changes
+//  a block is marked dirty only once its data is in, so a sync or snapshot never takes it half copied
+ssize_t copy_reserved(F19FS_t* fs, size_t inodeID, uint32_t generation, size_t offset, const void* src, size_t nbyte) {
+    inode_t inode;
+    block_store_inode_read_inline(fs->BlockStore_inode, inodeID, &inode);
+    if (inode.generation != generation || inode.fileSize < offset + nbyte) {
+        // removed or truncated before the copy, the range is not the file's any more
+        return -5;
+    }
+    uint8_t* data = block_store_get_data(fs->BlockStore_whole);
+    const uint8_t* from = (const uint8_t*)src;
+    size_t done = 0;
+    while (done < nbyte) {
+        size_t position = offset + done;
+        size_t inBlock = position % BLOCK_SIZE_BYTES;
+        size_t length = BLOCK_SIZE_BYTES - inBlock < nbyte - done ? BLOCK_SIZE_BYTES - inBlock : nbyte - done;
+        uint16_t blockID = getBlockID(fs, &inode, position / BLOCK_SIZE_BYTES);
+        if (blockID == 0) {
+            return -5;
+        }
+        memcpy(data + (size_t)blockID * BLOCK_SIZE_BYTES + inBlock, from + done, length);
+        block_store_mark_dirty_shared(fs->BlockStore_whole, blockID, 1);
+        done += length;
+    }
+    return done;
+}
+
+// a queued write-through reserves its range under the write lock and copies under the read lock,
+//  so writers only queue for the block and inode allocation and copy side by side
+// -1 when the write has to run the usual way
+ssize_t ring_write(F19FS_t* fs, const fs_request_t* request) {
+    size_t inodeID = 0, offset = 0;
+    uint32_t generation = 0;
+    fs_lock(fs, true);
+    int reserved = reserve_write(fs, request->fd, request->nbyte, &inodeID, &offset, &generation);
+    fs_unlock(fs);
+    if (reserved <= 0) {
+        return reserved == 0 ? -1 : reserved;
+    }
+    fs_lock(fs, false);
+    ssize_t result = copy_reserved(fs, inodeID, generation, offset, request->buf, request->nbyte);
+    fs_unlock(fs);
+    return result;
+}
+
+// run one request the way the synchronous call would, under the volume lock
+ssize_t fs_ring_execute(F19FS_t* fs, const fs_request_t* request) {
+    ssize_t result = -1;
+    if (request->op == FS_OP_WRITE && request->buf != NULL && (result = ring_write(fs, request)) != -1) {
+        return result;
+    }
+    if (request->op == FS_OP_READ) {
+        fs_lock(fs, false);
+        result = fs_read_body(fs, request->fd, request->buf, request->nbyte);
+        fs_unlock(fs);
+        return result;
+    }
+    fs_op_begin(fs);
+    if (request->op == FS_OP_WRITE) {
+        result = fs_write_body(fs, request->fd, request->buf, request->nbyte);
+    } else if (request->op == FS_OP_CREATE) {
+        result = fs_create_body(fs, request->path, request->type);
+    } else if (request->op == FS_OP_REMOVE) {
+        result = fs_remove_body(fs, request->path);
+    }
+    fs_op_end(fs);
+    return result;
+}
+
+void* fs_ring_worker(void* arg) {
+    F19FS_t* fs = (F19FS_t*)arg;
+    fs_ring_t* ring = fs->ring;
+
+    pthread_mutex_lock(&ring->mutex);
+    while (true) {
+        while (ring->sq_head == ring->sq_tail && !ring->stopping) {
+            pthread_cond_wait(&ring->submitted, &ring->mutex);
+        }
+        if (ring->sq_head == ring->sq_tail) {
+            // stopping and nothing left to run
+            break;
+        }
+        fs_request_t request = ring->sq[ring->sq_head % FS_QUEUE_DEPTH];
+        ring->sq_head += 1;
+        ring->inflight += 1;
+        pthread_mutex_unlock(&ring->mutex);
+
+        ssize_t result = fs_ring_execute(fs, &request);
+
+        pthread_mutex_lock(&ring->mutex);
+        fs_completion_t* completion = &ring->cq[ring->cq_tail % FS_QUEUE_DEPTH];
+        completion->user_data = request.user_data;
+        completion->result = result;
+        ring->cq_tail += 1;
+        ring->inflight -= 1;
+        pthread_cond_broadcast(&ring->completed);
+    }
+    pthread_mutex_unlock(&ring->mutex);
+    return NULL;
+}
+
+int fs_submit(F19FS_t *fs, const fs_request_t *requests, size_t count) {
+    if (!fs || !fs->ring || (!requests && count)) {
+        return -1;
+    }
+    fs_ring_t* ring = fs->ring;
+    pthread_mutex_lock(&ring->mutex);
+
+    // the pool is only started by the first user of the rings
+    while (ring->nr_workers < FS_QUEUE_WORKERS) {
+        if (pthread_create(&ring->workers[ring->nr_workers], NULL, fs_ring_worker, fs) != 0) {
+            break;
+        }
+        ring->nr_workers += 1;
+    }
+    if (ring->nr_workers == 0) {
+        pthread_mutex_unlock(&ring->mutex);
+        return -2;
+    }
+
+    // every accepted request needs a cq slot waiting for it, so count everything not yet reaped
+    size_t queued = 0;
+    while (queued < count) {
+        size_t outstanding = (ring->sq_tail - ring->sq_head) + ring->inflight + (ring->cq_tail - ring->cq_head);
+        if (outstanding >= FS_QUEUE_DEPTH) {
+            break;
+        }
+        ring->sq[ring->sq_tail % FS_QUEUE_DEPTH] = requests[queued];
+        ring->sq_tail += 1;
+        queued += 1;
+    }
+    if (queued) {
+        pthread_cond_broadcast(&ring->submitted);
+    }
+    pthread_mutex_unlock(&ring->mutex);
+    return queued;
+}
 
+int fs_poll_completions(F19FS_t *fs, fs_completion_t *completions, size_t max, size_t min_complete) {
+    if (!fs || !fs->ring || (!completions && max)) {
+        return -1;
+    }
+    fs_ring_t* ring = fs->ring;
+    if (min_complete > max) {
+        min_complete = max;
+    }
+    pthread_mutex_lock(&ring->mutex);
+    while (true) {
+        size_t ready = ring->cq_tail - ring->cq_head;
+        size_t outstanding = ready + (ring->sq_tail - ring->sq_head) + ring->inflight;
+        // don't wait for completions that can never arrive
+        if (ready >= min_complete || ready == outstanding) {
+            break;
+        }
+        pthread_cond_wait(&ring->completed, &ring->mutex);
+    }
+    size_t reaped = 0;
+    while (reaped < max && ring->cq_head != ring->cq_tail) {
+        completions[reaped] = ring->cq[ring->cq_head % FS_QUEUE_DEPTH];
+        ring->cq_head += 1;
+        reaped += 1;
+    }
+    pthread_mutex_unlock(&ring->mutex);
+    return reaped;
+}
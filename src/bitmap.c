@@ -1,18 +1,7 @@
 #include "bitmap.h"
+#include "bitmap_inline.h"
 #include <string.h>
 
-// Just the one for now. Indicates we're an overlay and should not free
-// (also, make sure that ALL is as wide as ll of the flags)
-typedef enum { NONE = 0x00, OVERLAY = 0x01, ALL = 0xFF } BITMAP_FLAGS;
-
-struct bitmap {
-    unsigned leftover_bits;  // Packing will increase this to an int anyway
-    BITMAP_FLAGS flags;      // Generic place to store flags. Not enough flags to worry about width yet.
-    uint8_t *data;
-    size_t bit_count, byte_count;
-};
-
-
 #define FLAG_CHECK(bitmap, flag) ((bitmap)->flags & flag)
 // Not sure I want these
 // #define FLAG_SET(bitmap, flag) bitmap->flags |= flag
@@ -26,9 +15,6 @@ static const uint8_t mask[8] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80};
 // Mask for all bits at index i and lower
 static const uint8_t mask_down_inclusive[8] = {0x01, 0x03, 0x07, 0x0F, 0x1F, 0x3F, 0x7F, 0xFF};
 
-// Inverted mask
-static const uint8_t invert_mask[8] = {0xFE, 0xFD, 0xFB, 0xF7, 0xEF, 0xDF, 0xBF, 0x7F};
-
 // Way more testing than I should waste my time on suggested uint8_t was faster
 // but it may still be negligible/indeterminate.
 // Since the data store is uint8_t, we already get punished for our bad alignment
@@ -56,59 +42,161 @@ static const uint8_t bit_totals[256] = {B6(0), B6(1), B6(1), B6(2)};
     }
 */
 
+// Counting kernels: bits set in size bytes of data
+// The table walks a byte at a time, the others 8 bytes at a time with a popcount per word
+static size_t count_table(const uint8_t *data, size_t size) {
+    size_t total = 0;
+    for (size_t idx = 0; idx < size; ++idx) {
+        total += bit_totals[data[idx]];
+    }
+    return total;
+}
+
+#define COUNT_WORDS_BODY                                                         \
+    size_t total = 0, idx = 0;                                                   \
+    for (; idx + sizeof(uint64_t) <= size; idx += sizeof(uint64_t)) {            \
+        uint64_t word;                                                           \
+        memcpy(&word, data + idx, sizeof(word));                                 \
+        total += __builtin_popcountll(word);                                     \
+    }                                                                            \
+    return total + count_table(data + idx, size - idx);
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+// built for the POPCNT instruction, only ever called where the CPU has it
+__attribute__((target("popcnt"))) static size_t count_popcnt(const uint8_t *data, size_t size) {
+    COUNT_WORDS_BODY
+}
+#else
+// elsewhere the compiler's popcount already is the best the target has
+static size_t count_words(const uint8_t *data, size_t size) {
+    COUNT_WORDS_BODY
+}
+#endif
+#undef COUNT_WORDS_BODY
+
+static size_t count_dispatch(const uint8_t *data, size_t size);
+static size_t (*count_kernel)(const uint8_t *, size_t) = count_dispatch;
+
+// first call: pick the kernel for this CPU, every later call goes straight to it
+static size_t count_dispatch(const uint8_t *data, size_t size) {
+    size_t (*kernel)(const uint8_t *, size_t) = count_table;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("popcnt")) {
+        kernel = count_popcnt;
+    }
+#else
+    kernel = count_words;
+#endif
+    __atomic_store_n(&count_kernel, kernel, __ATOMIC_RELAXED);
+    return kernel(data, size);
+}
+
+static inline size_t count_bits(const uint8_t *data, size_t size) {
+    return __atomic_load_n(&count_kernel, __ATOMIC_RELAXED)(data, size);
+}
+
 // A place to generalize the creation process and setup
 bitmap_t *bitmap_initialize(size_t n_bits, BITMAP_FLAGS flags);
 
+// everything but data, shared by heap bitmaps and views
+static inline void init_fields(bitmap_t *const bitmap, const size_t n_bits, const BITMAP_FLAGS flags) {
+    bitmap->flags         = flags;
+    bitmap->total         = 0;
+    bitmap->bit_count     = n_bits;
+    bitmap->byte_count    = n_bits >> 3;
+    bitmap->leftover_bits = n_bits & 0x07;
+    bitmap->byte_count += (bitmap->leftover_bits ? 1 : 0);
+}
+
 void bitmap_set(bitmap_t *const bitmap, const size_t bit) {
-    bitmap->data[bit >> 3] |= mask[bit & 0x07];
+    bitmap_set_inline(bitmap, bit);
+}
+
+void bitmap_set_shared(bitmap_t *const bitmap, const size_t bit) {
+    __atomic_fetch_or(&bitmap->data[bit >> 3], (uint8_t) (1u << (bit & 0x07)), __ATOMIC_RELEASE);
 }
 
 void bitmap_reset(bitmap_t *const bitmap, const size_t bit) {
-    bitmap->data[bit >> 3] &= invert_mask[bit & 0x07];
+    bitmap_reset_inline(bitmap, bit);
 }
 
 bool bitmap_test(const bitmap_t *const bitmap, const size_t bit) {
-    return bitmap->data[bit >> 3] & mask[bit & 0x07];
+    return bitmap_test_inline(bitmap, bit);
 }
 
 void bitmap_flip(bitmap_t *const bitmap, const size_t bit) {
     bitmap->data[bit >> 3] ^= mask[bit & 0x07];
+    if (FLAG_CHECK(bitmap, BITMAP_COUNTED)) {
+        bitmap->total += (bitmap->data[bit >> 3] & mask[bit & 0x07]) ? 1 : -1;
+    }
 }
 
 void bitmap_invert(bitmap_t *const bitmap) {
     for (size_t byte = 0; byte < bitmap->byte_count; ++byte) {
         bitmap->data[byte] = ~bitmap->data[byte];
     }
+    if (FLAG_CHECK(bitmap, BITMAP_COUNTED)) {
+        bitmap->total = bitmap->bit_count - bitmap->total;
+    }
 }
 
-size_t bitmap_ffs(const bitmap_t *const bitmap) {
-    if (bitmap) {
-        size_t result = 0;
-        for (; result < bitmap->bit_count && !bitmap_test(bitmap, result); ++result) {
+// the 64 bits starting at bit word * 64, bit n of the bitmap at bit n of the word; past the end reads as 0
+static inline uint64_t load_word(const bitmap_t *const bitmap, const size_t word) {
+    uint64_t value = 0;
+    const size_t byte = word << 3;
+    const size_t left = bitmap->byte_count - byte;
+    memcpy(&value, bitmap->data + byte, left < sizeof(value) ? left : sizeof(value));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+// first bit at or after from that differs from the bits in skip (0 looks for ones, ~0 for zeros)
+// words with nothing to find cost one compare, the hit in a word is a count of trailing zeros
+static size_t next_bit(const bitmap_t *const bitmap, const size_t from, const uint64_t skip) {
+    if (!bitmap || from >= bitmap->bit_count) {
+        return SIZE_MAX;
+    }
+    size_t word = from >> 6;
+    uint64_t bits = (load_word(bitmap, word) ^ skip) & (UINT64_MAX << (from & 0x3F));
+    while (bits == 0) {
+        if (++word << 6 >= bitmap->bit_count) {
+            return SIZE_MAX;
         }
-        return (result == bitmap->bit_count ? SIZE_MAX : result);
+        bits = load_word(bitmap, word) ^ skip;
     }
-    return SIZE_MAX;
+    // bits past bit_count are ignored, whatever the last byte holds there
+    size_t bit = (word << 6) + __builtin_ctzll(bits);
+    return bit < bitmap->bit_count ? bit : SIZE_MAX;
+}
+
+size_t bitmap_next_set(const bitmap_t *const bitmap, const size_t from) {
+    return next_bit(bitmap, from, 0);
+}
+
+size_t bitmap_next_zero(const bitmap_t *const bitmap, const size_t from) {
+    return next_bit(bitmap, from, UINT64_MAX);
+}
+
+size_t bitmap_ffs(const bitmap_t *const bitmap) {
+    return bitmap_next_set(bitmap, 0);
 }
 
 size_t bitmap_ffz(const bitmap_t *const bitmap) {
-    if (bitmap) {
-        size_t result = 0;
-        for (; result < bitmap->bit_count && bitmap_test(bitmap, result); ++result) {
-        }
-        return (result == bitmap->bit_count ? SIZE_MAX : result);
-    }
-    return SIZE_MAX;
+    return bitmap_next_zero(bitmap, 0);
 }
 
 size_t bitmap_total_set(const bitmap_t *const bitmap) {
     size_t total = 0;
     if (bitmap) {
+        if (FLAG_CHECK(bitmap, BITMAP_COUNTED)) {
+            return bitmap->total;
+        }
         // If we have leftover, stop a byte early because we have to handle it differently.
         size_t stop = bitmap->leftover_bits ? bitmap->byte_count - 1 : bitmap->byte_count;
-        for (size_t idx = 0; idx < stop; ++idx) {
-            total += bit_totals[bitmap->data[idx]];
-        }
+        total = count_bits(bitmap->data, stop);
         if (bitmap->leftover_bits) {
             // haha, this is readable
             // get the byte at the end of the bitmap, mask it so we're only looking at the bits in use
@@ -120,18 +208,115 @@ size_t bitmap_total_set(const bitmap_t *const bitmap) {
     return total;
 }
 
+// bits [from, to) of a byte, 0 <= from < to <= 8
+static inline uint8_t byte_mask(const size_t from, const size_t to) {
+    return (uint8_t)((0xFFu << from) & (0xFFu >> (8 - to)));
+}
+
+void bitmap_track_total(bitmap_t *const bitmap, const size_t total) {
+    if (bitmap) {
+        bitmap->flags &= ~BITMAP_COUNTED;
+        bitmap->total = total == SIZE_MAX ? bitmap_total_set(bitmap) : total;
+        bitmap->flags |= BITMAP_COUNTED;
+    }
+}
+
+// apply value to bits [start, start + count): partial bytes at the ends are masked, the bytes between memset
+static void fill_range(bitmap_t *const bitmap, const size_t start, const size_t count, const bool value) {
+    if (count == 0) {
+        return;
+    }
+    if (FLAG_CHECK(bitmap, BITMAP_COUNTED)) {
+        size_t before = bitmap_count_range(bitmap, start, count);
+        bitmap->total += value ? count - before : -before;
+    }
+    size_t first = start >> 3, last = (start + count - 1) >> 3;
+    if (first == last) {
+        uint8_t m = byte_mask(start & 0x07, ((start + count - 1) & 0x07) + 1);
+        bitmap->data[first] = value ? bitmap->data[first] | m : bitmap->data[first] & ~m;
+        return;
+    }
+    uint8_t head = byte_mask(start & 0x07, 8), tail = byte_mask(0, ((start + count - 1) & 0x07) + 1);
+    bitmap->data[first] = value ? bitmap->data[first] | head : bitmap->data[first] & ~head;
+    bitmap->data[last] = value ? bitmap->data[last] | tail : bitmap->data[last] & ~tail;
+    memset(bitmap->data + first + 1, value ? 0xFF : 0x00, last - first - 1);
+}
+
+void bitmap_set_range(bitmap_t *const bitmap, const size_t start, const size_t count) {
+    fill_range(bitmap, start, count, true);
+}
+
+void bitmap_reset_range(bitmap_t *const bitmap, const size_t start, const size_t count) {
+    fill_range(bitmap, start, count, false);
+}
+
+size_t bitmap_count_range(const bitmap_t *const bitmap, const size_t start, const size_t count) {
+    if (!bitmap || count == 0 || start >= bitmap->bit_count) {
+        return 0;
+    }
+    size_t end = count > bitmap->bit_count - start ? bitmap->bit_count : start + count;
+    size_t first = start >> 3, last = (end - 1) >> 3;
+    if (first == last) {
+        return bit_totals[bitmap->data[first] & byte_mask(start & 0x07, ((end - 1) & 0x07) + 1)];
+    }
+    return bit_totals[bitmap->data[first] & byte_mask(start & 0x07, 8)]
+         + bit_totals[bitmap->data[last] & byte_mask(0, ((end - 1) & 0x07) + 1)]
+         + count_bits(bitmap->data + first + 1, last - first - 1);
+}
+
+size_t bitmap_find_zero_run(const bitmap_t *const bitmap, const size_t start, const size_t len) {
+    if (!bitmap || len == 0 || start >= bitmap->bit_count || len > bitmap->bit_count - start) {
+        return SIZE_MAX;
+    }
+    size_t run = 0;
+    size_t bit = start;
+    while (bit < bitmap->bit_count) {
+        // aligned stretches that are all ones or all zeros are taken a word, then a byte, at a time
+        if ((bit & 0x3F) == 0 && bit + 64 <= bitmap->bit_count) {
+            uint64_t word;
+            memcpy(&word, bitmap->data + (bit >> 3), sizeof(word));
+            if (word == UINT64_MAX || word == 0) {
+                run = word ? 0 : run + 64;
+                bit += 64;
+                if (run >= len) {
+                    return bit - run;
+                }
+                continue;
+            }
+        }
+        if ((bit & 0x07) == 0 && bit + 8 <= bitmap->bit_count) {
+            uint8_t byte = bitmap->data[bit >> 3];
+            if (byte == 0xFF || byte == 0x00) {
+                run = byte ? 0 : run + 8;
+                bit += 8;
+                if (run >= len) {
+                    return bit - run;
+                }
+                continue;
+            }
+        }
+        run = bitmap_test(bitmap, bit) ? 0 : run + 1;
+        ++bit;
+        if (run == len) {
+            return bit - run;
+        }
+    }
+    return SIZE_MAX;
+}
+
 void bitmap_for_each(const bitmap_t *const bitmap, void (*func)(size_t, void *), void *arg) {
     if (bitmap && func) {
-        for (size_t idx = 0; idx < bitmap->bit_count; ++idx) {
-            if (bitmap_test(bitmap, idx)) {
-                func(idx, arg);
-            }
+        for (size_t idx = bitmap_next_set(bitmap, 0); idx != SIZE_MAX; idx = bitmap_next_set(bitmap, idx + 1)) {
+            func(idx, arg);
         }
     }
 }
 
 void bitmap_format(bitmap_t *const bitmap, const uint8_t pattern) {
     memset(bitmap->data, pattern, bitmap->byte_count);
+    if (FLAG_CHECK(bitmap, BITMAP_COUNTED)) {
+        bitmap_track_total(bitmap, SIZE_MAX);
+    }
 }
 
 size_t bitmap_get_bits(const bitmap_t *const bitmap) {
@@ -143,7 +328,7 @@ size_t bitmap_get_bytes(const bitmap_t *const bitmap) {
 }
 
 bitmap_t *bitmap_create(const size_t n_bits) {
-    return bitmap_initialize(n_bits, NONE);
+    return bitmap_initialize(n_bits, BITMAP_NONE);
 }
 
 const uint8_t *bitmap_export(const bitmap_t *const bitmap) {
@@ -152,7 +337,7 @@ const uint8_t *bitmap_export(const bitmap_t *const bitmap) {
 
 bitmap_t *bitmap_import(const size_t n_bits, const void *const bitmap_data) {
     if (bitmap_data) {
-        bitmap_t *bitmap = bitmap_initialize(n_bits, NONE);
+        bitmap_t *bitmap = bitmap_initialize(n_bits, BITMAP_NONE);
         if (bitmap) {
             memcpy(bitmap->data, bitmap_data, bitmap->byte_count);
             return bitmap;
@@ -163,7 +348,7 @@ bitmap_t *bitmap_import(const size_t n_bits, const void *const bitmap_data) {
 
 bitmap_t *bitmap_overlay(const size_t n_bits, void *const bitmap_data) {
     if (bitmap_data) {
-        bitmap_t *bitmap = bitmap_initialize(n_bits, OVERLAY);
+        bitmap_t *bitmap = bitmap_initialize(n_bits, BITMAP_OVERLAY);
         if (bitmap) {
             bitmap->data = (uint8_t *) bitmap_data;
             return bitmap;
@@ -172,9 +357,22 @@ bitmap_t *bitmap_overlay(const size_t n_bits, void *const bitmap_data) {
     return NULL;
 }
 
+// fails to compile (negative array size) if bitmap_view_t can't hold a bitmap
+typedef char bitmap_view_fits[sizeof(bitmap_t) <= sizeof(bitmap_view_t) ? 1 : -1];
+
+bitmap_t *bitmap_view(bitmap_view_t *const view, const size_t n_bits, void *const bitmap_data) {
+    if (view && n_bits && bitmap_data) {
+        bitmap_t *bitmap = (bitmap_t *) view;
+        init_fields(bitmap, n_bits, BITMAP_OVERLAY);
+        bitmap->data = (uint8_t *) bitmap_data;
+        return bitmap;
+    }
+    return NULL;
+}
+
 void bitmap_destroy(bitmap_t *bitmap) {
     if (bitmap) {
-        if (!FLAG_CHECK(bitmap, OVERLAY)) {
+        if (!FLAG_CHECK(bitmap, BITMAP_OVERLAY)) {
             // don't free memory that isn't ours!
             free(bitmap->data);
         }
@@ -192,11 +390,7 @@ bitmap_t *bitmap_initialize(size_t n_bits, BITMAP_FLAGS flags) {
     if (n_bits) {  // must be non-zero
         bitmap_t *bitmap = (bitmap_t *) malloc(sizeof(bitmap_t));
         if (bitmap) {
-            bitmap->flags         = flags;
-            bitmap->bit_count     = n_bits;
-            bitmap->byte_count    = n_bits >> 3;
-            bitmap->leftover_bits = n_bits & 0x07;
-            bitmap->byte_count += (bitmap->leftover_bits ? 1 : 0);
+            init_fields(bitmap, n_bits, flags);
 
             // FLAG HANDLING HERE
 
@@ -204,7 +398,7 @@ bitmap_t *bitmap_initialize(size_t n_bits, BITMAP_FLAGS flags) {
             // Maybe something like if (flags) and then contain a giant if/else-if for each flag
             // Then a return at the end
 
-            if (FLAG_CHECK(bitmap, OVERLAY)) {
+            if (FLAG_CHECK(bitmap, BITMAP_OVERLAY)) {
                 // don't mess with data, caller will set it
                 bitmap->data = NULL;
                 return bitmap;
@@ -1,3 +1,5 @@
+// MAP_POPULATE, MADV_HUGEPAGE and fallocate are Linux extensions
+#define _GNU_SOURCE
 #include <stdint.h>
 #include <errno.h>
 #include <string.h>
@@ -7,7 +9,10 @@
 #include <stdbool.h>
 #include <sys/mman.h>
 #include <sys/types.h>
+#include <time.h>
+#include <sys/ioctl.h>
 #include "block_store.h"
+#include "block_store_inline.h"
 #include "bitmap.h"
 
 #define BLOCK_STORE_NUM_BLOCKS 65536   // 2^16 blocks.
@@ -22,11 +27,87 @@
 #define number_fd 256
 #define fd_size 6	// any number as you see fit
 
-struct block_store {
-    int fd;
-    uint8_t *data_blocks;
-    bitmap_t *fbm;
-};
+// block_store_inline.h repeats these for the inline accessors, a mismatch fails the build (negative array size)
+typedef char inline_block_bytes_match[BLOCK_STORE_INLINE_BLOCK_BYTES == BLOCK_SIZE_BYTES ? 1 : -1];
+typedef char inline_data_blocks_match[BLOCK_STORE_INLINE_DATA_BLOCKS == BLOCK_STORE_AVAIL_BLOCKS ? 1 : -1];
+typedef char inline_inode_bytes_match[BLOCK_STORE_INLINE_INODE_BYTES == inode_size ? 1 : -1];
+typedef char inline_fd_bytes_match[BLOCK_STORE_INLINE_FD_BYTES == fd_size ? 1 : -1];
+typedef char inline_entries_match[BLOCK_STORE_INLINE_ENTRIES == number_fd && BLOCK_STORE_INLINE_ENTRIES == number_inodes ? 1 : -1];
+
+#if defined(__linux__) && !defined(FICLONE)
+#define FICLONE _IOW(0x94, 9, int)	// from linux/fs.h, which clashes with BLOCK_SIZE_BITS
+#endif
+
+#define SNAPSHOT_MAGIC 0x53393146	// "F19S"
+#define SNAPSHOT_VERSION 1
+
+// start of a snapshot stream, followed by a bitmap of the blocks it holds and those blocks in order
+typedef struct snapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t blockSize;
+    uint32_t blockCount;
+    uint32_t count;             // blocks in the stream
+    uint32_t reserved;
+    uint64_t generation;        // what a later delta names as its base, 0 if it can't be one
+    uint64_t base;              // generation a delta applies on top of, 0 for a full snapshot
+} snapshotHeader_t;
+
+#define RESTORE_MAGIC 0x52393146	// "F19R"
+
+// left past the device bytes of a restored file, names the snapshot it holds for a later delta
+typedef struct restoreMark {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t generation;
+} restoreMark_t;
+
+// remember that count blocks from block_id changed, for fs syncs and delta snapshots
+static inline void mark_changed(block_store_t *const bs, const size_t block_id, const size_t count) {
+    for (size_t i = block_id; i < block_id + count && i < BLOCK_STORE_NUM_BLOCKS; ++i) {
+        if (bs->dirty) {
+            bitmap_set(bs->dirty, i);
+        }
+        if (bs->changed) {
+            bs->changed[i] = bs->generation;
+        }
+    }
+}
+
+// a number unlikely to repeat for another open of any device, never 0
+static uint32_t new_session(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint32_t session = (uint32_t) now.tv_nsec ^ (uint32_t) now.tv_sec * 2654435761u ^ (uint32_t) getpid() << 16;
+    return session ? session : 1;
+}
+
+// start dirty and generation tracking for a device with its own mapping
+static void track_changes(block_store_t *const bs) {
+    bs->dirty = bitmap_create(BLOCK_STORE_NUM_BLOCKS);
+    bs->changed = (uint32_t *) calloc(BLOCK_STORE_NUM_BLOCKS, sizeof(uint32_t));
+    bs->generation = 1;
+    bs->session = new_session();
+}
+
+// report the byte of the bitmap holding bit before it is flipped
+static inline void before_bit_change(block_store_t *const bs, const size_t bit) {
+    const uint8_t *addr = bitmap_export(bs->fbm) + bit / 8;
+    if (bs->hook) {
+        bs->hook(bs->hook_arg, addr);
+    }
+    if (bs->dirty) {
+        // the free block bitmap lives inside the device
+        mark_changed(bs, (addr - bs->data_blocks) / BLOCK_SIZE_BYTES, 1);
+    }
+}
+
+// report each bitmap byte holding one of count bits from bit before they change
+static inline void before_range_change(block_store_t *const bs, const size_t bit, const size_t count) {
+    for (size_t byte = bit / 8; byte <= (bit + count - 1) / 8; ++byte) {
+        before_bit_change(bs, byte * 8);
+    }
+}
 
 int create_file(const char *const fname) {
     if (fname) {
@@ -56,23 +137,54 @@ int check_file(const char *const fname) {
     return -1;
 }
 
-block_store_t *block_store_init(const bool init, const char *const fname) {
+block_store_t *block_store_init(const bool init, const char *const fname, const unsigned flags) {
     if (fname) {
         block_store_t *bs = (block_store_t *) malloc(sizeof(block_store_t));
         if (bs) {
-            bs->fd = init ? create_file(fname) : check_file(fname);
+            // an in-place format reuses a volume file of the right size as it is
+            bs->fd = init && !(flags & BLOCK_STORE_IN_PLACE) ? create_file(fname) : check_file(fname);
+            if (bs->fd == -1 && init) {
+                bs->fd = create_file(fname);
+            }
             if (bs->fd != -1) {
-                bs->data_blocks = (uint8_t *) mmap(NULL, BLOCK_STORE_NUM_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, bs->fd, 0);
+                int map_flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+                if (flags & BLOCK_STORE_POPULATE) {
+                    map_flags |= MAP_POPULATE;
+                }
+#endif
+                bs->data_blocks = (uint8_t *) mmap(NULL, BLOCK_STORE_NUM_BYTES, PROT_READ | PROT_WRITE, map_flags, bs->fd, 0);
                 if (bs->data_blocks != (uint8_t *) MAP_FAILED) {
+                         track_changes(bs);
+#ifdef MADV_HUGEPAGE
+                         // only a hint, shared file mappings get huge pages only where the kernel supports it
+                         if (flags & BLOCK_STORE_HUGEPAGE) {
+                                madvise(bs->data_blocks, BLOCK_STORE_NUM_BYTES, MADV_HUGEPAGE);
+                         }
+#endif
                          if (init) {
-                                memset(bs->data_blocks, 0X00, BLOCK_STORE_NUM_BYTES);
+                                // create_file leaves a sparse file that already reads as zeros,
+                                //  only an in-place format has an old bitmap to clear
+                                if (flags & BLOCK_STORE_IN_PLACE) {
+                                        block_store_discard(bs, BLOCK_STORE_AVAIL_BLOCKS, BLOCK_STORE_NUM_BLOCKS - BLOCK_STORE_AVAIL_BLOCKS);
+                                }
 								                bs->data_blocks[BLOCK_STORE_NUM_BYTES - 1] = 0xff;
+								                block_store_mark_dirty(bs, BLOCK_STORE_NUM_BLOCKS - 1, 1);
 								                // in case you are trying to write to the bitmap, that will be a disaster
                           }
                           bs->fbm = bitmap_overlay(BLOCK_STORE_AVAIL_BLOCKS, bs->data_blocks + BLOCK_STORE_AVAIL_BLOCKS*BLOCK_SIZE_BYTES);
-                          if (bs->fbm) {
+                          // a fresh bitmap is empty, an existing one is only counted when asked to
+                          if (init && bs->fbm) {
+                                bitmap_track_total(bs->fbm, 0);
+                          }
+                          bs->hook = NULL;
+                          bs->hook_arg = NULL;
+                          if (bs->fbm && bs->dirty && bs->changed) {
                                 return bs;
                            }
+                           bitmap_destroy(bs->fbm);
+                           bitmap_destroy(bs->dirty);
+                           free(bs->changed);
                            munmap(bs->data_blocks, BLOCK_STORE_NUM_BYTES);
                 }
                 close(bs->fd);
@@ -88,12 +200,22 @@ block_store_t *block_store_init(const bool init, const char *const fname) {
 ///-- Return pointer to the new block storage device, NULL on error
 ///
 block_store_t *block_store_create(const char *const fname) {
-    return block_store_init(true, fname);
+    return block_store_init(true, fname, 0);
+}
+
+//
+block_store_t *block_store_create_ex(const char *const fname, const unsigned flags) {
+    return block_store_init(true, fname, flags);
 }
 
 //
 block_store_t *block_store_open(const char *const fname) {
-    return block_store_init(false, fname);
+    return block_store_init(false, fname, 0);
+}
+
+//
+block_store_t *block_store_open_ex(const char *const fname, const unsigned flags) {
+    return block_store_init(false, fname, flags);
 }
 
 ///
@@ -103,8 +225,12 @@ block_store_t *block_store_open(const char *const fname) {
 void block_store_destroy(block_store_t *const bs) {
       if (bs) {
         bitmap_destroy(bs->fbm);
+        bitmap_destroy(bs->dirty);
+        free(bs->changed);
         munmap(bs->data_blocks, BLOCK_STORE_NUM_BYTES);
-        close(bs->fd);
+        if (bs->fd != -1) {
+            close(bs->fd);
+        }
         free(bs);
     }
 }
@@ -124,11 +250,46 @@ size_t block_store_allocate(block_store_t *const bs) {
     if (id == SIZE_MAX) {
         return SIZE_MAX; // return SIZE_MAX since the last block is not available for storing data
     }
+    before_bit_change(bs, id);
     bitmap_set(bs->fbm, id); // mark it as in use
   //  bitmap_destroy(bs->fbm); // destruct and destroy bitmap object
     return id;
 }
 
+///
+///-- Searches for a run of contiguous free blocks and marks it as in use
+///-- First fit; if no gap is long enough the longest one is taken instead
+/// \param bs BS device
+/// \param count Number of blocks wanted
+/// \param allocated Receives the length of the run taken (<= count)
+/// \return First block id of the run, SIZE_MAX on error/no free block
+///
+size_t block_store_allocate_run(block_store_t *const bs, const size_t count, size_t *const allocated) {
+    if (bs == NULL || count == 0 || allocated == NULL) {
+        return SIZE_MAX;
+    }
+    // a gap that fits the whole request is usually there, only a fragmented map needs the longest one
+    size_t best_start = bitmap_find_zero_run(bs->fbm, 0, count);
+    size_t best_len = best_start == SIZE_MAX ? 0 : count;
+    size_t start = best_len < count ? bitmap_next_zero(bs->fbm, 0) : SIZE_MAX;
+    while (start != SIZE_MAX) {
+        size_t end = bitmap_next_set(bs->fbm, start);
+        end = end == SIZE_MAX ? BLOCK_STORE_AVAIL_BLOCKS : end;
+        if (end - start > best_len) {
+            best_start = start;
+            best_len = end - start < count ? end - start : count;
+        }
+        start = end < BLOCK_STORE_AVAIL_BLOCKS ? bitmap_next_zero(bs->fbm, end) : SIZE_MAX;
+    }
+    if (best_start == SIZE_MAX) {
+        return SIZE_MAX;
+    }
+    before_range_change(bs, best_start, best_len);
+    bitmap_set_range(bs->fbm, best_start, best_len);
+    *allocated = best_len;
+    return best_start;
+}
+
 ///
 ///-- Attempts to allocate the requested block id
 /// \param bs the block store object
@@ -146,6 +307,7 @@ bool block_store_request(block_store_t *const bs, const size_t block_id) {
         return false;
     }
     else { // if this block is not in use
+        before_bit_change(bs, block_id);
         bitmap_set(bs->fbm, block_id); // mark the block as in use
         //bitmap_destroy(bs->fbm); // destruct and destroy bitmap object
         return true;
@@ -162,6 +324,7 @@ void block_store_release(block_store_t *const bs, const size_t block_id) {
         bool success = 0;
         success = bitmap_test(bs->fbm, block_id); // check if the block is in use
         if (success) {
+            before_bit_change(bs, block_id);
             bitmap_reset(bs->fbm, block_id); // clear requested bit in bitmap
     //        bitmap_destroy(bs->fbm); // destruct and destroy bitmap object
         }
@@ -169,6 +332,18 @@ void block_store_release(block_store_t *const bs, const size_t block_id) {
     //// Some error message here ////
 }
 
+size_t block_store_release_run(block_store_t *const bs, const size_t block_id, const size_t count) {
+    if (bs == NULL || block_id >= BLOCK_STORE_AVAIL_BLOCKS || count > BLOCK_STORE_AVAIL_BLOCKS - block_id) {
+        return 0;
+    }
+    size_t released = bitmap_count_range(bs->fbm, block_id, count);
+    if (released > 0) {
+        before_range_change(bs, block_id, count);
+        bitmap_reset_range(bs->fbm, block_id, count);
+    }
+    return released;
+}
+
 ///
 ///-- Counts the number of blocks marked as in use
 /// \param bs BS device
@@ -176,10 +351,8 @@ void block_store_release(block_store_t *const bs, const size_t block_id) {
 ///
 size_t block_store_get_used_blocks(const block_store_t *const bs) {
     if (bs) {
-        size_t numSet = 0;
-        numSet = bitmap_total_set(bs->fbm); // count all bits set
-      //  bitmap_destroy(bs->fbm); // destruct and destroy bitmap object
-        return numSet;
+        // O(1) once the bitmap tracks its total, a count otherwise
+        return bitmap_total_set(bs->fbm);
     }
     return SIZE_MAX;
 }
@@ -193,9 +366,9 @@ size_t block_store_get_free_blocks(const block_store_t *const bs) {
     if (bs) {
         size_t numSet = 0;
         size_t numZero = 0;
-        numSet = bitmap_total_set(bs->fbm); // count all bits set
+        numSet = block_store_get_used_blocks(bs);
         //bitmap_destroy(bs->fbm); // destruct and destroy bitmap object
-        numZero = BLOCK_STORE_AVAIL_BLOCKS - numSet; // count zero bits
+        numZero = bitmap_get_bits(bs->fbm) - numSet; // count zero bits
         return numZero;
     }
     return SIZE_MAX;
@@ -218,11 +391,7 @@ size_t block_store_get_total_blocks() {
 /// \return Number of bytes read, 0 on error
 ///
 size_t block_store_read(const block_store_t *const bs, const size_t block_id, void *buffer) {
-    if (bs && buffer && block_id <= BLOCK_STORE_AVAIL_BLOCKS) {
-        memcpy(buffer, bs->data_blocks+block_id*BLOCK_SIZE_BYTES, BLOCK_SIZE_BYTES);
-        return BLOCK_SIZE_BYTES;
-    }
-    return 0;
+    return block_store_read_inline(bs, block_id, buffer);
 }
 
 
@@ -236,53 +405,304 @@ size_t block_store_read(const block_store_t *const bs, const size_t block_id, vo
 size_t block_store_write(block_store_t *const bs, const size_t block_id, const void *buffer) {
     if (bs && buffer && block_id <= BLOCK_STORE_AVAIL_BLOCKS) {
         memcpy(bs->data_blocks+block_id*BLOCK_SIZE_BYTES, buffer, BLOCK_SIZE_BYTES);
+        mark_changed(bs, block_id, 1);
         return BLOCK_SIZE_BYTES;
     }
     return 0;
 }
 
 
+// write all of size bytes, retrying short writes
+static bool write_all(const int fd, const void *data, size_t size) {
+    const uint8_t *bytes = (const uint8_t *) data;
+    while (size > 0) {
+        ssize_t n = write(fd, bytes, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+// find the next run of held blocks at or after *id, false when there is none
+static bool next_run(const bitmap_t *const held, size_t *const id, size_t *const count) {
+    const size_t start = bitmap_next_set(held, *id);
+    if (start == SIZE_MAX) {
+        *count = 0;
+        return false;
+    }
+    const size_t end = bitmap_next_zero(held, start);
+    *id = start;
+    *count = (end == SIZE_MAX ? bitmap_get_bits(held) : end) - start;
+    return true;
+}
+
+// stream the blocks in use, or with a base generation only those written since, to fd
+static size_t write_snapshot(const block_store_t *const bs, const int fd, const uint64_t generation, const uint64_t base) {
+    bitmap_t *held = bitmap_create(BLOCK_STORE_NUM_BLOCKS);
+    if (held == NULL) {
+        return 0;
+    }
+    snapshotHeader_t header = {SNAPSHOT_MAGIC, SNAPSHOT_VERSION, BLOCK_SIZE_BYTES, BLOCK_STORE_NUM_BLOCKS, 0, 0, generation, base};
+    const uint32_t since = (uint32_t) base;
+    // the free block bitmap covers only the data blocks, its own blocks always go along
+    // a block freed since the base keeps whatever it held, the bitmap says it is free
+    for (size_t id = bitmap_next_set(bs->fbm, 0); id != SIZE_MAX; id = bitmap_next_set(bs->fbm, id + 1)) {
+        if (base == 0 || bs->changed[id] > since) {
+            bitmap_set(held, id);
+        }
+    }
+    for (size_t id = BLOCK_STORE_AVAIL_BLOCKS; id < BLOCK_STORE_NUM_BLOCKS; ++id) {
+        if (base == 0 || bs->changed[id] > since) {
+            bitmap_set(held, id);
+        }
+    }
+    header.count = bitmap_total_set(held);
+
+    size_t written = 0;
+    bool ok = write_all(fd, &header, sizeof(header)) && write_all(fd, bitmap_export(held), BLOCK_STORE_NUM_BLOCKS / 8);
+    if (ok) {
+        written = sizeof(header) + BLOCK_STORE_NUM_BLOCKS / 8;
+    }
+    size_t id = 0, count = 0;
+    // one write per run of neighbouring blocks, straight from the mapping
+    while (ok && next_run(held, &id, &count)) {
+        ok = write_all(fd, bs->data_blocks + id * BLOCK_SIZE_BYTES, count * BLOCK_SIZE_BYTES);
+        written += count * BLOCK_SIZE_BYTES;
+        id += count;
+    }
+    bitmap_destroy(held);
+    return ok ? written : 0;
+}
+
+size_t block_store_snapshot(block_store_t *const bs, const int fd, const uint64_t base, uint64_t *const generation) {
+    if (bs == NULL || bs->changed == NULL || fd < 0) {
+        return 0;
+    }
+    // a delta needs a base taken from this open of the device, older writes were never stamped
+    if (base != 0 && ((uint32_t) (base >> 32) != bs->session || (uint32_t) base == 0 || (uint32_t) base >= bs->generation)) {
+        return 0;
+    }
+    const uint64_t current = (uint64_t) bs->session << 32 | bs->generation;
+    size_t written = write_snapshot(bs, fd, current, base);
+    if (written == 0) {
+        return 0;
+    }
+    // writes from here on belong to the next snapshot
+    bs->generation++;
+    if (generation) {
+        *generation = current;
+    }
+    return written;
+}
+
+// read the header and block bitmap of a snapshot stream, false if fd holds something else
+static bool read_snapshot_header(const int fd, snapshotHeader_t *const header, bitmap_t **const held) {
+    uint8_t bits[BLOCK_STORE_NUM_BLOCKS / 8];
+    if (pread(fd, header, sizeof(*header), 0) != (ssize_t) sizeof(*header) || header->magic != SNAPSHOT_MAGIC
+        || header->version != SNAPSHOT_VERSION || header->blockSize != BLOCK_SIZE_BYTES
+        || header->blockCount != BLOCK_STORE_NUM_BLOCKS
+        || pread(fd, bits, sizeof(bits), sizeof(*header)) != (ssize_t) sizeof(bits)) {
+        return false;
+    }
+    *held = bitmap_import(BLOCK_STORE_NUM_BLOCKS, bits);
+    return *held != NULL;
+}
+
+// copy size bytes between files, in the kernel where it can
+static bool copy_range(const int in, off_t in_offset, const int out, off_t out_offset, size_t size) {
+#ifdef __linux__
+    while (size > 0) {
+        ssize_t n = copy_file_range(in, &in_offset, out, &out_offset, size, 0);
+        if (n <= 0) {
+            break;
+        }
+        size -= n;
+    }
+#endif
+    uint8_t buffer[64 * BLOCK_SIZE_BYTES];
+    while (size > 0) {
+        size_t chunk = size < sizeof(buffer) ? size : sizeof(buffer);
+        ssize_t n = pread(in, buffer, chunk, in_offset);
+        if (n <= 0 || pwrite(out, buffer, n, out_offset) != n) {
+            return false;
+        }
+        in_offset += n;
+        out_offset += n;
+        size -= n;
+    }
+    return true;
+}
+
+// put the blocks of a snapshot stream in place, its header already read
+static bool apply_snapshot(const int in, const snapshotHeader_t *const header, const bitmap_t *const held, const int out) {
+    off_t position = sizeof(*header) + BLOCK_STORE_NUM_BLOCKS / 8;
+    size_t id = 0, count = 0, total = 0;
+    while (next_run(held, &id, &count)) {
+        if (!copy_range(in, position, out, (off_t) id * BLOCK_SIZE_BYTES, count * BLOCK_SIZE_BYTES)) {
+            return false;
+        }
+        position += count * BLOCK_SIZE_BYTES;
+        total += count;
+        id += count;
+    }
+    return total == header->count;
+}
+
+// a raw device image, a restored one carries its mark past the device bytes
+static inline bool image_size(const off_t size) {
+    return size == BLOCK_STORE_NUM_BYTES || size == BLOCK_STORE_NUM_BYTES + (off_t) sizeof(restoreMark_t);
+}
+
+// copy a raw device image, sharing its extents if the file system can or else its data ranges only
+static bool clone_image(const int in, const int out) {
+#ifdef FICLONE
+    if (ioctl(out, FICLONE, in) == 0) {
+        return true;
+    }
+#endif
+    if (ftruncate(out, BLOCK_STORE_NUM_BYTES) == -1) {
+        return false;
+    }
+    off_t data = 0;
+#ifdef SEEK_DATA
+    // holes in the image stay holes in the copy
+    while ((data = lseek(in, data, SEEK_DATA)) != -1 && data < BLOCK_STORE_NUM_BYTES) {
+        off_t hole = lseek(in, data, SEEK_HOLE);
+        if (hole == -1 || hole > BLOCK_STORE_NUM_BYTES) {
+            hole = BLOCK_STORE_NUM_BYTES;
+        }
+        if (!copy_range(in, data, out, data, hole - data)) {
+            return false;
+        }
+        data = hole;
+    }
+    if (data != -1 || errno == ENXIO) {
+        return true;
+    }
+    data = 0;
+#endif
+    return copy_range(in, data, out, data, BLOCK_STORE_NUM_BYTES);
+}
+
+bool block_store_restore(const char *const source, const char *const target) {
+    if (source == NULL || target == NULL) {
+        return false;
+    }
+    int in = open(source, O_RDONLY);
+    if (in < 0) {
+        return false;
+    }
+    bool restored = false;
+    snapshotHeader_t header;
+    bitmap_t *held = NULL;
+    struct stat info;
+    if (read_snapshot_header(in, &header, &held)) {
+        // a full snapshot starts from an empty sparse file, a delta goes on top of its base
+        int out = header.base == 0 ? create_file(target) : check_file(target);
+        restoreMark_t mark;
+        if (out != -1 && header.base != 0
+            && (pread(out, &mark, sizeof(mark), BLOCK_STORE_NUM_BYTES) != (ssize_t) sizeof(mark)
+                || mark.magic != RESTORE_MAGIC || mark.generation != header.base)) {
+            // target isn't the snapshot this delta was taken against, leave it alone
+            close(out);
+            out = -1;
+        }
+        if (out != -1) {
+            restored = apply_snapshot(in, &header, held, out);
+            mark = (restoreMark_t) {RESTORE_MAGIC, 0, header.generation};
+            restored = restored && pwrite(out, &mark, sizeof(mark), BLOCK_STORE_NUM_BYTES) == (ssize_t) sizeof(mark);
+            restored = close(out) == 0 && restored;
+        }
+        bitmap_destroy(held);
+    } else if (fstat(in, &info) == 0 && image_size(info.st_size)) {
+        int out = open(target, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (out != -1) {
+            restored = clone_image(in, out);
+            restored = close(out) == 0 && restored;
+        }
+    }
+    close(in);
+    return restored;
+}
+
 ///
-///-- Imports BS device from the given file - for grads/bonus
+///-- Imports BS device from the given file, a device image or a full snapshot
+///   The file is mapped copy-on-write, changes to the device never reach it
 /// \param filename The file to load
 /// \return Pointer to new BS device, NULL on error
 ///
 block_store_t *block_store_deserialize(const char *const filename) {
-    if (filename) {
-        int fd = open(filename, O_RDONLY); // open file (read only)
-        if (fd < 0) { // if opening file fails
-            return 0;
+    if (filename == NULL) {
+        return NULL;
+    }
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    block_store_t *bs = (block_store_t *) calloc(1, sizeof(block_store_t));
+    snapshotHeader_t header;
+    bitmap_t *held = NULL;
+    struct stat info;
+    uint8_t *data = (uint8_t *) MAP_FAILED;
+    if (bs && read_snapshot_header(fd, &header, &held)) {
+        // untouched pages of an anonymous mapping read as zeros without being written
+        if (header.base == 0) {
+            data = (uint8_t *) mmap(NULL, BLOCK_STORE_NUM_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
         }
-        block_store_t *bs = NULL;
-        bs = block_store_create(filename);
-        int df_read1, df_read2;
-        df_read1 = read(fd, bs->data_blocks, BLOCK_STORE_AVAIL_BLOCKS*BLOCK_SIZE_BYTES); // read bs->Data from the file
-        df_read2 = read(fd, bs->fbm, BLOCK_STORE_NUM_BLOCKS/8); // read bs->FBM from the file
-        if (df_read1 < 0 || df_read2 < 0) { // if the system call returns an error
-            return 0;
+        off_t position = sizeof(header) + BLOCK_STORE_NUM_BLOCKS / 8;
+        size_t id = 0, count = 0;
+        while (data != (uint8_t *) MAP_FAILED && next_run(held, &id, &count)) {
+            if (pread(fd, data + id * BLOCK_SIZE_BYTES, count * BLOCK_SIZE_BYTES, position) != (ssize_t) (count * BLOCK_SIZE_BYTES)) {
+                munmap(data, BLOCK_STORE_NUM_BYTES);
+                data = (uint8_t *) MAP_FAILED;
+            }
+            position += count * BLOCK_SIZE_BYTES;
+            id += count;
         }
+        bitmap_destroy(held);
+    } else if (bs && fstat(fd, &info) == 0 && image_size(info.st_size)) {
+        data = (uint8_t *) mmap(NULL, BLOCK_STORE_NUM_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == (uint8_t *) MAP_FAILED) {
+        free(bs);
+        return NULL;
+    }
+    bs->fd = -1;	// nothing to write back to
+    bs->data_blocks = data;
+    bs->fbm = bitmap_overlay(BLOCK_STORE_AVAIL_BLOCKS, data + BLOCK_STORE_AVAIL_BLOCKS * BLOCK_SIZE_BYTES);
+    track_changes(bs);
+    if (bs->fbm && bs->dirty && bs->changed) {
         return bs;
     }
-    return 0;
+    block_store_destroy(bs);
+    return NULL;
 }
 
 ///
-///-- Writes the entirety of the BS device to file, overwriting it if it exists - for grads/bonus
+///-- Writes a full snapshot of the BS device to file, overwriting it if it exists
+///   Only the blocks in use are written, see block_store_snapshot
 /// \param bs BS device
 /// \param filename The file to write to
 /// \return Number of bytes written, 0 on error
 ///
 size_t block_store_serialize(const block_store_t *const bs, const char *const filename) {
     if (bs && filename) {
-        int fd = open(filename, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR); // open file (write only)
+        int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR); // open file (write only)
         if (fd < 0) { // if opening file fails
             return 0;
         }
-        write(fd, bs->data_blocks, BLOCK_STORE_AVAIL_BLOCKS*BLOCK_SIZE_BYTES); // write bs->Data to file
-        write(fd, bs->fbm, BLOCK_STORE_NUM_BLOCKS/8); // write bs->FBM to file
-        close(fd); // close file
-        size_t wr_size = block_store_get_used_blocks(bs); // number of block in use
-        return (wr_size*BLOCK_SIZE_BYTES); // return number of bytes written
+        size_t written = write_snapshot(bs, fd, 0, 0);
+        if (close(fd) != 0) {
+            return 0;
+        }
+        return written;
     }
     return 0;
 }
@@ -296,6 +716,10 @@ block_store_t *block_store_inode_create(void *const BM_start_pos, void *const da
 	{
 		BS->fbm = bitmap_overlay(256, BM_start_pos);
 		BS->data_blocks = data_start_pos;		
+		BS->hook = NULL;
+		BS->hook_arg = NULL;
+		BS->dirty = NULL;	// lives in the device, its owner tracks it
+		BS->changed = NULL;
 		return BS;
 	}
 	return NULL;
@@ -310,6 +734,11 @@ block_store_t *block_store_fd_create()
 	{
 		BS->data_blocks = calloc(256, 6);	// create space for the blocks
 		BS->fbm = bitmap_create(256);
+		bitmap_track_total(BS->fbm, 0);
+		BS->hook = NULL;
+		BS->hook_arg = NULL;
+		BS->dirty = NULL;	// memory only, never synced
+		BS->changed = NULL;
 		return BS;
 	}
 	return NULL;
@@ -356,6 +785,7 @@ size_t block_store_sub_allocate(block_store_t *const bs) {
     if (id == SIZE_MAX) {
         return SIZE_MAX; // return SIZE_MAX since the last block is not available for storing data
     }
+    before_bit_change(bs, id);
     bitmap_set(bs->fbm, id); // mark it as in use
 //	printf("fd_id = 0 is used or not?: %d\n", bitmap_test(bs->fbm, id));
     return id;
@@ -377,6 +807,7 @@ void block_store_sub_release(block_store_t *const bs, const size_t block_id) {
         bool success = 0;
         success = bitmap_test(bs->fbm, block_id); // check if the block is in use
         if (success) {
+            before_bit_change(bs, block_id);
             bitmap_reset(bs->fbm, block_id); // clear requested bit in bitmap
     //        bitmap_destroy(bs->fbm); // destruct and destroy bitmap object
         }
@@ -384,37 +815,21 @@ void block_store_sub_release(block_store_t *const bs, const size_t block_id) {
     //// Some error message here ////
 }
 size_t block_store_inode_read(const block_store_t *const bs, const size_t block_id, void *buffer) {
-    if (bs && buffer && block_id <= 255) {
-        memcpy(buffer, bs->data_blocks+block_id * 64, 64);
-        return 64;
-    }
-    return 0;
+    return block_store_inode_read_inline(bs, block_id, buffer);
 }
 
 
 size_t block_store_fd_read(const block_store_t *const bs, const size_t block_id, void *buffer) {
-    if (bs && buffer && block_id <= 255) {
-        memcpy(buffer, bs->data_blocks+block_id * 6, 6);
-        return 6;
-    }
-    return 0;
+    return block_store_fd_read_inline(bs, block_id, buffer);
 }
 size_t block_store_inode_write(block_store_t *const bs, const size_t block_id, const void *buffer) {
-    if (bs && buffer && block_id < 256) {
-        memcpy(bs->data_blocks+block_id*64, buffer, 64);
-        return 64;
-    }
-    return 0;
+    return block_store_inode_write_inline(bs, block_id, buffer);
 }
 
 
 
 size_t block_store_fd_write(block_store_t *const bs, const size_t block_id, const void *buffer) {
-    if (bs && buffer && block_id < 256) {
-        memcpy(bs->data_blocks+block_id*6, buffer, 6);
-        return 6;
-    }
-    return 0;
+    return block_store_fd_write_inline(bs, block_id, buffer);
 }
 
 
@@ -426,6 +841,120 @@ uint8_t* block_store_get_data(block_store_t *const bs) {
     return NULL;
 }
 
+void block_store_set_hook(block_store_t *const bs, block_store_hook_t hook, void *arg) {
+    if (bs) {
+        bs->hook = hook;
+        bs->hook_arg = arg;
+    }
+}
+
+bool block_store_sync_range(block_store_t *const bs, const size_t block_id, const size_t count) {
+    if (bs == NULL || count == 0 || block_id >= BLOCK_STORE_NUM_BLOCKS || count > BLOCK_STORE_NUM_BLOCKS - block_id) {
+        return false;
+    }
+    // msync wants a page aligned start
+    const uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t) (bs->data_blocks + block_id * BLOCK_SIZE_BYTES);
+    uintptr_t end = start + count * BLOCK_SIZE_BYTES;
+    start &= ~(page - 1);
+    return msync((void *) start, end - start, MS_SYNC) == 0;
+}
+
+void block_store_mark_dirty(block_store_t *const bs, const size_t block_id, const size_t count) {
+    if (bs && block_id < BLOCK_STORE_NUM_BLOCKS) {
+        mark_changed(bs, block_id, count);
+    }
+}
+
+void block_store_mark_dirty_shared(block_store_t *const bs, const size_t block_id, const size_t count) {
+    for (size_t i = block_id; bs && i < block_id + count && i < BLOCK_STORE_NUM_BLOCKS; ++i) {
+        if (bs->dirty) {
+            bitmap_set_shared(bs->dirty, i);
+        }
+        if (bs->changed) {
+            __atomic_store_n(&bs->changed[i], bs->generation, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+bool block_store_is_dirty(const block_store_t *const bs, const size_t block_id) {
+    return bs && bs->dirty && block_id < BLOCK_STORE_NUM_BLOCKS && bitmap_test(bs->dirty, block_id);
+}
+
+bool block_store_sync_dirty(block_store_t *const bs, const bitmap_t *const only) {
+    if (bs == NULL || bs->dirty == NULL) {
+        return false;
+    }
+    bool synced = true;
+    size_t id = 0;
+    // clean stretches are skipped a word at a time
+    while ((id = bitmap_next_set(bs->dirty, id)) != SIZE_MAX) {
+        if (only && !bitmap_test(only, id)) {
+            ++id;
+            continue;
+        }
+        // one msync per run of neighbouring dirty blocks
+        size_t start = id;
+        while (id < BLOCK_STORE_NUM_BLOCKS && bitmap_test(bs->dirty, id) && (!only || bitmap_test(only, id))) {
+            bitmap_reset(bs->dirty, id);
+            ++id;
+        }
+        if (!block_store_sync_range(bs, start, id - start)) {
+            while (start < id) {
+                bitmap_set(bs->dirty, start++);
+            }
+            synced = false;
+        }
+    }
+    return synced;
+}
+
+void block_store_set_used_blocks(block_store_t *const bs, const size_t used) {
+    if (bs) {
+        bitmap_track_total(bs->fbm, used);
+    }
+}
+
+bool block_store_discard(block_store_t *const bs, const size_t block_id, const size_t count) {
+    if (bs == NULL || count == 0 || block_id >= BLOCK_STORE_NUM_BLOCKS || count > BLOCK_STORE_NUM_BLOCKS - block_id) {
+        return false;
+    }
+#ifdef FALLOC_FL_PUNCH_HOLE
+    // the hole reads back as zeros through the mapping and frees the space on the host
+    if (fallocate(bs->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, block_id * BLOCK_SIZE_BYTES, count * BLOCK_SIZE_BYTES) == 0) {
+        if (bs->changed) {
+            // already on the host, but a delta snapshot has to carry the zeros
+            for (size_t i = block_id; i < block_id + count; ++i) {
+                bs->changed[i] = bs->generation;
+            }
+        }
+        return true;
+    }
+#endif
+    memset(bs->data_blocks + block_id * BLOCK_SIZE_BYTES, 0x00, count * BLOCK_SIZE_BYTES);
+    block_store_mark_dirty(bs, block_id, count);
+    return true;
+}
+
+bool block_store_lock(block_store_t *const bs, const size_t block_id, const size_t count) {
+    if (bs == NULL || count == 0 || block_id >= BLOCK_STORE_NUM_BLOCKS || count > BLOCK_STORE_NUM_BLOCKS - block_id) {
+        return false;
+    }
+    return mlock(bs->data_blocks + block_id * BLOCK_SIZE_BYTES, count * BLOCK_SIZE_BYTES) == 0;
+}
+
+bool block_store_advise(block_store_t *const bs, const size_t block_id, const size_t count, const int advice) {
+    if (bs == NULL || count == 0 || block_id >= BLOCK_STORE_NUM_BLOCKS || count > BLOCK_STORE_NUM_BLOCKS - block_id) {
+        return false;
+    }
+    // madvise works on whole pages, widen the range to the pages covering it
+    const uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t) (bs->data_blocks + block_id * BLOCK_SIZE_BYTES);
+    uintptr_t end = start + count * BLOCK_SIZE_BYTES;
+    start &= ~(page - 1);
+    return posix_madvise((void *) start, end - start, advice) == 0;
+}
+
 bitmap_t* block_store_get_bm(block_store_t* const bs) {
     if (bs) {
         return bs->fbm;
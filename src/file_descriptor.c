@@ -8,20 +8,15 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 #include "block_store.h"
+#include "block_store_inline.h"
 #include "bitmap.h"
 #include <file_descriptor.h>
 
 #define NUM_FD 256
 #define SIZE_FD 6
 
-struct block_store {
-    int fd;
-    uint8_t *data_blocks;
-    bitmap_t *fbm;
-};
-
 block_store_t *fd_table_create() {
-    block_store_t* bs = (block_store_t*)malloc(sizeof(block_store_t));
+    block_store_t* bs = (block_store_t*)calloc(1, sizeof(block_store_t));
     if (!bs) {
         return NULL;
     }
@@ -9,18 +9,14 @@
 #include <sys/types.h>
 #include <stdio.h>
 #include "block_store.h"
+#include "block_store_inline.h"
 #include "bitmap.h"
 #include "inode.h"
 
-struct block_store {
-    int fd;
-    uint8_t *data_blocks;
-    bitmap_t *fbm;
-};
 
 
 block_store_t *inode_table_create(void *const bitmap_buffer, void *const block_buffer) {
-    block_store_t* bs = (block_store_t*)malloc(sizeof(block_store_t));
+    block_store_t* bs = (block_store_t*)calloc(1, sizeof(block_store_t));
     if (!bs) {
         return NULL;
     }
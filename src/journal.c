@@ -0,0 +1,415 @@
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "block_store.h"
+#include "journal.h"
+
+#define BLOCK_STORE_NUM_BLOCKS 65536   // 2^16 blocks.
+#define BLOCK_SIZE_BYTES 1024         // 2^10 BYTES per block
+
+#define JOURNAL_MAGIC 0x4a393146	// "F19J"
+#define TX_MAGIC 0x54393146		// "F19T"
+#define TX_OPEN 1
+#define TX_COMMITTED 2
+#define TX_MAX_BLOCKS 496		// what fits in the header block next to the fixed fields
+
+// first block of the journal
+typedef struct journalHeader {
+    uint32_t magic;
+    uint32_t count;
+    uint64_t baseSeq;		// sequence number of the transaction at block 1, older ones are stale
+} journalHeader_t;
+
+// first block of a transaction, followed by a before-image and an after-image per block
+typedef struct txHeader {
+    uint32_t magic;
+    uint32_t state;
+    uint64_t seq;
+    uint64_t undo;			// before-images durable so far (high half) and their checksum over seq,
+    				//  block ids and images (low half), stored at once so a page flushed
+    				//  while it changes never pairs a count with another count's checksum
+    uint32_t count;
+    uint32_t checksum;		// over seq, count, blocks and the after-images
+    uint16_t blocks[TX_MAX_BLOCKS];
+} txHeader_t;
+
+// a header bigger than its block fails the build (negative array size)
+typedef char tx_header_fits[sizeof(txHeader_t) <= BLOCK_SIZE_BYTES ? 1 : -1];
+
+struct journal {
+    block_store_t *bs;
+    uint8_t *base;			// start of the device mapping
+    size_t start;
+    size_t count;
+    size_t head;			// journal block the next transaction starts at
+    uint64_t seq;			// sequence number of the next transaction
+
+    // running transaction, owned by the thread holding tx_mutex from its outermost begin to its end
+    pthread_mutex_t tx_mutex;	// recursive, nested begins of the owner join its transaction
+    pthread_t owner;
+    unsigned depth;
+    txHeader_t *tx;			// NULL until the transaction touches its first block
+    bool overflow;			// the transaction outgrew the journal and will be checkpointed
+    size_t last;			// block touched last, the common repeat is skipped without a search
+
+    // group commit
+    pthread_mutex_t mutex;
+    pthread_cond_t flushed;
+    bool flushing;
+    uint64_t committed;		// every transaction below this sequence number is committed
+    uint64_t durable;		// ... and below this one also synced
+};
+
+static inline uint8_t *journal_block(const journal_t *const journal, const size_t offset) {
+    return journal->base + (journal->start + offset) * BLOCK_SIZE_BYTES;
+}
+
+static inline uint8_t *home_block(const journal_t *const journal, const size_t block_id) {
+    return journal->base + block_id * BLOCK_SIZE_BYTES;
+}
+
+// the journal writes through the mapping, the block store still has to know for syncs and snapshots
+static inline void journal_changed(const journal_t *const journal, const size_t offset, const size_t count) {
+    block_store_mark_dirty(journal->bs, journal->start + offset, count);
+}
+
+// FNV-1a
+static uint32_t checksum(uint32_t hash, const void *const data, const size_t size) {
+    const uint8_t *bytes = (const uint8_t *) data;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// the undo checksum grows one before-image at a time, in journal order
+static uint32_t undo_checksum(uint32_t hash, const uint16_t block_id, const uint8_t *const image) {
+    hash = checksum(hash, &block_id, sizeof(block_id));
+    return checksum(hash, image, BLOCK_SIZE_BYTES);
+}
+
+static inline uint64_t pack_undo(const size_t count, const uint32_t hash) {
+    return (uint64_t) count << 32 | hash;
+}
+
+// put the blocks of a transaction back from its before-images, false if they are not all intact
+static bool roll_back(journal_t *const journal, const txHeader_t *const tx, const size_t offset) {
+    const uint64_t undo = __atomic_load_n(&tx->undo, __ATOMIC_ACQUIRE);
+    const size_t count = (size_t) (undo >> 32);
+    if (count > TX_MAX_BLOCKS || offset + 1 + 2 * count > journal->count) {
+        return false;
+    }
+    uint32_t hash = checksum(2166136261u, &tx->seq, sizeof(tx->seq));
+    for (size_t i = 0; i < count; ++i) {
+        hash = undo_checksum(hash, tx->blocks[i], journal_block(journal, offset + 1 + 2 * i));
+    }
+    if (hash != (uint32_t) undo) {
+        return false;
+    }
+    for (size_t i = count; i-- > 0;) {
+        memcpy(home_block(journal, tx->blocks[i]), journal_block(journal, offset + 1 + 2 * i), BLOCK_SIZE_BYTES);
+        block_store_mark_dirty(journal->bs, tx->blocks[i], 1);
+    }
+    return true;
+}
+
+static uint32_t tx_checksum(const journal_t *const journal, const txHeader_t *const tx, const size_t offset) {
+    uint32_t hash = 2166136261u;
+    hash = checksum(hash, &tx->seq, sizeof(tx->seq));
+    hash = checksum(hash, &tx->count, sizeof(tx->count));
+    hash = checksum(hash, tx->blocks, tx->count * sizeof(uint16_t));
+    for (size_t i = 0; i < tx->count; ++i) {
+        hash = checksum(hash, journal_block(journal, offset + 2 + 2 * i), BLOCK_SIZE_BYTES);
+    }
+    return hash;
+}
+
+// start the journal over, with a sequence number no stale transaction in it carries
+static void reset(journal_t *const journal) {
+    journal->seq++;
+    journal->head = 1;
+    journalHeader_t *header = (journalHeader_t *) journal_block(journal, 0);
+    header->magic = JOURNAL_MAGIC;
+    header->count = journal->count;
+    header->baseSeq = journal->seq;
+    memset(journal_block(journal, 1), 0x00, sizeof(txHeader_t));
+    journal_changed(journal, 0, 2);
+    journal->committed = journal->seq;
+    journal->durable = journal->seq;
+}
+
+static journal_t *journal_init(block_store_t *const bs, const size_t start, const size_t count) {
+    if (bs == NULL || count < 3 || start >= BLOCK_STORE_NUM_BLOCKS || count > BLOCK_STORE_NUM_BLOCKS - start) {
+        return NULL;
+    }
+    journal_t *journal = (journal_t *) calloc(1, sizeof(journal_t));
+    if (journal) {
+        journal->bs = bs;
+        journal->base = block_store_get_data(bs);
+        journal->start = start;
+        journal->count = count;
+        journal->head = 1;
+        journal->last = SIZE_MAX;
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&journal->tx_mutex, &attr);
+        pthread_mutexattr_destroy(&attr);
+        pthread_mutex_init(&journal->mutex, NULL);
+        pthread_cond_init(&journal->flushed, NULL);
+    }
+    return journal;
+}
+
+static void journal_free(journal_t *const journal) {
+    pthread_cond_destroy(&journal->flushed);
+    pthread_mutex_destroy(&journal->mutex);
+    pthread_mutex_destroy(&journal->tx_mutex);
+    free(journal);
+}
+
+journal_t *journal_create(block_store_t *const bs, const size_t start, const size_t count) {
+    journal_t *journal = journal_init(bs, start, count);
+    if (journal) {
+        reset(journal);
+        block_store_sync_range(bs, start, 2);
+    }
+    return journal;
+}
+
+journal_t *journal_open(block_store_t *const bs, const size_t start, const size_t count) {
+    journal_t *journal = journal_init(bs, start, count);
+    if (journal) {
+        const journalHeader_t *header = (const journalHeader_t *) journal_block(journal, 0);
+        if (header->magic != JOURNAL_MAGIC || header->count != count) {
+            journal_free(journal);
+            return NULL;
+        }
+        journal->seq = header->baseSeq;
+        journal->committed = journal->seq;
+        journal->durable = journal->seq;
+    }
+    return journal;
+}
+
+int journal_replay(journal_t *const journal) {
+    if (journal == NULL || journal->depth != 0) {
+        return -1;
+    }
+    const journalHeader_t *header = (const journalHeader_t *) journal_block(journal, 0);
+    uint64_t expect = header->baseSeq;
+    size_t offset = 1;
+    int applied = 0;
+    while (offset + 1 <= journal->count) {
+        const txHeader_t *tx = (const txHeader_t *) journal_block(journal, offset);
+        if (tx->magic != TX_MAGIC || tx->seq != expect || tx->count > TX_MAX_BLOCKS
+            || offset + 1 + 2 * tx->count > journal->count) {
+            break;
+        }
+        if (tx->state == TX_COMMITTED && tx->checksum == tx_checksum(journal, tx, offset)) {
+            // roll forward
+            for (size_t i = 0; i < tx->count; ++i) {
+                memcpy(home_block(journal, tx->blocks[i]), journal_block(journal, offset + 2 + 2 * i), BLOCK_SIZE_BYTES);
+                block_store_mark_dirty(journal->bs, tx->blocks[i], 1);
+            }
+            ++applied;
+            ++expect;
+            offset += 1 + 2 * tx->count;
+            continue;
+        }
+        // the process died inside this transaction, or before all of its after-images reached the
+        //  file: put its blocks back the way they were
+        if (tx->state == TX_OPEN || tx->state == TX_COMMITTED) {
+            if (!roll_back(journal, tx, offset)) {
+                // before-images that can't be trusted are not applied, the volume needs a look
+                return -3;
+            }
+            ++applied;
+        }
+        break;
+    }
+    journal->seq = expect;
+    return journal_checkpoint(journal) == 0 ? applied : -2;
+}
+
+void journal_begin(journal_t *const journal) {
+    if (journal == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&journal->tx_mutex);
+    if (journal->depth == 0) {
+        // the owner is in place before the depth tells other threads a transaction runs
+        journal->owner = pthread_self();
+        journal->tx = NULL;
+        journal->overflow = false;
+        journal->last = SIZE_MAX;
+        // keep a quarter of the journal free so a transaction rarely outgrows it
+        if (journal->count - journal->head < journal->count / 4) {
+            journal_checkpoint(journal);
+        }
+    }
+    __atomic_store_n(&journal->depth, journal->depth + 1, __ATOMIC_RELEASE);
+}
+
+// the transaction can't hold another block: its header no longer names a state replay may act on,
+//  so it is voided and everything changed so far written back before the next change goes ahead
+static void overflow(journal_t *const journal) {
+    if (journal->tx) {
+        journal->tx->magic = 0;
+        journal_changed(journal, journal->head, 1);
+        journal->tx = NULL;
+    }
+    journal->overflow = true;
+    journal_checkpoint(journal);
+}
+
+void journal_touch(journal_t *const journal, const size_t block_id) {
+    // only the thread running the transaction journals, anyone else changes blocks outside of it
+    if (journal == NULL || __atomic_load_n(&journal->depth, __ATOMIC_ACQUIRE) == 0
+        || !pthread_equal(journal->owner, pthread_self()) || journal->overflow
+        || block_id == journal->last || block_id >= BLOCK_STORE_NUM_BLOCKS) {
+        return;
+    }
+    if (block_id >= journal->start && block_id < journal->start + journal->count) {
+        return;
+    }
+    txHeader_t *tx = journal->tx;
+    if (tx) {
+        for (size_t i = 0; i < tx->count; ++i) {
+            if (tx->blocks[i] == block_id) {
+                journal->last = block_id;
+                return;
+            }
+        }
+    } else {
+        if (journal->head + 3 > journal->count) {
+            // nothing journaled yet, a checkpoint makes room for the whole transaction
+            journal_checkpoint(journal);
+        }
+        // only the newest transaction in the file may be torn, the ones before it are made durable
+        //  before it records anything
+        journal_sync(journal);
+        tx = (txHeader_t *) journal_block(journal, journal->head);
+        tx->count = 0;
+        tx->seq = journal->seq;
+        tx->undo = pack_undo(0, checksum(2166136261u, &tx->seq, sizeof(tx->seq)));
+        tx->state = TX_OPEN;
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        tx->magic = TX_MAGIC;
+        journal->tx = tx;
+    }
+    const size_t n = tx->count;
+    if (n == TX_MAX_BLOCKS || journal->head + 1 + 2 * (n + 1) > journal->count) {
+        overflow(journal);
+        return;
+    }
+    // journal and home blocks share one mapping and the kernel writes its pages back in any order:
+    //  the before-image reaches the file first, then the header naming it, and only then may the
+    //  caller change the block
+    uint8_t *image = journal_block(journal, journal->head + 1 + 2 * n);
+    memcpy(image, home_block(journal, block_id), BLOCK_SIZE_BYTES);
+    journal_changed(journal, journal->head + 1 + 2 * n, 1);
+    block_store_sync_range(journal->bs, journal->start + journal->head + 1 + 2 * n, 1);
+    tx->blocks[n] = block_id;
+    const uint32_t hash = undo_checksum((uint32_t) tx->undo, (uint16_t) block_id, image);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    tx->count = n + 1;
+    __atomic_store_n(&tx->undo, pack_undo(n + 1, hash), __ATOMIC_RELEASE);
+    journal_changed(journal, journal->head, 1);
+    block_store_sync_range(journal->bs, journal->start + journal->head, 1);
+    journal->last = block_id;
+}
+
+// the outermost end: copy the after-images next to the before-images and seal the transaction
+static void commit(journal_t *const journal) {
+    txHeader_t *tx = journal->tx;
+    journal->tx = NULL;
+    if (journal->overflow) {
+        // written back when it overflowed, what changed since goes the same way
+        journal_checkpoint(journal);
+        return;
+    }
+    if (tx == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < tx->count; ++i) {
+        memcpy(journal_block(journal, journal->head + 2 + 2 * i), home_block(journal, tx->blocks[i]), BLOCK_SIZE_BYTES);
+    }
+    tx->checksum = tx_checksum(journal, tx, journal->head);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    tx->state = TX_COMMITTED;
+    journal_changed(journal, journal->head, 1 + 2 * tx->count);
+
+    pthread_mutex_lock(&journal->mutex);
+    journal->head += 1 + 2 * tx->count;
+    journal->seq++;
+    journal->committed = journal->seq;
+    pthread_mutex_unlock(&journal->mutex);
+}
+
+void journal_end(journal_t *const journal) {
+    if (journal == NULL || journal->depth == 0 || !pthread_equal(journal->owner, pthread_self())) {
+        return;
+    }
+    if (journal->depth == 1) {
+        commit(journal);
+    }
+    __atomic_store_n(&journal->depth, journal->depth - 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&journal->tx_mutex);
+}
+
+int journal_sync(journal_t *const journal) {
+    if (journal == NULL) {
+        return -1;
+    }
+    pthread_mutex_lock(&journal->mutex);
+    const uint64_t target = journal->committed;
+    while (journal->durable < target) {
+        if (journal->flushing) {
+            // someone else's flush is running, it may already cover us
+            pthread_cond_wait(&journal->flushed, &journal->mutex);
+            continue;
+        }
+        journal->flushing = true;
+        const uint64_t covered = journal->committed;
+        pthread_mutex_unlock(&journal->mutex);
+        const bool synced = block_store_sync_range(journal->bs, journal->start, journal->count);
+        pthread_mutex_lock(&journal->mutex);
+        journal->flushing = false;
+        if (synced && covered > journal->durable) {
+            journal->durable = covered;
+        }
+        pthread_cond_broadcast(&journal->flushed);
+        if (!synced) {
+            pthread_mutex_unlock(&journal->mutex);
+            return -2;
+        }
+    }
+    pthread_mutex_unlock(&journal->mutex);
+    return 0;
+}
+
+int journal_checkpoint(journal_t *const journal) {
+    if (journal == NULL) {
+        return -1;
+    }
+    pthread_mutex_lock(&journal->mutex);
+    while (journal->flushing) {
+        pthread_cond_wait(&journal->flushed, &journal->mutex);
+    }
+    // every change the journal holds reaches its home before the journal forgets it
+    bool synced = block_store_sync_range(journal->bs, 0, BLOCK_STORE_NUM_BLOCKS);
+    if (synced) {
+        reset(journal);
+        synced = block_store_sync_range(journal->bs, journal->start, 2);
+    }
+    pthread_mutex_unlock(&journal->mutex);
+    return synced ? 0 : -2;
+}
+
+void journal_close(journal_t *const journal) {
+    if (journal) {
+        journal_checkpoint(journal);
+        journal_free(journal);
+    }
+}
@@ -2,11 +2,17 @@
 #include <iostream>
 #include <new>
 #include <vector>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
 using std::vector;
 using std::string;
 #include <gtest/gtest.h>
 extern "C" {
 #include "F19FS.h"
+#include "bitmap.h"
 }
 
 unsigned int score;
@@ -643,7 +649,7 @@ TEST(e_tests, remove_file) {
 				"more/bad_req",
 			"/folder/withfilethatiswayyyyytoolongwhydoyoumakefilesthataretoobigEXACT!", "/", "/mystery_file"};
 	vector<const char *> a_fnames{"/file_a", "/file_b", "/file_c", "/file_d"};
-	const char *(test_fname[2]) = {"e_tests_a.F19FS", "e_tests_b.F19FS"};
+	const char *test_fname[2] = {"e_tests_a.F19FS", "e_tests_b.F19FS"};
 	ASSERT_EQ(system("cp d_tests_full.F19FS e_tests_a.F19FS"), 0);
 	ASSERT_EQ(system("cp c_tests.F19FS e_tests_b.F19FS"), 0);
 	F19FS *fs = fs_mount(test_fname[1]);
@@ -1091,6 +1097,1465 @@ TEST(j_tests, link) {
 	score += 20;
 }
 
+/*
+   int fs_submit(F19FS *fs, const fs_request_t *requests, size_t count);
+   int fs_poll_completions(F19FS *fs, fs_completion_t *completions, size_t max, size_t min_complete);
+   1. Normal, batch of creates
+   2. Normal, batch of writes to different descriptors, read back synchronously
+   3. Normal, batch of reads
+   4. Normal, batch of removes
+   5. Normal, poll with nothing outstanding
+   6. Error, NULL fs
+ */
+TEST(k_tests, async_queue) {
+	const char *test_fname = "k_tests.F19FS";
+	F19FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	const size_t n = 8;
+	char names[n][16];
+	fs_request_t requests[n];
+	fs_completion_t completions[n];
+	uint8_t data[n][1500];
+	uint8_t back[1500];
+	int fds[n];
+
+	// FS_SUBMIT 1
+	for (size_t i = 0; i < n; ++i) {
+		snprintf(names[i], sizeof(names[i]), "/shard_%zu", i);
+		requests[i] = fs_request_t{FS_OP_CREATE, -1, nullptr, 0, names[i], FS_REGULAR, i};
+	}
+	ASSERT_EQ(fs_submit(fs, requests, n), (int) n);
+	ASSERT_EQ(fs_poll_completions(fs, completions, n, n), (int) n);
+	for (size_t i = 0; i < n; ++i) {
+		ASSERT_EQ(completions[i].result, 0);
+	}
+
+	// FS_SUBMIT 2
+	for (size_t i = 0; i < n; ++i) {
+		fds[i] = fs_open(fs, names[i]);
+		ASSERT_GE(fds[i], 0);
+		memset(data[i], 0x10 + i, sizeof(data[i]));
+		requests[i] = fs_request_t{FS_OP_WRITE, fds[i], data[i], sizeof(data[i]), nullptr, FS_REGULAR, i};
+	}
+	ASSERT_EQ(fs_submit(fs, requests, n), (int) n);
+	size_t reaped = 0;
+	while (reaped < n) {
+		int got = fs_poll_completions(fs, completions + reaped, n - reaped, 1);
+		ASSERT_GT(got, 0);
+		reaped += got;
+	}
+	for (size_t i = 0; i < n; ++i) {
+		ASSERT_EQ(completions[i].result, (ssize_t) sizeof(data[i]));
+	}
+
+	// FS_SUBMIT 3
+	for (size_t i = 0; i < n; ++i) {
+		ASSERT_EQ(fs_seek(fs, fds[i], 0, FS_SEEK_SET), 0);
+		requests[i] = fs_request_t{FS_OP_READ, fds[i], data[i], sizeof(data[i]), nullptr, FS_REGULAR, i};
+	}
+	memset(data, 0, sizeof(data));
+	ASSERT_EQ(fs_submit(fs, requests, n), (int) n);
+	ASSERT_EQ(fs_poll_completions(fs, completions, n, n), (int) n);
+	for (size_t i = 0; i < n; ++i) {
+		ASSERT_EQ(completions[i].result, (ssize_t) sizeof(back));
+		memset(back, 0x10 + completions[i].user_data, sizeof(back));
+		ASSERT_EQ(memcmp(data[completions[i].user_data], back, sizeof(back)), 0);
+		ASSERT_EQ(fs_close(fs, fds[i]), 0);
+	}
+
+	// FS_SUBMIT 4
+	for (size_t i = 0; i < n; ++i) {
+		requests[i] = fs_request_t{FS_OP_REMOVE, -1, nullptr, 0, names[i], FS_REGULAR, i};
+	}
+	ASSERT_EQ(fs_submit(fs, requests, n), (int) n);
+	ASSERT_EQ(fs_poll_completions(fs, completions, n, n), (int) n);
+	for (size_t i = 0; i < n; ++i) {
+		ASSERT_EQ(completions[i].result, 0);
+	}
+	ASSERT_LT(fs_open(fs, names[0]), 0);
+
+	// FS_SUBMIT 5
+	ASSERT_EQ(fs_poll_completions(fs, completions, n, n), 0);
+
+	// FS_SUBMIT 6
+	ASSERT_LT(fs_submit(NULL, requests, n), 0);
+	ASSERT_LT(fs_poll_completions(NULL, completions, n, 1), 0);
+	fs_unmount(fs);
+}
+
+/*
+   int fs_create_many(F19FS *fs, const char *dir, const char *const *names, size_t count, file_t type, int *results);
+   int fs_remove_many(F19FS *fs, const char *dir, const char *const *names, size_t count, int *results);
+   1. Normal, files in root
+   2. Normal, directories in a subdirectory, then files inside them
+   3. Error, duplicate and invalid names are reported per name
+   4. Error, directory full
+   5. Normal, remove a batch, non-empty directory is refused
+   6. Error, missing directory, NULL fs
+ */
+TEST(l_tests, batch_create_remove) {
+	const char *test_fname = "l_tests.F19FS";
+	F19FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	const char *files[] = {"shard_0", "shard_1", "shard_2", "shard_3"};
+	const char *dirs[] = {"ckpt_a", "ckpt_b"};
+	int results[40];
+
+	// BATCH 1
+	ASSERT_EQ(fs_create_many(fs, "/", files, 4, FS_REGULAR, results), 4);
+	for (int i = 0; i < 4; ++i) {
+		ASSERT_EQ(results[i], 0);
+		char path[16];
+		snprintf(path, sizeof(path), "/%s", files[i]);
+		int fd = fs_open(fs, path);
+		ASSERT_GE(fd, 0);
+		ASSERT_EQ(fs_close(fs, fd), 0);
+	}
+
+	// BATCH 2
+	ASSERT_EQ(fs_create(fs, "/ckpt", FS_DIRECTORY), 0);
+	ASSERT_EQ(fs_create_many(fs, "/ckpt", dirs, 2, FS_DIRECTORY, results), 2);
+	ASSERT_EQ(fs_create_many(fs, "/ckpt/ckpt_b", files, 4, FS_REGULAR, NULL), 4);
+	dyn_array_t *listing = fs_get_dir(fs, "/ckpt/ckpt_b");
+	ASSERT_NE(listing, nullptr);
+	ASSERT_EQ(dyn_array_size(listing), 4);
+	ASSERT_TRUE(find_in_directory(listing, "shard_3"));
+	dyn_array_destroy(listing);
+	// paths relative to the batch directory go to their own parent
+	const char *relative[] = {"ckpt_b/extra", "fresh_b", "missing/extra", "/ckpt_b/abs"};
+	ASSERT_EQ(fs_create_many(fs, "/ckpt", relative, 4, FS_REGULAR, results), 2);
+	ASSERT_EQ(results[0], 0);
+	ASSERT_EQ(results[1], 0);
+	ASSERT_LT(results[2], 0);
+	ASSERT_LT(results[3], 0);
+	int fd = fs_open(fs, "/ckpt/ckpt_b/extra");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	ASSERT_EQ(fs_remove_many(fs, "/ckpt", relative, 2, results), 2);
+	ASSERT_LT(fs_open(fs, "/ckpt/ckpt_b/extra"), 0);
+
+	// BATCH 3
+	const char *mixed[] = {"shard_0", "fresh", "bad*name", "fresh"};
+	ASSERT_EQ(fs_create_many(fs, "/", mixed, 4, FS_REGULAR, results), 1);
+	ASSERT_LT(results[0], 0);
+	ASSERT_EQ(results[1], 0);
+	ASSERT_LT(results[2], 0);
+	ASSERT_LT(results[3], 0);
+
+	// BATCH 4
+	char many[40][8];
+	const char *many_names[40];
+	for (int i = 0; i < 40; ++i) {
+		snprintf(many[i], sizeof(many[i]), "f%d", i);
+		many_names[i] = many[i];
+	}
+	ASSERT_EQ(fs_create_many(fs, "/ckpt/ckpt_a", many_names, 40, FS_REGULAR, results), 31);
+	ASSERT_EQ(results[30], 0);
+	ASSERT_LT(results[31], 0);
+
+	// BATCH 5
+	ASSERT_EQ(fs_remove_many(fs, "/ckpt/ckpt_a", many_names, 40, results), 31);
+	ASSERT_LT(results[35], 0);
+	const char *both[] = {"ckpt_a", "ckpt_b"};
+	ASSERT_EQ(fs_remove_many(fs, "/ckpt", both, 2, results), 1);
+	ASSERT_EQ(results[0], 0);
+	ASSERT_LT(results[1], 0);
+	ASSERT_EQ(fs_remove_many(fs, "/", files, 4, NULL), 4);
+	ASSERT_LT(fs_open(fs, "/shard_0"), 0);
+	// the freed slot is reused without clobbering the remaining entries
+	ASSERT_EQ(fs_create(fs, "/shard_0", FS_REGULAR), 0);
+	listing = fs_get_dir(fs, "/");
+	ASSERT_NE(listing, nullptr);
+	ASSERT_TRUE(find_in_directory(listing, "ckpt"));
+	ASSERT_TRUE(find_in_directory(listing, "fresh"));
+	ASSERT_TRUE(find_in_directory(listing, "shard_0"));
+	ASSERT_EQ(dyn_array_size(listing), 3);
+	dyn_array_destroy(listing);
+
+	// BATCH 6
+	ASSERT_LT(fs_create_many(fs, "/nope", files, 4, FS_REGULAR, NULL), 0);
+	ASSERT_LT(fs_remove_many(fs, "/nope", files, 4, NULL), 0);
+	ASSERT_LT(fs_create_many(NULL, "/", files, 4, FS_REGULAR, NULL), 0);
+	fs_unmount(fs);
+}
+
+TEST(m_tests, write_back_cache) {
+	const char *test_fname = "m_tests.F19FS";
+	F19FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	uint8_t pattern[1024 * 3];
+	uint8_t readback[1024 * 3];
+	for (size_t i = 0; i < sizeof(pattern); ++i) {
+		pattern[i] = (uint8_t)(i * 7);
+	}
+
+	// CACHE 1
+	ASSERT_EQ(fs_create(fs, "/staged", FS_REGULAR), 0);
+	int fd = fs_open(fs, "/staged");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_set_buffered(fs, fd, true), 0);
+	ASSERT_EQ(fs_write(fs, fd, pattern, 1500), 1500);
+	ASSERT_EQ(fs_write(fs, fd, pattern + 1500, sizeof(pattern) - 1500), (ssize_t)(sizeof(pattern) - 1500));
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_END), (off_t)sizeof(pattern));
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, fd, readback, sizeof(readback)), (ssize_t)sizeof(readback));
+	ASSERT_EQ(memcmp(pattern, readback, sizeof(pattern)), 0);
+
+	// CACHE 2
+	// overwriting inside the file keeps its size
+	ASSERT_EQ(fs_seek(fs, fd, 100, FS_SEEK_SET), 100);
+	ASSERT_EQ(fs_write(fs, fd, pattern, 10), 10);
+	ASSERT_EQ(fs_fsync(fs, fd), 0);
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_END), (off_t)sizeof(pattern));
+	memcpy(pattern + 100, pattern, 10);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	fs_unmount(fs);
+
+	// CACHE 3
+	fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	fd = fs_open(fs, "/staged");
+	ASSERT_GE(fd, 0);
+	memset(readback, 0, sizeof(readback));
+	ASSERT_EQ(fs_read(fs, fd, readback, sizeof(readback)), (ssize_t)sizeof(readback));
+	ASSERT_EQ(memcmp(pattern, readback, sizeof(pattern)), 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+
+	// CACHE 4
+	// a file removed before writeback never takes blocks
+	ASSERT_EQ(fs_create(fs, "/scratch", FS_REGULAR), 0);
+	fd = fs_open(fs, "/scratch");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_set_buffered(fs, fd, true), 0);
+	ASSERT_EQ(fs_write(fs, fd, pattern, sizeof(pattern)), (ssize_t)sizeof(pattern));
+	ASSERT_EQ(fs_remove(fs, "/scratch"), 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	ASSERT_LT(fs_set_buffered(fs, 300, true), 0);
+
+	// CACHE 5
+	// a write-through filling the volume leaves the blocks promised to staged pages alone
+	ASSERT_EQ(fs_create(fs, "/promised", FS_REGULAR), 0);
+	fd = fs_open(fs, "/promised");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_set_buffered(fs, fd, true), 0);
+	ASSERT_EQ(fs_write(fs, fd, pattern, sizeof(pattern)), (ssize_t)sizeof(pattern));
+	ASSERT_EQ(fs_create(fs, "/filler", FS_REGULAR), 0);
+	int filler = fs_open(fs, "/filler");
+	ASSERT_GE(filler, 0);
+	std::vector<uint8_t> chunk(64 * 1024, 0x5a);
+	size_t rounds = 0;
+	while (fs_write(fs, filler, chunk.data(), chunk.size()) == (ssize_t)chunk.size()) {
+		ASSERT_LT(++rounds, 1024u);
+	}
+	ASSERT_EQ(fs_fsync(fs, fd), 0);
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_SET), 0);
+	memset(readback, 0, sizeof(readback));
+	ASSERT_EQ(fs_read(fs, fd, readback, sizeof(readback)), (ssize_t)sizeof(readback));
+	ASSERT_EQ(memcmp(pattern, readback, sizeof(pattern)), 0);
+	ASSERT_EQ(fs_close(fs, filler), 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	fs_unmount(fs);
+}
+
+TEST(n_tests, advise_read_ahead) {
+	const char *test_fname = "n_tests.F19FS";
+	F19FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	const size_t file_size = 1024 * 300;
+	uint8_t *pattern = new uint8_t[file_size];
+	uint8_t *readback = new uint8_t[file_size];
+	for (size_t i = 0; i < file_size; ++i) {
+		pattern[i] = (uint8_t)(i * 13 + i / 1024);
+	}
+	ASSERT_EQ(fs_create(fs, "/stream", FS_REGULAR), 0);
+	int fd = fs_open(fs, "/stream");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_write(fs, fd, pattern, file_size), (ssize_t)file_size);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	fs_unmount(fs);
+
+	// ADVISE 1
+	// sequential reads across the direct, indirect and double indirect blocks
+	fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	fd = fs_open(fs, "/stream");
+	ASSERT_GE(fd, 0);
+	for (size_t done = 0; done < file_size; done += 1000) {
+		size_t chunk = file_size - done < 1000 ? file_size - done : 1000;
+		ASSERT_EQ(fs_read(fs, fd, readback + done, chunk), (ssize_t)chunk);
+	}
+	ASSERT_EQ(memcmp(pattern, readback, file_size), 0);
+
+	// ADVISE 2
+	ASSERT_EQ(fs_advise(fs, fd, 0, 0, FS_ADV_RANDOM), 0);
+	ASSERT_EQ(fs_seek(fs, fd, 1024 * 200 + 5, FS_SEEK_SET), 1024 * 200 + 5);
+	ASSERT_EQ(fs_read(fs, fd, readback, 3000), 3000);
+	ASSERT_EQ(memcmp(pattern + 1024 * 200 + 5, readback, 3000), 0);
+	ASSERT_EQ(fs_advise(fs, fd, 1024 * 10, 1024 * 50, FS_ADV_WILLNEED), 0);
+	ASSERT_EQ(fs_advise(fs, fd, 0, 0, FS_ADV_SEQUENTIAL), 0);
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, fd, readback, file_size), (ssize_t)file_size);
+	ASSERT_EQ(memcmp(pattern, readback, file_size), 0);
+	ASSERT_EQ(fs_advise(fs, fd, file_size * 2, 10, FS_ADV_DONTNEED), 0);
+	ASSERT_EQ(fs_advise(fs, fd, 0, 0, FS_ADV_NORMAL), 0);
+
+	// ADVISE 3
+	ASSERT_LT(fs_advise(fs, fd, -1, 0, FS_ADV_NORMAL), 0);
+	ASSERT_LT(fs_advise(fs, fd + 1, 0, 0, FS_ADV_NORMAL), 0);
+	ASSERT_LT(fs_advise(NULL, fd, 0, 0, FS_ADV_NORMAL), 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	ASSERT_LT(fs_advise(fs, fd, 0, 0, FS_ADV_NORMAL), 0);
+	fs_unmount(fs);
+	delete[] pattern;
+	delete[] readback;
+}
+
+TEST(o_tests, mount_options) {
+	const char *test_fname = "o_tests.F19FS";
+	F19FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_create(fs, "/meta", FS_DIRECTORY), 0);
+	ASSERT_EQ(fs_create(fs, "/meta/data", FS_REGULAR), 0);
+	fs_unmount(fs);
+
+	// MOUNT 1
+	fs = fs_mount_ex(test_fname, FS_MOUNT_POPULATE | FS_MOUNT_HUGEPAGE | FS_MOUNT_MLOCK_META);
+	ASSERT_NE(fs, nullptr);
+	int fd = fs_open(fs, "/meta/data");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_write(fs, fd, test_fname, 14), 14);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	ASSERT_EQ(fs_create(fs, "/meta/sub", FS_DIRECTORY), 0);
+	ASSERT_EQ(fs_create(fs, "/meta/sub/leaf", FS_REGULAR), 0);
+	fs_unmount(fs);
+
+	// MOUNT 2
+	fs = fs_mount_ex(test_fname, 0);
+	ASSERT_NE(fs, nullptr);
+	char buffer[14];
+	fd = fs_open(fs, "/meta/data");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_read(fs, fd, buffer, 14), 14);
+	ASSERT_EQ(memcmp(buffer, test_fname, 14), 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	ASSERT_GE(fs_open(fs, "/meta/sub/leaf"), 0);
+	fs_unmount(fs);
+
+	// MOUNT 3
+	ASSERT_EQ(fs_mount_ex("o_tests.missing", FS_MOUNT_POPULATE), nullptr);
+	ASSERT_EQ(fs_mount_ex(NULL, 0), nullptr);
+}
+
+TEST(p_tests, fast_format) {
+	const char *test_fname = "p_tests.F19FS";
+	F19FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	fs_unmount(fs);
+
+	// FORMAT 1
+	// nothing but the metadata is written, the rest of the 64 MiB stays a hole
+	struct stat image;
+	ASSERT_EQ(stat(test_fname, &image), 0);
+	ASSERT_EQ(image.st_size, 1024 * 65536);
+	ASSERT_LT(image.st_blocks * 512, 1024 * 1024);
+
+	// FORMAT 2
+	fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	char junk[2048];
+	memset(junk, 0x5a, sizeof(junk));
+	for (int i = 0; i < 20; ++i) {
+		char path[16];
+		snprintf(path, sizeof(path), "/old_%d", i);
+		ASSERT_EQ(fs_create(fs, path, FS_REGULAR), 0);
+		int fd = fs_open(fs, path);
+		ASSERT_GE(fd, 0);
+		ASSERT_EQ(fs_write(fs, fd, junk, sizeof(junk)), (ssize_t)sizeof(junk));
+		ASSERT_EQ(fs_close(fs, fd), 0);
+	}
+	fs_unmount(fs);
+
+	// FORMAT 3
+	fs = fs_format_ex(test_fname, FS_FORMAT_IN_PLACE);
+	ASSERT_NE(fs, nullptr);
+	dyn_array_t *listing = fs_get_dir(fs, "/");
+	ASSERT_NE(listing, nullptr);
+	ASSERT_EQ(dyn_array_size(listing), 0);
+	dyn_array_destroy(listing);
+	ASSERT_LT(fs_open(fs, "/old_0"), 0);
+	for (int i = 0; i < 20; ++i) {
+		char path[16];
+		snprintf(path, sizeof(path), "/new_%d", i);
+		ASSERT_EQ(fs_create(fs, path, FS_REGULAR), 0);
+	}
+	int fd = fs_open(fs, "/new_19");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_END), 0);
+	ASSERT_EQ(fs_read(fs, fd, junk, sizeof(junk)), 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	fs_unmount(fs);
+
+	// FORMAT 4
+	fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_GE(fs_open(fs, "/new_7"), 0);
+	fs_unmount(fs);
+	ASSERT_EQ(fs_format_ex(NULL, FS_FORMAT_IN_PLACE), nullptr);
+}
+
+TEST(q_tests, clean_and_crash_mount) {
+	const char *test_fname = "q_tests.F19FS";
+	F19FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_create(fs, "/kept", FS_REGULAR), 0);
+	fs_unmount(fs);
+
+	// MOUNT 1
+	// the child dies without fs_unmount, the next mount has to rebuild its counters
+	pid_t child = fork();
+	ASSERT_GE(child, 0);
+	if (child == 0) {
+		F19FS *crashed = fs_mount(test_fname);
+		if (!crashed || fs_create(crashed, "/during_crash", FS_REGULAR) != 0) {
+			_exit(1);
+		}
+		int fd = fs_open(crashed, "/during_crash");
+		_exit(fd >= 0 && fs_write(crashed, fd, "crash", 5) == 5 ? 0 : 1);
+	}
+	int status = 0;
+	ASSERT_EQ(waitpid(child, &status, 0), child);
+	ASSERT_TRUE(WIFEXITED(status));
+	ASSERT_EQ(WEXITSTATUS(status), 0);
+
+	fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	char buffer[5];
+	int fd = fs_open(fs, "/during_crash");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_read(fs, fd, buffer, 5), 5);
+	ASSERT_EQ(memcmp(buffer, "crash", 5), 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	ASSERT_EQ(fs_create(fs, "/after_crash", FS_REGULAR), 0);
+	fs_unmount(fs);
+
+	// MOUNT 2
+	fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_GE(fs_open(fs, "/kept"), 0);
+	ASSERT_GE(fs_open(fs, "/after_crash"), 0);
+	fs_unmount(fs);
+
+	// MOUNT 3
+	// a superblock describing another geometry (block count at offset 512 + 8) is refused
+	int image = open(test_fname, O_RDWR);
+	ASSERT_GE(image, 0);
+	uint32_t block_count = 12345;
+	ASSERT_EQ(pwrite(image, &block_count, sizeof(block_count), 512 + 8), (ssize_t)sizeof(block_count));
+	close(image);
+	ASSERT_EQ(fs_mount(test_fname), nullptr);
+}
+
+TEST(r_tests, journal_recovery) {
+	const char *test_fname = "r_tests.F19FS";
+	F19FS *fs = fs_format_ex(test_fname, FS_FORMAT_JOURNAL);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_create(fs, "/logs", FS_DIRECTORY), 0);
+	ASSERT_EQ(fs_create(fs, "/logs/a", FS_REGULAR), 0);
+	int fd = fs_open(fs, "/logs/a");
+	ASSERT_GE(fd, 0);
+	char payload[3000];
+	memset(payload, 'j', sizeof(payload));
+	ASSERT_EQ(fs_write(fs, fd, payload, sizeof(payload)), (ssize_t)sizeof(payload));
+	ASSERT_EQ(fs_fsync(fs, fd), 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	fs_unmount(fs);
+
+	// JOURNAL 1
+	// committed operations of a process that never unmounted are rolled forward
+	pid_t child = fork();
+	ASSERT_GE(child, 0);
+	if (child == 0) {
+		F19FS *crashed = fs_mount(test_fname);
+		bool ok = crashed && fs_create(crashed, "/logs/b", FS_REGULAR) == 0 && fs_remove(crashed, "/logs/a") == 0;
+		_exit(ok ? 0 : 1);
+	}
+	int status = 0;
+	ASSERT_EQ(waitpid(child, &status, 0), child);
+	ASSERT_TRUE(WIFEXITED(status));
+	ASSERT_EQ(WEXITSTATUS(status), 0);
+	fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_LT(fs_open(fs, "/logs/a"), 0);
+	ASSERT_GE(fs_open(fs, "/logs/b"), 0);
+	fs_unmount(fs);
+
+	// JOURNAL 2
+	// killed at an arbitrary point, the volume comes back consistent
+	child = fork();
+	ASSERT_GE(child, 0);
+	if (child == 0) {
+		F19FS *busy = fs_mount(test_fname);
+		for (unsigned i = 0; busy; ++i) {
+			char path[32];
+			snprintf(path, sizeof(path), "/logs/f%u", i % 24);
+			if (fs_create(busy, path, FS_REGULAR) == 0) {
+				int busy_fd = fs_open(busy, path);
+				fs_write(busy, busy_fd, payload, sizeof(payload));
+				fs_close(busy, busy_fd);
+			} else {
+				fs_remove(busy, path);
+			}
+		}
+		_exit(1);
+	}
+	usleep(200000);
+	ASSERT_EQ(kill(child, SIGKILL), 0);
+	ASSERT_EQ(waitpid(child, &status, 0), child);
+
+	fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	dyn_array_t *listing = fs_get_dir(fs, "/logs");
+	ASSERT_NE(listing, nullptr);
+	for (size_t i = 0; i < dyn_array_size(listing); ++i) {
+		file_record_t *record = (file_record_t *)dyn_array_at(listing, i);
+		char path[48];
+		snprintf(path, sizeof(path), "/logs/%s", record->name);
+		fd = fs_open(fs, path);
+		ASSERT_GE(fd, 0);
+		off_t size = fs_seek(fs, fd, 0, FS_SEEK_END);
+		ASSERT_TRUE(size == 0 || size == (off_t)sizeof(payload));
+		ASSERT_EQ(fs_close(fs, fd), 0);
+		ASSERT_EQ(fs_remove(fs, path), 0);
+	}
+	dyn_array_destroy(listing);
+	// every block and inode the dead process held is reusable
+	for (int i = 0; i < 24; ++i) {
+		char path[32];
+		snprintf(path, sizeof(path), "/logs/g%d", i);
+		ASSERT_EQ(fs_create(fs, path, FS_REGULAR), 0);
+	}
+	fs_unmount(fs);
+}
+
+TEST(s_tests, fsync_and_sync) {
+	const char *test_fname = "s_tests.F19FS";
+	F19FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_create(fs, "/one", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/two", FS_REGULAR), 0);
+	ASSERT_EQ(fs_sync(fs), 0);
+	fs_unmount(fs);
+
+	// MOUNT 1
+	// buffered writes only survive the killed child because of fs_fsync and fs_sync
+	static uint8_t data[8 * 1024];
+	for (size_t i = 0; i < sizeof(data); i++) {
+		data[i] = (uint8_t)(i * 7 + 3);
+	}
+	pid_t child = fork();
+	ASSERT_GE(child, 0);
+	if (child == 0) {
+		F19FS *crashed = fs_mount(test_fname);
+		int one = crashed ? fs_open(crashed, "/one") : -1;
+		int two = crashed ? fs_open(crashed, "/two") : -1;
+		if (one < 0 || two < 0 || fs_set_buffered(crashed, one, true) != 0 || fs_set_buffered(crashed, two, true) != 0) {
+			_exit(1);
+		}
+		if (fs_write(crashed, one, data, sizeof(data)) != (ssize_t)sizeof(data) || fs_fsync(crashed, one) != 0) {
+			_exit(1);
+		}
+		if (fs_write(crashed, two, data, 2048) != 2048 || fs_sync(crashed) != 0) {
+			_exit(1);
+		}
+		raise(SIGKILL);
+	}
+	int status = 0;
+	ASSERT_EQ(waitpid(child, &status, 0), child);
+	ASSERT_TRUE(WIFSIGNALED(status));
+
+	fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	static uint8_t buffer[8 * 1024];
+	int fd = fs_open(fs, "/one");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_read(fs, fd, buffer, sizeof(buffer)), (ssize_t)sizeof(buffer));
+	ASSERT_EQ(memcmp(buffer, data, sizeof(data)), 0);
+	ASSERT_EQ(fs_fsync(fs, fd), 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	fd = fs_open(fs, "/two");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_read(fs, fd, buffer, sizeof(buffer)), 2048);
+	ASSERT_EQ(memcmp(buffer, data, 2048), 0);
+
+	// bad arguments
+	ASSERT_LT(fs_fsync(NULL, fd), 0);
+	ASSERT_LT(fs_fsync(fs, -1), 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	ASSERT_LT(fs_fsync(fs, fd), 0);
+	ASSERT_LT(fs_sync(NULL), 0);
+	fs_unmount(fs);
+}
+
+TEST(t_tests, sparse_and_delta_snapshot) {
+	const char *test_fname = "t_tests.F19FS";
+	const char *full_fname = "t_tests.full";
+	const char *delta_fname = "t_tests.delta";
+	F19FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_create(fs, "/big", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/small", FS_REGULAR), 0);
+	static uint8_t data[64 * 1024];
+	memset(data, 0x5a, sizeof(data));
+	int big = fs_open(fs, "/big");
+	ASSERT_GE(big, 0);
+	ASSERT_EQ(fs_write(fs, big, data, sizeof(data)), (ssize_t)sizeof(data));
+
+	// a full snapshot of a nearly empty 64 MiB volume holds only what is in use
+	int out = open(full_fname, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	ASSERT_GE(out, 0);
+	uint64_t generation = 0;
+	ssize_t full = fs_snapshot(fs, out, 0, &generation);
+	close(out);
+	ASSERT_GT(full, (ssize_t)sizeof(data));
+	ASSERT_LT(full, 256 * 1024);
+	ASSERT_NE(generation, 0u);
+	struct stat info;
+	ASSERT_EQ(stat(full_fname, &info), 0);
+	ASSERT_EQ(info.st_size, full);
+
+	// the delta carries the small write and the metadata it touched, not the big file
+	int small = fs_open(fs, "/small");
+	ASSERT_GE(small, 0);
+	ASSERT_EQ(fs_write(fs, small, "delta", 5), 5);
+	out = open(delta_fname, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	ASSERT_GE(out, 0);
+	uint64_t next = 0;
+	ssize_t delta = fs_snapshot(fs, out, generation, &next);
+	ASSERT_GT(delta, 0);
+	ASSERT_LT(delta, 64 * 1024);
+	ASSERT_NE(next, generation);
+
+	// nothing changed since, only the header and the block bitmap
+	ssize_t empty = fs_snapshot(fs, out, next, NULL);
+	ASSERT_GT(empty, 0);
+	ASSERT_LT(empty, delta);
+
+	// unknown generations
+	ASSERT_LT(fs_snapshot(fs, out, next + 100, NULL), 0);
+	ASSERT_LT(fs_snapshot(fs, out, 12345, NULL), 0);
+	ASSERT_LT(fs_snapshot(NULL, out, 0, NULL), 0);
+	ASSERT_LT(fs_snapshot(fs, -1, 0, NULL), 0);
+	close(out);
+	fs_unmount(fs);
+}
+
+TEST(u_tests, restore_image_and_snapshots) {
+	const char *test_fname = "u_tests.F19FS";
+	const char *copy_fname = "u_tests_copy.F19FS";
+	const char *full_fname = "u_tests.full";
+	const char *delta_fname = "u_tests.delta";
+	F19FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_create(fs, "/first", FS_REGULAR), 0);
+	int fd = fs_open(fs, "/first");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_write(fs, fd, "golden", 6), 6);
+	int out = open(full_fname, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	ASSERT_GE(out, 0);
+	uint64_t generation = 0;
+	ASSERT_GT(fs_snapshot(fs, out, 0, &generation), 0);
+	close(out);
+	ASSERT_EQ(fs_create(fs, "/second", FS_REGULAR), 0);
+	fd = fs_open(fs, "/second");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_write(fs, fd, "later", 5), 5);
+	out = open(delta_fname, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	ASSERT_GE(out, 0);
+	ASSERT_GT(fs_snapshot(fs, out, generation, NULL), 0);
+	close(out);
+	fs_unmount(fs);
+
+	// MOUNT 1
+	// the full snapshot brings back the first file only
+	char buffer[6];
+	fs = fs_restore(full_fname, copy_fname);
+	ASSERT_NE(fs, nullptr);
+	fd = fs_open(fs, "/first");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_read(fs, fd, buffer, 6), 6);
+	ASSERT_EQ(memcmp(buffer, "golden", 6), 0);
+	ASSERT_LT(fs_open(fs, "/second"), 0);
+	fs_unmount(fs);
+
+	// MOUNT 2
+	// the delta goes on top of it
+	fs = fs_restore(delta_fname, copy_fname);
+	ASSERT_NE(fs, nullptr);
+	fd = fs_open(fs, "/second");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_read(fs, fd, buffer, 5), 5);
+	ASSERT_EQ(memcmp(buffer, "later", 5), 0);
+	ASSERT_GE(fs_open(fs, "/first"), 0);
+	ASSERT_EQ(fs_create(fs, "/third", FS_REGULAR), 0);
+	fs_unmount(fs);
+
+	// MOUNT 3
+	// a whole image is cloned
+	fs = fs_restore(copy_fname, test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_GE(fs_open(fs, "/first"), 0);
+	ASSERT_GE(fs_open(fs, "/second"), 0);
+	ASSERT_GE(fs_open(fs, "/third"), 0);
+	fs_unmount(fs);
+
+	// a delta only goes on top of the snapshot it was taken against
+	ASSERT_EQ(fs_restore(delta_fname, copy_fname), nullptr);
+	fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	fs_unmount(fs);
+	ASSERT_EQ(fs_restore(delta_fname, test_fname), nullptr);
+
+	ASSERT_EQ(fs_restore("u_tests.missing", copy_fname), nullptr);
+	ASSERT_EQ(fs_restore(full_fname, NULL), nullptr);
+}
+
+TEST(v_tests, sparse_files) {
+	const char *test_fname = "v_tests.F19FS";
+	F19FS *fs = fs_format_ex(test_fname, FS_FORMAT_SPARSE);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_create(fs, "/index", FS_REGULAR), 0);
+	int fd = fs_open(fs, "/index");
+	ASSERT_GE(fd, 0);
+
+	// a header, a 4 MiB hole, a tail record in the double indirect range
+	ASSERT_EQ(fs_write(fs, fd, "head", 4), 4);
+	const off_t tail = 4 * 1024 * 1024 + 100;
+	ASSERT_EQ(fs_seek(fs, fd, tail, FS_SEEK_SET), tail);
+	ASSERT_EQ(fs_write(fs, fd, "tail", 4), 4);
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_END), tail + 4);
+	fs_unmount(fs);
+
+	// MOUNT 1
+	fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	fd = fs_open(fs, "/index");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_HOLE), 1024);
+	ASSERT_EQ(fs_seek(fs, fd, 1024, FS_SEEK_DATA), tail / 1024 * 1024);
+	ASSERT_EQ(fs_seek(fs, fd, tail, FS_SEEK_HOLE), tail + 4);
+	ASSERT_LT(fs_seek(fs, fd, tail + 4, FS_SEEK_DATA), 0);
+
+	// holes read back as zeros
+	static uint8_t buffer[8 * 1024];
+	static uint8_t zeros[8 * 1024];
+	ASSERT_EQ(fs_seek(fs, fd, 2 * 1024 * 1024 - 100, FS_SEEK_SET), 2 * 1024 * 1024 - 100);
+	ASSERT_EQ(fs_read(fs, fd, buffer, sizeof(buffer)), (ssize_t)sizeof(buffer));
+	ASSERT_EQ(memcmp(buffer, zeros, sizeof(buffer)), 0);
+	ASSERT_EQ(fs_seek(fs, fd, tail - 96, FS_SEEK_SET), tail - 96);
+	ASSERT_EQ(fs_read(fs, fd, buffer, 200), 100);
+	ASSERT_EQ(memcmp(buffer, zeros, 96), 0);
+	ASSERT_EQ(memcmp(buffer + 96, "tail", 4), 0);
+
+	// a buffered write into the hole is data before and after it reaches the device
+	ASSERT_EQ(fs_set_buffered(fs, fd, true), 0);
+	ASSERT_EQ(fs_seek(fs, fd, 10 * 1024 + 5, FS_SEEK_SET), 10 * 1024 + 5);
+	ASSERT_EQ(fs_write(fs, fd, "mid", 3), 3);
+	ASSERT_EQ(fs_seek(fs, fd, 1024, FS_SEEK_DATA), 10 * 1024);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	fd = fs_open(fs, "/index");
+	ASSERT_EQ(fs_seek(fs, fd, 1024, FS_SEEK_DATA), 10 * 1024);
+	ASSERT_EQ(fs_seek(fs, fd, 10 * 1024, FS_SEEK_HOLE), 11 * 1024);
+	ASSERT_EQ(fs_seek(fs, fd, 10 * 1024, FS_SEEK_SET), 10 * 1024);
+	ASSERT_EQ(fs_read(fs, fd, buffer, 8), 8);
+	ASSERT_EQ(memcmp(buffer, "\0\0\0\0\0mid", 8), 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	fs_unmount(fs);
+
+	// without the feature seeks still stop at EOF
+	fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_create(fs, "/dense", FS_REGULAR), 0);
+	fd = fs_open(fs, "/dense");
+	ASSERT_EQ(fs_write(fs, fd, "dense", 5), 5);
+	ASSERT_EQ(fs_seek(fs, fd, 1000, FS_SEEK_SET), 5);
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_DATA), 0);
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_HOLE), 5);
+	fs_unmount(fs);
+}
+
+TEST(w_tests, truncate_and_fallocate) {
+	const char *test_fname = "w_tests.F19FS";
+	F19FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_create(fs, "/log", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/dir", FS_DIRECTORY), 0);
+	int fd = fs_open(fs, "/log");
+	ASSERT_GE(fd, 0);
+	static uint8_t data[300 * 1024];
+	for (size_t i = 0; i < sizeof(data); i++) {
+		data[i] = (uint8_t)(i % 251 + 1);
+	}
+	ASSERT_EQ(fs_write(fs, fd, data, sizeof(data)), (ssize_t)sizeof(data));
+
+	// shrink into the direct blocks, then grow back over a hole
+	ASSERT_EQ(fs_ftruncate(fs, fd, 2500), 0);
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_END), 2500);
+	ASSERT_EQ(fs_truncate(fs, "/log", 4000), 0);
+	static uint8_t buffer[4096];
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, fd, buffer, sizeof(buffer)), 4000);
+	ASSERT_EQ(memcmp(buffer, data, 2500), 0);
+	for (size_t i = 2500; i < 4000; i++) {
+		ASSERT_EQ(buffer[i], 0);
+	}
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_HOLE), 3 * 1024);
+
+	// preallocate almost the whole volume, the next request finds nothing and takes nothing
+	ASSERT_EQ(fs_fallocate(fs, fd, 0, 60 * 1024 * 1024), 0);
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_END), 60 * 1024 * 1024);
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_HOLE), 60 * 1024 * 1024);
+	ASSERT_EQ(fs_seek(fs, fd, 3000, FS_SEEK_SET), 3000);
+	ASSERT_EQ(fs_read(fs, fd, buffer, 1000), 1000);
+	for (size_t i = 0; i < 1000; i++) {
+		ASSERT_EQ(buffer[i], 0);
+	}
+	ASSERT_EQ(fs_create(fs, "/next", FS_REGULAR), 0);
+	int next = fs_open(fs, "/next");
+	ASSERT_GE(next, 0);
+	ASSERT_EQ(fs_fallocate(fs, next, 0, 8 * 1024 * 1024), -5);
+	ASSERT_EQ(fs_seek(fs, next, 0, FS_SEEK_END), 0);
+
+	// releasing the big file gives the space back
+	ASSERT_EQ(fs_ftruncate(fs, fd, 0), 0);
+	ASSERT_EQ(fs_fallocate(fs, next, 0, 8 * 1024 * 1024), 0);
+	ASSERT_EQ(fs_write(fs, next, data, 1024), 1024);
+	ASSERT_EQ(fs_close(fs, next), 0);
+
+	// leave room for the data of a range spanning three second level pointer blocks but not for all
+	// four pointer blocks, the call fails part way and must hand back what it linked
+	fs_statfs_t usage;
+	ASSERT_EQ(fs_statfs(fs, &usage), 0);
+	ASSERT_EQ(fs_fallocate(fs, fd, 0, (off_t)((usage.free_blocks - 1200) / 513 * 512) * 1024), 0);
+	off_t filled = fs_seek(fs, fd, 0, FS_SEEK_END);
+	ASSERT_EQ(fs_statfs(fs, &usage), 0);
+	while (usage.free_blocks > 1008) {
+		ASSERT_EQ(fs_fallocate(fs, fd, filled, 1024), 0);
+		filled += 1024;
+		ASSERT_EQ(fs_statfs(fs, &usage), 0);
+	}
+	for (int pad = 0; usage.free_blocks > 1003; pad++) {
+		char name[32];
+		snprintf(name, sizeof(name), "/dir/pad%d", pad);
+		ASSERT_EQ(fs_create(fs, name, FS_REGULAR), 0);
+		int padFd = fs_open(fs, name);
+		ASSERT_EQ(fs_write(fs, padFd, data, 1024), 1024);
+		ASSERT_EQ(fs_close(fs, padFd), 0);
+		ASSERT_EQ(fs_statfs(fs, &usage), 0);
+	}
+	ASSERT_EQ(fs_create(fs, "/sparse", FS_REGULAR), 0);
+	int sparse = fs_open(fs, "/sparse");
+	ASSERT_GE(sparse, 0);
+	ASSERT_EQ(fs_fallocate(fs, sparse, (6 + 512 + 300) * 1024, 1000 * 1024), -5);
+	ASSERT_EQ(fs_statfs(fs, &usage), 0);
+	fs_stat_t sparseStat;
+	ASSERT_EQ(fs_fstat(fs, sparse, &sparseStat), 0);
+	ASSERT_EQ(usage.free_blocks, (size_t)1003);
+	ASSERT_EQ(sparseStat.size, (size_t)0);
+	ASSERT_EQ(sparseStat.blocks, (size_t)0);
+	ASSERT_EQ(fs_fallocate(fs, sparse, (6 + 512) * 1024, 1000 * 1024), 0);
+	ASSERT_EQ(fs_close(fs, sparse), 0);
+	fs_unmount(fs);
+
+	// MOUNT 1
+	fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	fd = fs_open(fs, "/next");
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_END), 8 * 1024 * 1024);
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, fd, buffer, 1024), 1024);
+	ASSERT_EQ(memcmp(buffer, data, 1024), 0);
+
+	// bad arguments
+	ASSERT_LT(fs_ftruncate(NULL, fd, 0), 0);
+	ASSERT_LT(fs_ftruncate(fs, fd, -1), 0);
+	ASSERT_LT(fs_truncate(fs, "/dir", 0), 0);
+	ASSERT_LT(fs_truncate(fs, "/missing", 0), 0);
+	ASSERT_LT(fs_fallocate(fs, fd, 0, 0), 0);
+	ASSERT_LT(fs_fallocate(fs, fd, -1, 10), 0);
+	ASSERT_LT(fs_fallocate(fs, 200, 0, 10), 0);
+	fs_unmount(fs);
+}
+
+TEST(x_tests, bitmap_ranges) {
+	bitmap_t *bitmap = bitmap_create(1000);
+	ASSERT_NE(bitmap, nullptr);
+
+	// inside one byte, across a byte boundary, across whole words
+	bitmap_set_range(bitmap, 2, 3);
+	ASSERT_EQ(bitmap_count_range(bitmap, 0, 8), 3u);
+	ASSERT_FALSE(bitmap_test(bitmap, 1));
+	ASSERT_TRUE(bitmap_test(bitmap, 4));
+	ASSERT_FALSE(bitmap_test(bitmap, 5));
+	bitmap_set_range(bitmap, 13, 300);
+	ASSERT_EQ(bitmap_total_set(bitmap), 303u);
+	ASSERT_FALSE(bitmap_test(bitmap, 12));
+	ASSERT_TRUE(bitmap_test(bitmap, 312));
+	ASSERT_FALSE(bitmap_test(bitmap, 313));
+	ASSERT_EQ(bitmap_count_range(bitmap, 10, 10), 7u);
+	ASSERT_EQ(bitmap_count_range(bitmap, 900, 500), 0u);
+	bitmap_reset_range(bitmap, 20, 200);
+	ASSERT_EQ(bitmap_count_range(bitmap, 0, 1000), 3u + 7u + 93u);
+	ASSERT_TRUE(bitmap_test(bitmap, 19));
+	ASSERT_FALSE(bitmap_test(bitmap, 20));
+	ASSERT_FALSE(bitmap_test(bitmap, 219));
+	ASSERT_TRUE(bitmap_test(bitmap, 220));
+	bitmap_set_range(bitmap, 0, 0);
+	ASSERT_EQ(bitmap_total_set(bitmap), 103u);
+
+	// runs of clear bits: the gaps are [0,2) [5,13) [20,220) [313,1000)
+	ASSERT_EQ(bitmap_find_zero_run(bitmap, 0, 2), 0u);
+	ASSERT_EQ(bitmap_find_zero_run(bitmap, 0, 3), 5u);
+	ASSERT_EQ(bitmap_find_zero_run(bitmap, 0, 9), 20u);
+	ASSERT_EQ(bitmap_find_zero_run(bitmap, 30, 190), 30u);
+	ASSERT_EQ(bitmap_find_zero_run(bitmap, 30, 191), 313u);
+	ASSERT_EQ(bitmap_find_zero_run(bitmap, 0, 687), 313u);
+	ASSERT_EQ(bitmap_find_zero_run(bitmap, 0, 688), SIZE_MAX);
+	ASSERT_EQ(bitmap_find_zero_run(bitmap, 999, 2), SIZE_MAX);
+	ASSERT_EQ(bitmap_find_zero_run(bitmap, 0, 0), SIZE_MAX);
+	ASSERT_EQ(bitmap_find_zero_run(NULL, 0, 1), SIZE_MAX);
+	bitmap_destroy(bitmap);
+}
+
+TEST(y_tests, tracked_total) {
+	// a tracked bitmap and an untracked twin take the same changes, their totals must agree
+	bitmap_t *tracked = bitmap_create(1003);
+	bitmap_t *counted = bitmap_create(1003);
+	ASSERT_NE(tracked, nullptr);
+	ASSERT_NE(counted, nullptr);
+	bitmap_set_range(tracked, 100, 50);
+	bitmap_set_range(counted, 100, 50);
+	bitmap_track_total(tracked, SIZE_MAX);
+	ASSERT_EQ(bitmap_total_set(tracked), 50u);
+
+	uint32_t seed = 19;
+	for (int i = 0; i < 2000; ++i) {
+		seed = seed * 1103515245u + 12345u;
+		size_t bit = (seed >> 8) % 1003;
+		size_t count = (seed >> 20) % 70;
+		if (count > 1003 - bit) {
+			count = 1003 - bit;
+		}
+		switch (seed % 6) {
+		case 0: bitmap_set(tracked, bit); bitmap_set(counted, bit); break;
+		case 1: bitmap_reset(tracked, bit); bitmap_reset(counted, bit); break;
+		case 2: bitmap_flip(tracked, bit); bitmap_flip(counted, bit); break;
+		case 3: bitmap_set_range(tracked, bit, count); bitmap_set_range(counted, bit, count); break;
+		case 4: bitmap_reset_range(tracked, bit, count); bitmap_reset_range(counted, bit, count); break;
+		default: bitmap_invert(tracked); bitmap_invert(counted); break;
+		}
+		ASSERT_EQ(bitmap_total_set(tracked), bitmap_total_set(counted));
+	}
+	bitmap_format(tracked, 0xFF);
+	ASSERT_EQ(bitmap_total_set(tracked), 1003u);
+	bitmap_format(tracked, 0x00);
+	ASSERT_EQ(bitmap_total_set(tracked), 0u);
+	bitmap_destroy(tracked);
+	bitmap_destroy(counted);
+}
+
+static void collect_bit(size_t bit, void *arg) {
+	((std::vector<size_t> *) arg)->push_back(bit);
+}
+
+TEST(z_tests, bitmap_next_set_and_zero) {
+	bitmap_t *bitmap = bitmap_create(1003);
+	ASSERT_NE(bitmap, nullptr);
+	ASSERT_EQ(bitmap_next_set(bitmap, 0), SIZE_MAX);
+	ASSERT_EQ(bitmap_ffs(bitmap), SIZE_MAX);
+	ASSERT_EQ(bitmap_next_zero(bitmap, 1002), 1002u);
+	ASSERT_EQ(bitmap_next_zero(bitmap, 1003), SIZE_MAX);
+
+	// hits at word edges, in the middle of a long empty stretch and in the last partial byte
+	const size_t bits[] = {0, 63, 64, 127, 500, 1001, 1002};
+	for (size_t bit : bits) {
+		bitmap_set(bitmap, bit);
+	}
+	size_t at = 0;
+	for (size_t bit : bits) {
+		at = bitmap_next_set(bitmap, at);
+		ASSERT_EQ(at, bit);
+		++at;
+	}
+	ASSERT_EQ(bitmap_next_set(bitmap, at), SIZE_MAX);
+	ASSERT_EQ(bitmap_next_set(bitmap, 128), 500u);
+	ASSERT_EQ(bitmap_next_set(bitmap, 5000), SIZE_MAX);
+	ASSERT_EQ(bitmap_ffs(bitmap), 0u);
+
+	std::vector<size_t> seen;
+	bitmap_for_each(bitmap, collect_bit, &seen);
+	ASSERT_EQ(seen, std::vector<size_t>(std::begin(bits), std::end(bits)));
+
+	// zeros: a full bitmap has none, gaps show up wherever they sit
+	bitmap_format(bitmap, 0xFF);
+	ASSERT_EQ(bitmap_ffz(bitmap), SIZE_MAX);
+	ASSERT_EQ(bitmap_next_zero(bitmap, 0), SIZE_MAX);
+	bitmap_reset(bitmap, 700);
+	bitmap_reset(bitmap, 1002);
+	ASSERT_EQ(bitmap_ffz(bitmap), 700u);
+	ASSERT_EQ(bitmap_next_zero(bitmap, 701), 1002u);
+	ASSERT_EQ(bitmap_next_set(bitmap, 700), 701u);
+	ASSERT_EQ(bitmap_next_zero(NULL, 0), SIZE_MAX);
+	bitmap_destroy(bitmap);
+}
+
+TEST(za_tests, bitmap_view) {
+	uint32_t word = 0x5;
+	bitmap_view_t view;
+	bitmap_t *bitmap = bitmap_view(&view, 31, &word);
+	ASSERT_NE(bitmap, nullptr);
+	ASSERT_EQ(bitmap_get_bits(bitmap), 31u);
+	ASSERT_EQ(bitmap_get_bytes(bitmap), 4u);
+	ASSERT_EQ(bitmap_total_set(bitmap), 2u);
+	ASSERT_EQ(bitmap_ffz(bitmap), 1u);
+	// changes land in the caller's memory, no copy in between
+	bitmap_set(bitmap, 30);
+	bitmap_reset(bitmap, 0);
+	ASSERT_EQ(word, 0x40000004u);
+	ASSERT_EQ(bitmap_next_set(bitmap, 3), 30u);
+	ASSERT_EQ(bitmap_view(&view, 0, &word), nullptr);
+	ASSERT_EQ(bitmap_view(&view, 31, NULL), nullptr);
+	ASSERT_EQ(bitmap_view(NULL, 31, &word), nullptr);
+}
+
+TEST(zb_tests, opendir_readdir_cookies) {
+	const char *test_fname = "zb_tests.F19FS";
+	F19FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_create(fs, "/dir", FS_DIRECTORY), 0);
+	const char *names[] = {"a", "b", "c", "d", "e"};
+	for (const char *name : names) {
+		ASSERT_EQ(fs_create_many(fs, "/dir", &name, 1, name[0] == 'c' ? FS_DIRECTORY : FS_REGULAR, NULL), 1);
+	}
+
+	// entries come out in slot order, regular files typed as such
+	fs_dir_t *dir = fs_opendir(fs, "/dir");
+	ASSERT_NE(dir, nullptr);
+	ASSERT_EQ(fs_telldir(dir), 0u);
+	file_record_t record;
+	ASSERT_EQ(fs_readdir(dir, &record), 1);
+	ASSERT_STREQ(record.name, "a");
+	ASSERT_EQ(record.type, FS_REGULAR);
+	ASSERT_EQ(fs_readdir(dir, &record), 1);
+	ASSERT_STREQ(record.name, "b");
+	uint64_t cookie = fs_telldir(dir);
+	fs_closedir(dir);
+
+	// resume on a new handle, an entry removed ahead of the cookie is skipped
+	ASSERT_EQ(fs_remove(fs, "/dir/d"), 0);
+	dir = fs_opendir(fs, "/dir");
+	ASSERT_NE(dir, nullptr);
+	ASSERT_EQ(fs_seekdir(dir, cookie), 0);
+	ASSERT_EQ(fs_readdir(dir, &record), 1);
+	ASSERT_STREQ(record.name, "c");
+	ASSERT_EQ(record.type, FS_DIRECTORY);
+	ASSERT_EQ(fs_readdir(dir, &record), 1);
+	ASSERT_STREQ(record.name, "e");
+	ASSERT_EQ(fs_readdir(dir, &record), 0);
+	ASSERT_EQ(fs_readdir(dir, &record), 0);
+	ASSERT_EQ(fs_seekdir(dir, 0), 0);
+	ASSERT_EQ(fs_readdir(dir, &record), 1);
+	ASSERT_STREQ(record.name, "a");
+	ASSERT_LT(fs_seekdir(dir, 1000), 0);
+	fs_closedir(dir);
+
+	// fs_get_dir lists the same entries front to back
+	dyn_array_t *records = fs_get_dir(fs, "/dir");
+	ASSERT_NE(records, nullptr);
+	ASSERT_EQ(dyn_array_size(records), 4u);
+	ASSERT_STREQ(((file_record_t *) dyn_array_at(records, 0))->name, "a");
+	ASSERT_STREQ(((file_record_t *) dyn_array_at(records, 3))->name, "e");
+	ASSERT_EQ(((file_record_t *) dyn_array_at(records, 3))->type, FS_REGULAR);
+	dyn_array_destroy(records);
+
+	// a directory removed and created again under the handle is not the one it lists
+	ASSERT_EQ(fs_create(fs, "/gone", FS_DIRECTORY), 0);
+	ASSERT_EQ(fs_create(fs, "/gone/x", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/gone/y", FS_REGULAR), 0);
+	dir = fs_opendir(fs, "/gone");
+	ASSERT_NE(dir, nullptr);
+	ASSERT_EQ(fs_readdir(dir, &record), 1);
+	ASSERT_STREQ(record.name, "x");
+	ASSERT_EQ(fs_remove(fs, "/gone/x"), 0);
+	ASSERT_EQ(fs_remove(fs, "/gone/y"), 0);
+	ASSERT_EQ(fs_remove(fs, "/gone"), 0);
+	ASSERT_EQ(fs_create(fs, "/gone", FS_DIRECTORY), 0);
+	ASSERT_EQ(fs_create(fs, "/gone/x", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/gone/z", FS_REGULAR), 0);
+	ASSERT_EQ(fs_readdir(dir, &record), -2);
+	fs_closedir(dir);
+
+	// the resolver takes paths as they are, no trailing slash or empty component
+	ASSERT_EQ(fs_opendir(fs, "/dir/"), nullptr);
+	ASSERT_EQ(fs_opendir(fs, "//dir"), nullptr);
+	ASSERT_EQ(fs_opendir(fs, "dir"), nullptr);
+	ASSERT_EQ(fs_opendir(fs, "/dir/a"), nullptr);
+	ASSERT_EQ(fs_opendir(fs, "/dir/missing"), nullptr);
+	ASSERT_EQ(fs_opendir(NULL, "/dir"), nullptr);
+	dir = fs_opendir(fs, "/dir/c");
+	ASSERT_NE(dir, nullptr);
+	ASSERT_EQ(fs_readdir(dir, &record), 0);
+	fs_closedir(dir);
+	fs_closedir(NULL);
+	fs_unmount(fs);
+}
+
+TEST(zc_tests, readdirplus_attributes) {
+	const char *test_fname = "zc_tests.F19FS";
+	F19FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_create(fs, "/d", FS_DIRECTORY), 0);
+	ASSERT_EQ(fs_create(fs, "/d/small", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/d/big", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/d/sub", FS_DIRECTORY), 0);
+	std::vector<uint8_t> data(8 * 1024, 0x5a);
+	int fd = fs_open(fs, "/d/small");
+	ASSERT_EQ(fs_write(fs, fd, data.data(), 3000), 3000);
+	fs_close(fs, fd);
+	fd = fs_open(fs, "/d/big");
+	ASSERT_EQ(fs_write(fs, fd, data.data(), 7 * 1024), 7 * 1024);
+	fs_close(fs, fd);
+	ASSERT_EQ(fs_link(fs, "/d/big", "/d/alias"), 0);
+
+	// one pass: names in slot order with size, links and blocks (pointer blocks included)
+	dyn_array_t *records = fs_get_dir_plus(fs, "/d");
+	ASSERT_NE(records, nullptr);
+	ASSERT_EQ(dyn_array_size(records), 4u);
+	file_record_plus_t *small = (file_record_plus_t *) dyn_array_at(records, 0);
+	file_record_plus_t *big = (file_record_plus_t *) dyn_array_at(records, 1);
+	file_record_plus_t *sub = (file_record_plus_t *) dyn_array_at(records, 2);
+	file_record_plus_t *alias = (file_record_plus_t *) dyn_array_at(records, 3);
+	ASSERT_STREQ(small->name, "small");
+	ASSERT_EQ(small->stat.type, FS_REGULAR);
+	ASSERT_EQ(small->stat.size, 3000u);
+	ASSERT_EQ(small->stat.links, 1u);
+	ASSERT_EQ(small->stat.blocks, 3u);
+	ASSERT_STREQ(big->name, "big");
+	ASSERT_EQ(big->stat.size, 7u * 1024);
+	ASSERT_EQ(big->stat.links, 2u);
+	ASSERT_EQ(big->stat.blocks, 8u);
+	ASSERT_STREQ(sub->name, "sub");
+	ASSERT_EQ(sub->stat.type, FS_DIRECTORY);
+	// a directory only gets its block with its first entry
+	ASSERT_EQ(sub->stat.blocks, 0u);
+	ASSERT_STREQ(alias->name, "alias");
+	ASSERT_EQ(alias->stat.inode, big->stat.inode);
+	ASSERT_EQ(alias->stat.blocks, 8u);
+	dyn_array_destroy(records);
+
+	// the handle form resumes like fs_readdir
+	fs_dir_t *dir = fs_opendir(fs, "/d");
+	ASSERT_NE(dir, nullptr);
+	ASSERT_EQ(fs_seekdir(dir, 2), 0);
+	file_record_plus_t record;
+	ASSERT_EQ(fs_readdirplus(dir, &record), 1);
+	ASSERT_STREQ(record.name, "sub");
+	ASSERT_EQ(fs_readdirplus(dir, &record), 1);
+	ASSERT_EQ(fs_readdirplus(dir, &record), 0);
+	ASSERT_LT(fs_readdirplus(dir, NULL), 0);
+	fs_closedir(dir);
+	ASSERT_EQ(fs_get_dir_plus(fs, "/d/small"), nullptr);
+	fs_unmount(fs);
+}
+
+TEST(zd_tests, stat_fstat_statfs) {
+	const char *test_fname = "zd_tests.F19FS";
+	F19FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	fs_statfs_t before;
+	ASSERT_EQ(fs_statfs(fs, &before), 0);
+	ASSERT_EQ(before.block_size, 1024u);
+	ASSERT_EQ(before.total_inodes, 256u);
+	ASSERT_EQ(before.free_inodes, 255u);
+	ASSERT_EQ(before.name_max, 31u);
+	ASSERT_LT(before.free_blocks, before.total_blocks);
+
+	ASSERT_EQ(fs_create(fs, "/log", FS_REGULAR), 0);
+	std::vector<uint8_t> data(5000, 0x11);
+	int fd = fs_open(fs, "/log");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_write(fs, fd, data.data(), 5000), 5000);
+
+	// by path and by descriptor, without moving the descriptor
+	fs_stat_t stat;
+	ASSERT_EQ(fs_stat(fs, "/log", &stat), 0);
+	ASSERT_EQ(stat.type, FS_REGULAR);
+	ASSERT_EQ(stat.size, 5000u);
+	ASSERT_EQ(stat.blocks, 5u);
+	ASSERT_EQ(stat.links, 1u);
+	fs_stat_t fstat;
+	ASSERT_EQ(fs_fstat(fs, fd, &fstat), 0);
+	ASSERT_EQ(fstat.inode, stat.inode);
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_CUR), 5000);
+	ASSERT_EQ(fs_stat(fs, "/", &stat), 0);
+	ASSERT_EQ(stat.type, FS_DIRECTORY);
+	ASSERT_EQ(stat.inode, 0u);
+
+	// write-back data counts towards the size before it has blocks
+	ASSERT_EQ(fs_set_buffered(fs, fd, true), 0);
+	ASSERT_EQ(fs_write(fs, fd, data.data(), 3000), 3000);
+	ASSERT_EQ(fs_fstat(fs, fd, &fstat), 0);
+	ASSERT_EQ(fstat.size, 8000u);
+
+	fs_statfs_t after;
+	ASSERT_EQ(fs_statfs(fs, &after), 0);
+	ASSERT_EQ(after.free_inodes, 254u);
+	ASSERT_LT(after.free_blocks, before.free_blocks - 5);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	ASSERT_EQ(fs_stat(fs, "/log", &stat), 0);
+	ASSERT_EQ(stat.size, 8000u);
+	// 8 data blocks, the last 2 behind the indirect block
+	ASSERT_EQ(stat.blocks, 9u);
+
+	ASSERT_LT(fs_stat(fs, "/missing", &stat), 0);
+	ASSERT_LT(fs_stat(fs, "/log/", &stat), 0);
+	ASSERT_LT(fs_stat(fs, "/log", NULL), 0);
+	ASSERT_LT(fs_fstat(fs, fd, &fstat), 0);
+	ASSERT_LT(fs_fstat(fs, 300, &fstat), 0);
+	ASSERT_LT(fs_statfs(NULL, &after), 0);
+	fs_unmount(fs);
+}
+
+TEST(ze_tests, handles) {
+	const char *test_fname = "ze_tests.F19FS";
+	F19FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_create(fs, "/dir", FS_DIRECTORY), 0);
+	ASSERT_EQ(fs_create(fs, "/dir/a", FS_REGULAR), 0);
+	int fd = fs_open(fs, "/dir/a");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_write(fs, fd, "handle", 6), 6);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+
+	fs_handle_t handle;
+	ASSERT_EQ(fs_get_handle(fs, "/dir/a", &handle), 0);
+	fs_stat_t stat;
+	ASSERT_EQ(fs_stat(fs, "/dir/a", &stat), 0);
+	ASSERT_EQ(handle.inode, stat.inode);
+	ASSERT_EQ(handle.generation, stat.generation);
+
+	// the handle follows the file to another name and across a remount
+	ASSERT_EQ(fs_link(fs, "/dir/a", "/b"), 0);
+	ASSERT_EQ(fs_remove(fs, "/dir/a"), 0);
+	ASSERT_EQ(fs_stat_by_handle(fs, &handle, &stat), 0);
+	ASSERT_EQ(stat.links, 1u);
+	ASSERT_EQ(fs_unmount(fs), 0);
+	fs = fs_mount(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_stat_by_handle(fs, &handle, &stat), 0);
+	ASSERT_EQ(stat.size, 6u);
+	fd = fs_open_by_handle(fs, &handle);
+	ASSERT_GE(fd, 0);
+	char buffer[6];
+	ASSERT_EQ(fs_read(fs, fd, buffer, 6), 6);
+	ASSERT_EQ(memcmp(buffer, "handle", 6), 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+
+	// a new file in the freed slot gets a new generation
+	ASSERT_EQ(fs_remove(fs, "/b"), 0);
+	ASSERT_EQ(fs_stat_by_handle(fs, &handle, &stat), -2);
+	ASSERT_EQ(fs_create(fs, "/c", FS_REGULAR), 0);
+	fs_handle_t reused;
+	ASSERT_EQ(fs_get_handle(fs, "/c", &reused), 0);
+	ASSERT_EQ(reused.inode, handle.inode);
+	ASSERT_NE(reused.generation, handle.generation);
+	ASSERT_EQ(fs_open_by_handle(fs, &handle), -2);
+	ASSERT_EQ(fs_stat_by_handle(fs, &handle, &stat), -2);
+	ASSERT_EQ(fs_stat_by_handle(fs, &reused, &stat), 0);
+	ASSERT_EQ(stat.size, 0u);
+
+	fs_handle_t dir;
+	ASSERT_EQ(fs_get_handle(fs, "/dir", &dir), 0);
+	ASSERT_LT(fs_open_by_handle(fs, &dir), 0);
+	fs_handle_t bogus = {300, 0};
+	ASSERT_LT(fs_stat_by_handle(fs, &bogus, &stat), 0);
+	ASSERT_LT(fs_get_handle(fs, "/missing", &reused), 0);
+	fs_unmount(fs);
+}
+
+TEST(zf_tests, openat_createat_removeat) {
+	const char *test_fname = "zf_tests.F19FS";
+	F19FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_create(fs, "/a", FS_DIRECTORY), 0);
+	ASSERT_EQ(fs_create(fs, "/a/b", FS_DIRECTORY), 0);
+	fs_dir_t *dir = fs_opendir(fs, "/a/b");
+	ASSERT_NE(dir, nullptr);
+
+	// names resolve from the open directory
+	ASSERT_EQ(fs_createat(dir, "file", FS_REGULAR), 0);
+	ASSERT_EQ(fs_createat(dir, "sub", FS_DIRECTORY), 0);
+	ASSERT_LT(fs_createat(dir, "file", FS_REGULAR), 0);
+	ASSERT_LT(fs_createat(dir, "sub/nested", FS_REGULAR), 0);
+	ASSERT_EQ(fs_create(fs, "/a/b/sub/nested", FS_REGULAR), 0);
+	int fd = fs_openat(dir, "file");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_write(fs, fd, "at", 2), 2);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	fd = fs_openat(dir, "sub/nested");
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	fs_stat_t stat;
+	ASSERT_EQ(fs_stat(fs, "/a/b/file", &stat), 0);
+	ASSERT_EQ(stat.size, 2u);
+	ASSERT_LT(fs_openat(dir, "sub"), 0);
+	ASSERT_LT(fs_openat(dir, "missing"), 0);
+	ASSERT_LT(fs_openat(dir, "/a/b/file"), 0);
+	ASSERT_LT(fs_openat(dir, "sub/"), 0);
+
+	// the listing sees entries made through the handle
+	file_record_t record;
+	int seen = 0;
+	while (fs_readdir(dir, &record) > 0) {
+		seen++;
+	}
+	ASSERT_EQ(seen, 2);
+
+	ASSERT_LT(fs_removeat(dir, "sub"), 0);
+	ASSERT_EQ(fs_remove(fs, "/a/b/sub/nested"), 0);
+	ASSERT_EQ(fs_removeat(dir, "sub"), 0);
+	ASSERT_EQ(fs_removeat(dir, "file"), 0);
+	ASSERT_LT(fs_removeat(dir, "file"), 0);
+	ASSERT_LT(fs_stat(fs, "/a/b/file", &stat), 0);
+
+	// a removed directory takes its handles with it, even once its inode is reused
+	ASSERT_EQ(fs_remove(fs, "/a/b"), 0);
+	ASSERT_EQ(fs_create(fs, "/a/c", FS_DIRECTORY), 0);
+	ASSERT_EQ(fs_openat(dir, "file"), -2);
+	ASSERT_LT(fs_createat(dir, "file", FS_REGULAR), 0);
+	ASSERT_LT(fs_removeat(dir, "file"), 0);
+	ASSERT_LT(fs_stat(fs, "/a/c/file", &stat), 0);
+	fs_closedir(dir);
+	fs_unmount(fs);
+}
+
+TEST(zg_tests, open2_flags) {
+	const char *test_fname = "zg_tests.F19FS";
+	F19FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	ASSERT_EQ(fs_create(fs, "/logs", FS_DIRECTORY), 0);
+
+	// create on open, exclusive create refuses an existing file
+	ASSERT_EQ(fs_open2(fs, "/logs/app", 0), -2);
+	int fd = fs_open2(fs, "/logs/app", FS_OPEN_CREATE | FS_OPEN_EXCL);
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_write(fs, fd, "0123456789", 10), 10);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+	ASSERT_EQ(fs_open2(fs, "/logs/app", FS_OPEN_CREATE | FS_OPEN_EXCL), -3);
+	ASSERT_LT(fs_create(fs, "/logs/app", FS_REGULAR), 0);
+
+	// appends land at the end whatever the position
+	fd = fs_open2(fs, "/logs/app", FS_OPEN_CREATE | FS_OPEN_APPEND);
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(fs_seek(fs, fd, 2, FS_SEEK_SET), 2);
+	ASSERT_EQ(fs_write(fs, fd, "ab", 2), 2);
+	ASSERT_EQ(fs_seek(fs, fd, 0, FS_SEEK_CUR), 12);
+	int other = fs_open(fs, "/logs/app");
+	ASSERT_GE(other, 0);
+	ASSERT_EQ(fs_seek(fs, other, 0, FS_SEEK_END), 12);
+	ASSERT_EQ(fs_write(fs, other, "cd", 2), 2);
+	ASSERT_EQ(fs_write(fs, fd, "ef", 2), 2);
+	char buffer[16];
+	ASSERT_EQ(fs_seek(fs, other, 0, FS_SEEK_SET), 0);
+	ASSERT_EQ(fs_read(fs, other, buffer, 16), 16);
+	ASSERT_EQ(memcmp(buffer, "0123456789abcdef", 16), 0);
+	ASSERT_EQ(fs_close(fs, other), 0);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+
+	// truncation drops the data and its blocks
+	fd = fs_open2(fs, "/logs/app", FS_OPEN_TRUNC);
+	ASSERT_GE(fd, 0);
+	fs_stat_t stat;
+	ASSERT_EQ(fs_fstat(fs, fd, &stat), 0);
+	ASSERT_EQ(stat.size, 0u);
+	ASSERT_EQ(stat.blocks, 0u);
+	ASSERT_EQ(fs_close(fs, fd), 0);
+
+	ASSERT_LT(fs_open2(fs, "/logs", FS_OPEN_CREATE), 0);
+	ASSERT_LT(fs_open2(fs, "/missing/app", FS_OPEN_CREATE), 0);
+	ASSERT_LT(fs_open2(fs, "/logs/", FS_OPEN_CREATE), 0);
+	ASSERT_LT(fs_open2(fs, "/logs/app", 0x100), 0);
+	ASSERT_LT(fs_open2(NULL, "/logs/app", 0), 0);
+	fs_unmount(fs);
+}
+
+TEST(zh_tests, concurrent_append) {
+	const char *test_fname = "zh_tests.F19FS";
+	F19FS *fs = fs_format(test_fname);
+	ASSERT_NE(fs, nullptr);
+	const size_t n = 256;
+	const size_t record = 300;
+	int fds[2];
+	for (size_t p = 0; p < 2; ++p) {
+		fds[p] = fs_open2(fs, "/log", FS_OPEN_CREATE | FS_OPEN_APPEND);
+		ASSERT_GE(fds[p], 0);
+	}
+	ASSERT_EQ(fs_write(fs, fds[0], "head", 4), 4);
+
+	// many producers on two descriptors, every record lands whole and none overlaps another
+	std::vector<uint8_t> data(n * record);
+	std::vector<fs_request_t> requests(n);
+	for (size_t i = 0; i < n; ++i) {
+		memset(&data[i * record], (int) i, record);
+		requests[i] = fs_request_t{FS_OP_WRITE, fds[i % 2], &data[i * record], record, nullptr, FS_REGULAR, i};
+	}
+	ASSERT_EQ(fs_submit(fs, requests.data(), n), (int) n);
+	// synchronous calls take the same volume lock and mix with the requests in flight
+	ASSERT_EQ(fs_sync(fs), 0);
+	ASSERT_EQ(fs_fsync(fs, fds[0]), 0);
+	std::vector<fs_completion_t> completions(n);
+	size_t reaped = 0;
+	while (reaped < n) {
+		int got = fs_poll_completions(fs, completions.data() + reaped, n - reaped, 1);
+		ASSERT_GT(got, 0);
+		reaped += got;
+	}
+	for (size_t i = 0; i < n; ++i) {
+		ASSERT_EQ(completions[i].result, (ssize_t) record);
+	}
+
+	fs_stat_t stat;
+	ASSERT_EQ(fs_fstat(fs, fds[1], &stat), 0);
+	ASSERT_EQ(stat.size, 4 + n * record);
+	int reader = fs_open(fs, "/log");
+	ASSERT_GE(reader, 0);
+	std::vector<uint8_t> back(4 + n * record);
+	ASSERT_EQ(fs_read(fs, reader, back.data(), back.size()), (ssize_t) back.size());
+	ASSERT_EQ(memcmp(back.data(), "head", 4), 0);
+	std::vector<bool> seen(n, false);
+	for (size_t r = 0; r < n; ++r) {
+		const uint8_t *at = &back[4 + r * record];
+		for (size_t b = 1; b < record; ++b) {
+			ASSERT_EQ(at[b], at[0]);
+		}
+		ASSERT_FALSE(seen[at[0]]);
+		seen[at[0]] = true;
+	}
+
+	// a descriptor without the flag keeps writing at its position
+	ASSERT_EQ(fs_seek(fs, reader, 0, FS_SEEK_SET), 0);
+	fs_request_t overwrite{FS_OP_WRITE, reader, (void *) "HEAD", 4, nullptr, FS_REGULAR, 0};
+	ASSERT_EQ(fs_submit(fs, &overwrite, 1), 1);
+	ASSERT_EQ(fs_poll_completions(fs, completions.data(), 1, 1), 1);
+	ASSERT_EQ(completions[0].result, 4);
+	ASSERT_EQ(fs_fstat(fs, reader, &stat), 0);
+	ASSERT_EQ(stat.size, 4 + n * record);
+	for (size_t p = 0; p < 2; ++p) {
+		ASSERT_EQ(fs_close(fs, fds[p]), 0);
+	}
+	ASSERT_EQ(fs_close(fs, reader), 0);
+	fs_unmount(fs);
+}
+
 int main(int argc, char **argv) {
 	::testing::InitGoogleTest(&argc, argv);
 	::testing::AddGlobalTestEnvironment(new GradeEnvironment);